@@ -0,0 +1,434 @@
+/* Micro benchmarks for the editor core: row insertion and editing, pasting,
+ * render and syntax update, open, save, search, replace, filter, multiple
+ * cursors and project search, over synthetic corpora from 1K to 10M lines.
+ *
+ * Usage: kilo-bench [--max-lines <n>] [--filter <substring>]
+ *
+ * Every benchmark prints the number of operations, the average time per
+ * operation and the heap bytes retained per operation (glibc only, 0
+ * elsewhere). Benchmarks are named "<benchmark>/<corpus>/<lines>", and
+ * --filter selects the ones whose name contains the given substring. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include "editor.h"
+#include "grep.h"
+using namespace std;
+using namespace std::chrono;
+
+/* A corpus is a sequence of null terminated lines stored back to back, so
+ * that generating it does not count against the benchmarks and every line
+ * can be passed to editorInsertRow() as it is. */
+struct corpus {
+    const char *kind;
+    string data;
+    vector<size_t> off;     /* Offset of every line in 'data'. */
+    vector<size_t> len;     /* Length of every line, without the null term. */
+};
+
+static const char *words[] = {
+    "int", "return", "if", "while", "for", "char", "buf", "len", "count",
+    "static", "void", "struct", "row", "idx", "0x1f", "42", "\"str\"", "'c'"
+};
+#define NUMWORDS (sizeof(words)/sizeof(words[0]))
+
+static void corpusAddLine(corpus &c, const string &line) {
+    c.off.push_back(c.data.size());
+    c.len.push_back(line.size());
+    c.data.append(line);
+    c.data.push_back('\0');
+}
+
+/* Generate 'lines' lines of the given kind:
+ *
+ * code:     short C-like lines indented with spaces.
+ * long:     lines of about 4000 characters.
+ * tabs:     lines indented and aligned with tabs.
+ * comments: mostly block and line comments.
+ * utf8:     code with accented and CJK identifiers and strings. */
+static void corpusGenerate(corpus &c, const char *kind, long lines) {
+    unsigned int seed = 1;
+    string line;
+
+    c.kind = kind;
+    for (long i = 0; i < lines; i++) {
+        line.clear();
+        if (!strcmp(kind,"code")) {
+            line.append((i % 4) * 4, ' ');
+            for (int w = 0; w < 5; w++) {
+                line += words[rand_r(&seed) % NUMWORDS];
+                line += (w == 4) ? ";" : " ";
+            }
+        } else if (!strcmp(kind,"long")) {
+            while (line.size() < 4000) {
+                line += words[rand_r(&seed) % NUMWORDS];
+                line += ' ';
+            }
+        } else if (!strcmp(kind,"tabs")) {
+            line.append(i % 6, '\t');
+            line += words[rand_r(&seed) % NUMWORDS];
+            line += "\t\t";
+            line += words[rand_r(&seed) % NUMWORDS];
+            line += "\t/* x */";
+        } else if (!strcmp(kind,"utf8")) {
+            line.append((i % 4) * 4, ' ');
+            for (int w = 0; w < 5; w++) {
+                line += words[rand_r(&seed) % NUMWORDS];
+                line += (w % 2) ? "_d\xc3\xa9j\xc3\xa0 " : " \"\xe4\xb8\xad\xe6\x96\x87\" ";
+            }
+            line += ";";
+        } else if (!strcmp(kind,"comments")) {
+            switch (i % 8) {
+            case 0: line = "/* Block comment starting here"; break;
+            case 3: line = " * and ending here. */"; break;
+            case 5: line = "int x = 1; // trailing comment"; break;
+            default: line = " * comment body with some words in it"; break;
+            }
+        }
+        corpusAddLine(c, line);
+    }
+}
+
+/* Heap bytes currently in use. */
+static long heapInUse(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 mi = mallinfo2();
+    return (long) (mi.uordblks + mi.hblkhd);
+#else
+    return 0;
+#endif
+}
+
+static const char *filter = NULL;
+static char tmpfile_path[] = "/tmp/kilo-bench-XXXXXX";
+
+/* Time 'fn', which is expected to perform 'ops' operations, and report the
+ * result under the name "name/corpus/lines". */
+template<typename F>
+static void bench(const char *name, corpus &c, long ops, F fn) {
+    char fullname[128];
+    snprintf(fullname, sizeof(fullname), "%s/%s/%zu", name, c.kind, c.off.size());
+    if (filter && !strstr(fullname,filter)) return;
+
+    long heap = heapInUse();
+    auto t1 = steady_clock::now();
+    fn();
+    auto t2 = steady_clock::now();
+    double ns = duration_cast<nanoseconds>(t2 - t1).count();
+    long bytes = heapInUse() - heap;
+    printf("%-36s %10ld %12.1f ns/op %10.1f B/op\n", fullname, ops,
+        ops ? ns / ops : 0, ops ? (double) bytes / ops : 0);
+    fflush(stdout);
+}
+
+/* Write the corpus as a tree of 8 directories of 8 files each under a new
+ * temporary directory, whose path is returned. */
+static string corpusWriteTree(corpus &c) {
+    char dir[] = "/tmp/kilo-bench-tree-XXXXXX";
+    if (!mkdtemp(dir)) throw Exception("Creating the search tree");
+    size_t lines = c.off.size(), per = (lines+63)/64;
+    for (int d = 0; d < 8; d++) {
+        string sub = string(dir)+"/"+to_string(d);
+        mkdir(sub.c_str(),0700);
+        for (int f = 0; f < 8; f++) {
+            FILE *fp = fopen((sub+"/"+to_string(f)+".c").c_str(),"w");
+            if (!fp) throw Exception("Writing the search tree");
+            size_t first = (d*8+f)*per;
+            for (size_t j = first; j < first+per && j < lines; j++) {
+                fwrite(&c.data[c.off[j]],1,c.len[j],fp);
+                fputc('\n',fp);
+            }
+            fclose(fp);
+        }
+    }
+    return dir;
+}
+
+static void removeTree(const string &dir) {
+    for (int d = 0; d < 8; d++) {
+        string sub = dir+"/"+to_string(d);
+        for (int f = 0; f < 8; f++)
+            unlink((sub+"/"+to_string(f)+".c").c_str());
+        rmdir(sub.c_str());
+    }
+    rmdir(dir.c_str());
+}
+
+/* Load the corpus rows in the editor, outside of any measurement. */
+static void loadCorpus(corpus &c) {
+    editorClearRows();
+    for (size_t j = 0; j < c.off.size(); j++)
+        editorInsertRow(E.numrows, &c.data[c.off[j]], c.len[j]);
+}
+
+static void runCorpus(corpus &c) {
+    long lines = c.off.size();
+
+    bench("insert_row", c, lines, [&]() {
+        editorClearRows();
+        for (long j = 0; j < lines; j++)
+            editorInsertRow(E.numrows, &c.data[c.off[j]], c.len[j]);
+    });
+    if (E.numrows != lines) loadCorpus(c);
+
+    bench("update_row", c, lines, [&]() {
+        for (long j = 0; j < lines; j++) editorUpdateRow(E.row+j);
+    });
+
+    bench("update_syntax", c, lines, [&]() {
+        for (long j = 0; j < lines; j++) editorUpdateSyntax(E.row+j);
+    });
+
+    /* Insert a char in the middle of up to 100K rows spread over the file. */
+    long inserts = lines < 100000 ? lines : 100000;
+    bench("row_insert_char", c, inserts, [&]() {
+        for (long j = 0; j < inserts; j++) {
+            erow *row = E.row + j*(lines/inserts);
+            editorRowInsertChar(row, row->size/2, 'x');
+        }
+    });
+
+    /* The needle never matches, so every row is scanned. */
+    bench("search", c, lines, [&]() {
+        int offset;
+        editorFindRow("needle-not-in-corpus", -1, 1, &offset);
+    });
+
+    /* Replace a frequent word everywhere, then undo it: every changed row
+     * is rebuilt and highlighted once. */
+    const char *word = strcmp(c.kind,"comments") ? "row" : "comment";
+    bench("replace_all", c, lines, [&]() {
+        if (editorReplaceAll(word, "WORD", 0) <= 0)
+            throw Exception(string("Nothing replaced in the corpus: ") + word);
+    });
+    bench("undo_replace", c, lines, [&]() {
+        editorUndo();
+    });
+
+    /* Pipe every row through cat and swap the output in, then undo it:
+     * the rows go back without being rendered again. */
+    bench("filter", c, lines, [&]() {
+        editorFilterStart("cat", 0, E.numrows);
+        while (editorFilterRunning()) editorFilterPoll();
+    });
+    bench("undo_filter", c, lines, [&]() {
+        editorUndo();
+    });
+
+    /* Type a word at up to 10K cursors spread over the file and delete it,
+     * a batch of edits per key, then undo it all at once. */
+    long cursors = lines < 10000 ? lines : 10000;
+    E.cursors.clear();
+    for (long j = 1; j < cursors; j++) {
+        erow *row = E.row + j*(lines/cursors);
+        E.cursors.push_back({row->idx, row->size/2});
+    }
+    editorSetCursor(0, 0);
+    bench("cursors_type", c, cursors*16, [&]() {
+        for (const char *p = "word_typ"; *p; p++) editorInsertText(p, 1);
+        for (int j = 0; j < 8; j++) editorDelChar();
+    });
+    bench("undo_cursors", c, cursors, [&]() {
+        editorUndo();
+    });
+    editorCursorsClear();
+
+    /* The same over the corpus split in a tree of files, searched by a
+     * thread per core. */
+    string tree = corpusWriteTree(c);
+    bench("grep", c, lines, [&]() {
+        grepSearch gs;
+        vector<grepMatch> found;
+        grepStart(gs, tree.c_str(), "needle-not-in-corpus", 0);
+        while (grepPoll(gs, found)) usleep(100);
+    });
+    removeTree(tree);
+
+    /* Soft wrap: build the visual line index, then page through the file
+     * and jump to pseudo random visual lines. */
+    bench("wrap_build", c, lines, [&]() {
+        editorSetWrap(1);
+    });
+    long jumps = 100000;
+    bench("wrap_page_down", c, jumps, [&]() {
+        for (long j = 0; j < jumps; j++) editorMovePages(1);
+    });
+    bench("wrap_goto", c, jumps, [&]() {
+        unsigned int seed = 1;
+        int64_t total = E.wrapidx.prefix(E.numrows);
+        for (long j = 0; j < jumps; j++)
+            editorGotoVisualLine(((int64_t) rand_r(&seed) << 16) % total);
+    });
+    editorSetWrap(0);
+
+    /* Minimap: build it for a 1000 pixel high window, then edit rows spread
+     * over the file updating it after each edit, as every frame does. */
+    vector<int> tiles;
+    bench("minimap_build", c, lines, [&]() {
+        E.minimap.height = 0;
+        editorMinimapUpdate(1000, tiles);
+    });
+    bench("minimap_edit", c, inserts, [&]() {
+        for (long j = 0; j < inserts; j++) {
+            erow *row = E.row + j*(lines/inserts);
+            editorRowInsertChar(row, row->size, 'x');
+            editorRowInsertChar(row, row->size, 'x');
+            tiles.clear();
+            editorMinimapUpdate(1000, tiles);
+        }
+    });
+
+    /* Word index: build it, update it after editing rows spread over the
+     * file, as the main loop does after every key, then complete two
+     * letter prefixes of corpus words at rows spread over the file. */
+    bench("words_build", c, lines, [&]() {
+        E.words.on = 0;
+        editorWordsStart();
+        while (editorWordsPoll());
+    });
+    long completions = 10000;
+    bench("words_update", c, completions, [&]() {
+        for (long j = 0; j < completions; j++) {
+            editorRowInsertChar(E.row + j*lines/completions, 0, 'x');
+            editorWordsPoll();
+        }
+    });
+    bench("complete", c, completions, [&]() {
+        vector<string> found;
+        for (long j = 0; j < completions; j++) {
+            editorComplete(words[j % NUMWORDS], 2, j*lines/completions,
+                           found, 16);
+        }
+    });
+
+    /* Byte offset to position and back, the index being already built. */
+    editorRowFileOffset(0);
+    bench("offset_to_pos", c, jumps, [&]() {
+        unsigned int seed = 1;
+        int64_t total = editorRowFileOffset(E.numrows);
+        for (long j = 0; j < jumps; j++) {
+            int filerow, filecol;
+            editorFileOffsetToPos(((int64_t) rand_r(&seed) << 16) % total,
+                                  &filerow, &filecol);
+            editorRowFileOffset(filerow);
+        }
+    });
+
+    /* Paste the whole corpus in an empty buffer with a single call. */
+    string text;
+    for (long j = 0; j < lines; j++) {
+        text.append(&c.data[c.off[j]],c.len[j]);
+        if (j+1 < lines) text.push_back('\n');
+    }
+    editorClearRows();
+    editorSetCursor(0,0);
+    bench("insert_text", c, lines, [&]() {
+        editorInsertText(text.c_str(),text.size());
+    });
+    text.clear();
+    text.shrink_to_fit();
+
+    /* Write the corpus with editorSave(), then load it with editorOpen(). */
+    loadCorpus(c);
+    free(E.filename);
+    E.filename = strdup(tmpfile_path);
+    E.disk.stale = 1; /* Overwrite the file mkstemp() created. */
+    E.disk.gzip = 0;
+    bench("save", c, lines, [&]() {
+        editorSave();
+    });
+
+    editorClearRows();
+    bench("open", c, lines, [&]() {
+        editorOpen(tmpfile_path);
+    });
+
+    /* Change a row in the middle and load the file again: the diff only
+     * patches that row back. */
+    if (E.numrows) editorRowInsertChar(E.row+E.numrows/2, 0, 'x');
+    bench("reload", c, lines, [&]() {
+        editorReload();
+    });
+
+    /* Modified lines gutter: edit rows spread over the file, polling after
+     * each edit as the main loop does, then wait for the last diff. */
+    bench("gutter_update", c, completions, [&]() {
+        for (long j = 0; j < completions; j++) {
+            editorRowInsertChar(E.row + j*E.numrows/completions, 0, 'x');
+            editorGutterPoll();
+        }
+        while (editorGutterBusy()) {
+            editorGutterPoll();
+            usleep(100);
+        }
+        editorGutterPoll();
+    });
+
+    /* The same with gzip compression, found by the magic bytes. */
+    E.disk.gzip = 1;
+    bench("save_gzip", c, lines, [&]() {
+        editorSave();
+    });
+    editorClearRows();
+    bench("open_gzip", c, lines, [&]() {
+        editorOpen(tmpfile_path);
+    });
+    editorClearRows();
+}
+
+int main(int argc, char **argv) {
+    long max_lines = 1000000;
+    for (int j = 1; j < argc; j++) {
+        if (!strcmp(argv[j],"--max-lines") && j+1 < argc) {
+            max_lines = atol(argv[++j]);
+        } else if (!strcmp(argv[j],"--filter") && j+1 < argc) {
+            filter = argv[++j];
+        } else {
+            fprintf(stderr,
+                "Usage: kilo-bench [--max-lines <n>] [--filter <substring>]\n");
+            return 1;
+        }
+    }
+
+    int fd = mkstemp(tmpfile_path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    initEditor(40, 120);
+    editorSelectSyntaxHighlight((char*) "bench.c");
+
+    const char *kinds[] = {"code", "long", "tabs", "comments", "utf8"};
+    const long sizes[] = {1000, 100000, 1000000, 10000000};
+    try {
+        for (long lines : sizes) {
+            if (lines > max_lines) break;
+            for (const char *kind : kinds) {
+                corpus c;
+                /* Long lines are ~100 times bigger, keep the size in check. */
+                long n = strcmp(kind,"long") ? lines : lines/100;
+                if (n == 0) continue;
+                corpusGenerate(c, kind, n);
+                runCorpus(c);
+            }
+        }
+    } catch(const exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        unlink(tmpfile_path);
+        return 1;
+    }
+    unlink(tmpfile_path);
+    return 0;
+}
@@ -0,0 +1,16 @@
+# Embed a file in the binary: writes OUT, a C++ source defining the bytes
+# of IN as 'const unsigned char NAME[]' and their count as
+# 'const unsigned int NAME_len'.
+#
+#   cmake -DIN=<file> -DOUT=<source> -DNAME=<symbol> -P Embed.cmake
+
+file(READ "${IN}" hex HEX)
+string(LENGTH "${hex}" len)
+math(EXPR len "${len} / 2")
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+string(REGEX REPLACE "(0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,)" "\\1\n" bytes "${bytes}")
+get_filename_component(name "${IN}" NAME)
+file(WRITE "${OUT}"
+    "/* Generated from ${name} by cmake/Embed.cmake, do not edit. */\n"
+    "extern const unsigned char ${NAME}[] = {\n${bytes}\n};\n"
+    "extern const unsigned int ${NAME}_len = ${len};\n")
@@ -0,0 +1,100 @@
+/* Line based differences between two sequences, with Myers' O(ND) greedy
+ * algorithm ("An O(ND) Difference Algorithm and Its Variations", 1986).
+ *
+ * The cost is O((n+m)*d) time and O(d^2) space, d being the number of
+ * lines inserted plus removed, so it is meant to be run on what is left
+ * after stripping the common prefix and suffix, and to give up past a
+ * maximum d, leaving the caller to replace the whole range. Comparing
+ * lines goes through a callback, usually checking a hash first. */
+
+#ifndef KILO_DIFF_H
+#define KILO_DIFF_H
+
+#include <stdint.h>
+#include <vector>
+
+/* Lines [a,a+alen) of the old sequence are replaced by lines [b,b+blen) of
+ * the new one. Either length may be zero. */
+struct diffHunk {
+    int a, alen;
+    int b, blen;
+};
+
+/* 64 bit FNV-1a hash of a line. */
+static inline uint64_t diffHash(const char *s, int len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (int j = 0; j < len; j++) {
+        h ^= (unsigned char) s[j];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* Fill 'hunks', in order, with the changes turning the 'n' lines of the
+ * old sequence into the 'm' lines of the new one, eq(i,j) telling if old
+ * line i equals new line j. Returns 0 on success, or -1 if more than
+ * 'maxd' lines would be inserted or removed. */
+template<typename Eq>
+int diffLines(int n, int m, Eq eq, std::vector<diffHunk> &hunks, int maxd) {
+    hunks.clear();
+    if (maxd > n+m) maxd = n+m;
+
+    /* v[off+k] is the furthest x reached on diagonal k = x-y. trace[d]
+     * saves diagonals -(d-1)..d-1 as they were before step d. */
+    int off = maxd+1, d, x, y;
+    std::vector<int> v(2*maxd+3,0);
+    std::vector<std::vector<int>> trace;
+    for (d = 0; d <= maxd; d++) {
+        if (d) trace.emplace_back(v.begin()+off-d+1, v.begin()+off+d);
+        else trace.emplace_back();
+        int k;
+        for (k = -d; k <= d; k += 2) {
+            if (k == -d || (k != d && v[off+k-1] < v[off+k+1]))
+                x = v[off+k+1];             /* Insertion: move down. */
+            else
+                x = v[off+k-1]+1;           /* Removal: move right. */
+            y = x-k;
+            while (x < n && y < m && eq(x,y)) x++, y++;
+            v[off+k] = x;
+            if (x >= n && y >= m) break;
+        }
+        if (k <= d) break;
+    }
+    if (d > maxd) return -1;
+
+    /* Walk the path back from (n,m), collecting the edits, then merge the
+     * adjacent ones into hunks. */
+    std::vector<diffHunk> edits;
+    x = n;
+    y = m;
+    for (; d > 0; d--) {
+        const std::vector<int> &pv = trace[d];
+        auto at = [&](int k) { return pv[k+d-1]; };
+        int k = x-y, prevk;
+        if (k == -d || (k != d && at(k-1) < at(k+1)))
+            prevk = k+1;
+        else
+            prevk = k-1;
+        int px = at(prevk), py = px-prevk;
+        if (prevk == k+1)
+            edits.push_back({px,0,py,1});
+        else
+            edits.push_back({px,1,py,0});
+        x = px;
+        y = py;
+    }
+    for (auto e = edits.rbegin(); e != edits.rend(); ++e) {
+        if (!hunks.empty()) {
+            diffHunk &h = hunks.back();
+            if (h.a+h.alen == e->a && h.b+h.blen == e->b) {
+                h.alen += e->alen;
+                h.blen += e->blen;
+                continue;
+            }
+        }
+        hunks.push_back(*e);
+    }
+    return 0;
+}
+
+#endif
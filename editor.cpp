@@ -0,0 +1,4582 @@
+/* Kilo -- A very simple editor in less than 1-kilo lines of code (as counted
+ *         by "cloc"). Does not depend on libcurses, directly emits VT100
+ *         escapes on the terminal.
+ *
+ * -----------------------------------------------------------------------
+ *
+ * Copyright (C) 2016 Salvatore Sanfilippo <antirez at gmail dot com>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  *  Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *  *  Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <regex.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "editor.h"
+#include "profile.h"
+#include "utf8.h"
+#include "diff.h"
+#include "gzip.h"
+#include "grep.h"
+
+/* Every thread has its own editor state, so that files are loaded in the
+ * background with the same code, see editorBufferOpen(). */
+thread_local struct editorConfig E;
+
+/* =========================== Syntax highlights DB =========================
+ *
+ * In order to add a new syntax, define two arrays with a list of file name
+ * matches and keywords. The file name matches are used in order to match
+ * a given syntax with a given file name: if a match pattern starts with a
+ * dot, it is matched as the last past of the filename, for example ".c".
+ * Otherwise the pattern is just searched inside the filenme, like "Makefile").
+ *
+ * The list of keywords to highlight is just a list of words, however if they
+ * a trailing '|' character is added at the end, they are highlighted in
+ * a different color, so that you can have two different sets of keywords.
+ *
+ * Finally add a stanza in the HLDB global variable with two two arrays
+ * of strings, and a set of flags in order to enable highlighting of
+ * comments and numbers.
+ *
+ * The characters for single and multi line comments must be exactly two
+ * and must be provided as well (see the C language example).
+ *
+ * There is no support to highlight patterns currently. */
+
+/* C / C++ */
+char *C_HL_extensions[] = {".c",".cpp",NULL};
+char *C_HL_keywords[] = {
+        /* A few C / C++ keywords */
+        "switch","if","while","for","break","continue","return","else",
+        "struct","union","typedef","static","enum","class",
+        /* C types */
+        "int|","long|","double|","float|","char|","unsigned|","signed|",
+        "void|",NULL
+};
+
+/* Here we define an array of syntax highlights by extensions, keywords,
+ * comments delimiters and flags. */
+editorSyntax HLDB[] = {
+    {
+        /* C / C++ */
+        C_HL_extensions,
+        C_HL_keywords,
+        "//","/*","*/",
+        HL_HIGHLIGHT_STRINGS | HL_HIGHLIGHT_NUMBERS
+    }
+};
+
+#define HLDB_ENTRIES (sizeof(HLDB)/sizeof(HLDB[0]))
+
+/* ====================== Syntax highlight color scheme  ==================== */
+
+/* Bytes of non ASCII chars are never separators, so that UTF-8 text is
+ * handled as part of words. */
+int is_separator(int c) {
+    c = (unsigned char) c;
+    return c == '\0' || isspace(c) || strchr(",.()+-/*=~%[];",c) != NULL;
+}
+
+/* Chars of identifiers, as indexed for word completion: like separators,
+ * non ASCII bytes are part of words. */
+int is_word_char(int c) {
+    c = (unsigned char) c;
+    return isalnum(c) || c == '_' || c >= 0x80;
+}
+
+/* Return true if the last char of 'render', highlighted as 'hl', is part
+ * of a multi line comment that does not end there. */
+static int editorTextHasOpenComment(const char *render,
+                                    const unsigned char *hl, int rsize)
+{
+    if (hl && rsize && hl[rsize-1] == HL_MLCOMMENT &&
+        (rsize < 2 || (render[rsize-2] != '*' ||
+                       render[rsize-1] != '/'))) return 1;
+    return 0;
+}
+
+/* Return true if the specified row last char is part of a multi line comment
+ * that starts at this row or at one before, and does not end at the end
+ * of the row but spawns to the next row. */
+int editorRowHasOpenComment(erow *row) {
+    return editorTextHasOpenComment(editorRowRender(row),editorRowHl(row),
+                                    row->rsize);
+}
+
+/* Set every byte of 'hl' (that corresponds to every character of the
+ * 'rsize' bytes of 'render') to the right syntax highlight type (HL_*
+ * defines), starting inside a multi line comment if 'in_comment'. Returns
+ * the open comment state at the end. It only reads the syntax 'syn', so it
+ * can run in other threads. */
+static int editorHighlightText(struct editorSyntax *syn, char *render,
+                               int rsize, unsigned char *hl, int in_comment)
+{
+    int i, prev_sep, in_string;
+    char *p;
+    char **keywords = syn->keywords;
+    char *scs = syn->singleline_comment_start;
+    char *mcs = syn->multiline_comment_start;
+    char *mce = syn->multiline_comment_end;
+
+    memset(hl,HL_NORMAL,rsize);
+
+    /* Point to the first non-space char. */
+    p = render;
+    i = 0; /* Current char offset */
+    while(*p && isspace((unsigned char) *p)) {
+        p++;
+        i++;
+    }
+    prev_sep = 1; /* Tell the parser if 'i' points to start of word. */
+    in_string = 0; /* Are we inside "" or '' ? */
+
+    while(*p) {
+        /* Handle // comments. */
+        if (prev_sep && *p == scs[0] && *(p+1) == scs[1]) {
+            /* From here to end is a comment */
+            memset(hl+i,HL_COMMENT,rsize-i);
+            break;
+        }
+
+        /* Handle multi line comments. */
+        if (in_comment) {
+            hl[i] = HL_MLCOMMENT;
+            if (*p == mce[0] && *(p+1) == mce[1]) {
+                hl[i+1] = HL_MLCOMMENT;
+                p += 2; i += 2;
+                in_comment = 0;
+                prev_sep = 1;
+                continue;
+            } else {
+                prev_sep = 0;
+                p++; i++;
+                continue;
+            }
+        } else if (*p == mcs[0] && *(p+1) == mcs[1]) {
+            hl[i] = HL_MLCOMMENT;
+            hl[i+1] = HL_MLCOMMENT;
+            p += 2; i += 2;
+            in_comment = 1;
+            prev_sep = 0;
+            continue;
+        }
+
+        /* Handle "" and '' */
+        if (in_string) {
+            hl[i] = HL_STRING;
+            if (*p == '\\' && *(p+1)) {
+                hl[i+1] = HL_STRING;
+                p += 2; i += 2;
+                prev_sep = 0;
+                continue;
+            }
+            if (*p == in_string) in_string = 0;
+            p++; i++;
+            continue;
+        } else {
+            if (*p == '"' || *p == '\'') {
+                in_string = *p;
+                hl[i] = HL_STRING;
+                p++; i++;
+                prev_sep = 0;
+                continue;
+            }
+        }
+
+        /* Handle non printable chars. Bytes of UTF-8 sequences are printable:
+         * invalid ones are already replaced in the rendered row. */
+        if (!(*p & 0x80) && !isprint(*p)) {
+            hl[i] = HL_NONPRINT;
+            p++; i++;
+            prev_sep = 0;
+            continue;
+        }
+
+        /* Handle numbers */
+        if ((isdigit((unsigned char) *p) &&
+             (prev_sep || hl[i-1] == HL_NUMBER)) ||
+            (*p == '.' && i >0 && hl[i-1] == HL_NUMBER)) {
+            hl[i] = HL_NUMBER;
+            p++; i++;
+            prev_sep = 0;
+            continue;
+        }
+
+        /* Handle keywords and lib calls */
+        if (prev_sep) {
+            int j;
+            for (j = 0; keywords[j]; j++) {
+                if (keywords[j][0] != *p) continue; /* Cheap reject. */
+                int klen = strlen(keywords[j]);
+                int kw2 = keywords[j][klen-1] == '|';
+                if (kw2) klen--;
+
+                if (!strncmp(p,keywords[j],klen) &&
+                    is_separator(*(p+klen)))
+                {
+                    /* Keyword */
+                    memset(hl+i,kw2 ? HL_KEYWORD2 : HL_KEYWORD1,klen);
+                    p += klen;
+                    i += klen;
+                    break;
+                }
+            }
+            if (keywords[j] != NULL) {
+                prev_sep = 0;
+                continue; /* We had a keyword match */
+            }
+        }
+
+        /* Not special chars */
+        prev_sep = is_separator(*p);
+        p++; i++;
+    }
+
+    return editorTextHasOpenComment(render,hl,rsize);
+}
+
+static void editorRowStoreHl(erow *row, const unsigned char *hl);
+static void editorMinimapRowChanged(erow *row);
+static void editorWordsRowChanged(erow *row);
+
+/* Summarize the rendered row for the minimap, 'hl' being its highlight, or
+ * NULL if it is all HL_NORMAL: the highlight class of most of its non blank
+ * chars, and the cells it spans, blanks at the start excluded. */
+static void editorRowSummarize(erow *row, const unsigned char *hl) {
+    const char *render = editorRowRender(row);
+    int first = 0;
+    while (first < row->rsize && render[first] == ' ') first++;
+
+    unsigned short mini = 0;
+    if (first < row->rsize) {
+        int cls = HL_NORMAL;
+        if (hl) {
+            int count[HL_MATCH+1] = {0};
+            for (int j = first; j < row->rsize; j++)
+                if (render[j] != ' ') count[hl[j]]++;
+            for (int c = 0; c <= HL_MATCH; c++)
+                if (count[c] > count[cls]) cls = c;
+        }
+        int cfirst = editorRowRoffToCol(row,first)/MINIMAP_COLS;
+        int cend = (editorRowWidth(row)+MINIMAP_COLS-1)/MINIMAP_COLS;
+        if (cfirst > MINIMAP_WIDTH-1) cfirst = MINIMAP_WIDTH-1;
+        if (cend > MINIMAP_WIDTH) cend = MINIMAP_WIDTH;
+        mini = MINIMAP_ROW(cls,cfirst,cend);
+    }
+    if (mini != row->mini) {
+        row->mini = mini;
+        editorMinimapRowChanged(row);
+    }
+}
+
+/* Highlight a row, returning true if the open comment state at its end
+ * changed, so that the next row needs to be highlighted again. The
+ * highlight is computed aside, then stored with the row content. */
+static int editorHighlightRow(erow *row) {
+    static thread_local std::vector<unsigned char> hl;
+    if (E.syntax == NULL) {
+        /* No syntax, everything is HL_NORMAL. */
+        editorRowStoreHl(row,NULL);
+        editorRowSummarize(row,NULL);
+        editorWordsRowChanged(row);
+        return 0;
+    }
+    hl.resize(row->rsize+1);
+
+    /* If the previous line has an open comment, this line starts
+     * with an open comment state. */
+    int in_comment = row->idx > 0 ?
+        editorRowHasOpenComment(&E.row[row->idx-1]) :
+        (E.view ? E.view->firstoc : 0);
+    int oc = editorHighlightText(E.syntax,editorRowRender(row),row->rsize,
+                                 hl.data(),in_comment);
+    editorRowStoreHl(row,hl.data());
+    editorRowSummarize(row,hl.data());
+    editorWordsRowChanged(row);
+    int changed = row->hl_oc != oc;
+    row->hl_oc = oc;
+    return changed;
+}
+
+/* Highlight the rows from 'first' to 'last' included in a single pass, then
+ * propagate the syntax change to the next rows while the open comment state
+ * keeps changing. This may affect all the following rows in the file. */
+void editorUpdateSyntaxRange(int first, int last) {
+    PROFILE_ZONE("editorUpdateSyntax");
+    int j, changed = 0;
+
+    for (j = first; j <= last; j++) changed = editorHighlightRow(E.row+j);
+    while (changed && j < E.numrows) changed = editorHighlightRow(E.row+j++);
+}
+
+/* Update the syntax highlight of a single row. */
+void editorUpdateSyntax(erow *row) {
+    editorUpdateSyntaxRange(row->idx,row->idx);
+}
+
+/* Highlight 'len' bytes of the rendered row from 'roff' as 'hl', until the
+ * next update of the row, as search matches are. */
+void editorRowSetHighlight(erow *row, int roff, int len, int hl) {
+    if (roff < 0 || roff >= row->rsize) return;
+    if (len > row->rsize-roff) len = row->rsize-roff;
+    unsigned char *rowhl = editorRowHl(row);
+    if (!rowhl) {
+        std::vector<unsigned char> normal(row->rsize,HL_NORMAL);
+        normal[roff] = hl;
+        editorRowStoreHl(row,normal.data());
+        rowhl = editorRowHl(row);
+    }
+    memset(rowhl+roff,hl,len);
+}
+
+/* Select the syntax highlight scheme depending on the filename,
+ * setting it in the global state E.syntax. */
+void editorSelectSyntaxHighlight(char *filename) {
+    /* "foo.c.gz" is highlighted like "foo.c". */
+    std::string name = filename;
+    if (name.size() > 3 && !name.compare(name.size()-3,3,".gz"))
+        name.resize(name.size()-3);
+    for (unsigned int j = 0; j < HLDB_ENTRIES; j++) {
+        struct editorSyntax *s = HLDB+j;
+        unsigned int i = 0;
+        while(s->filematch[i]) {
+            const char *p;
+            int patlen = strlen(s->filematch[i]);
+            if ((p = strstr(name.c_str(),s->filematch[i])) != NULL) {
+                if (s->filematch[i][0] != '.' || p[patlen] == '\0') {
+                    E.syntax = s;
+                    return;
+                }
+            }
+            i++;
+        }
+    }
+}
+
+/* ======================= Editor rows implementation ======================= */
+
+static void editorIndexRowChanged(erow *row);
+static void editorIndexRowAppended(erow *row);
+static void editorIndexRowRemoved(int at);
+static void editorIndexInvalidate(int from);
+static void editorMinimapRowsMoved(int from);
+static void editorWordsRowsInserted(int at, int n);
+static void editorWordsRowsRemoved(int at, int n);
+static void editorWordsClear(void);
+static void editorGutterEdit(int at, int n, int m);
+static void editorGutterEdits(const std::vector<editorRowSwap> &edits);
+static void editorGutterStart(void);
+static void editorGutterStop(void);
+static void editorGutterSaved(void);
+static void editorUndoClear(void);
+static int editorReadOnly(void);
+static void editorCursorsEdit(const char *s, size_t len);
+static int64_t editorViewThreshold(void);
+static int editorRowVisualLines(erow *row);
+
+/* Update the rendered version of a row and its index of wide chars, leaving
+ * the highlight alone. TABs are expanded to spaces up to the next tab stop,
+ * and invalid UTF-8 bytes are rendered as '?'. Runs of ASCII chars are
+ * copied as they are. A row without TABs and non ASCII bytes is rendered as
+ * it is, and so is valid UTF-8 without TABs, that only needs the index.
+ * The row may not be in the file yet. */
+static void editorRenderRow(erow *row) {
+    int tabs = 0, high = 0, j, idx, col;
+    unsigned char *s = (unsigned char*) editorRowChars(row);
+
+    for (j = 0; j < row->size; j++) {
+        if (s[j] == TAB) tabs++;
+        else if (s[j] & 0x80) high++;
+    }
+
+    if (tabs+high == 0) {
+        free(row->rend);
+        row->rend = NULL;
+        row->rsize = row->size;
+        return;
+    }
+
+    /* Start without a copy of the row if there are no TABs, making one if
+     * an invalid byte turns up. */
+    int copy = tabs > 0;
+    erender *r;
+again:
+    r = (erender*) realloc(row->rend,sizeof(erender) +
+        sizeof(ewide)*(tabs+high) + (copy ? row->size+tabs*TAB_SIZE+1 : 0));
+    row->rend = r;
+    r->wide = (ewide*) (r+1);
+    r->render = copy ? (char*) (r->wide+tabs+high) : NULL;
+    r->nwide = 0;
+
+    idx = col = j = 0;
+    while (j < row->size) {
+        /* Copy the ASCII run up to the next TAB or non ASCII byte. */
+        int run = j;
+        while (run < row->size && s[run] != TAB && !(s[run] & 0x80)) run++;
+        if (copy) memcpy(r->render+idx,s+j,run-j);
+        idx += run-j;
+        col += run-j;
+        j = run;
+        if (j == row->size) break;
+
+        ewide *w = r->wide + r->nwide++;
+        w->off = j;
+        w->roff = idx;
+        w->col = col;
+        if (s[j] == TAB) {
+            w->len = 1;
+            w->width = TAB_SIZE - col % TAB_SIZE;
+            memset(r->render+idx,' ',w->width);
+            w->rlen = w->width;
+        } else {
+            uint32_t cp;
+            int n = utf8Decode((char*) s+j,row->size-j,&cp);
+            if (n) {
+                w->len = w->rlen = n;
+                w->width = utf8CharWidth(cp);
+                if (copy) memcpy(r->render+idx,s+j,n);
+            } else if (!copy) {
+                copy = 1;
+                goto again;
+            } else {
+                w->len = w->rlen = w->width = 1;
+                r->render[idx] = '?';
+            }
+        }
+        j += w->len;
+        idx += w->rlen;
+        col += w->width;
+    }
+    row->rsize = idx;
+    r->rwidth = col;
+    if (copy) r->render[idx] = '\0';
+}
+
+/* Render a row of the file again, see editorRenderRow(). Called every time
+ * the content of the row changes. */
+static void editorUpdateRender(erow *row) {
+    editorGutterEdit(row->idx,1,1);
+    editorRenderRow(row);
+    editorIndexRowChanged(row);
+}
+
+/* Return the index of the last entry of the row wide chars index whose
+ * 'field' is less than or equal to 'v', or -1 if there is none. */
+static int editorRowFindWide(erow *row, int ewide::*field, int v) {
+    if (!row->rend) return -1;
+    int lo = 0, hi = row->rend->nwide;
+    while (lo < hi) {
+        int mid = (lo+hi)/2;
+        if (row->rend->wide[mid].*field <= v) lo = mid+1;
+        else hi = mid;
+    }
+    return lo-1;
+}
+
+/* Convert a position in one representation of the row into another one,
+ * 'from' and 'to' being the fields of ewide for the two representations and
+ * 'fromlen' and 'tolen' the size of the char in each of them. A position
+ * inside a char maps to the start of the char. */
+static int editorRowConvert(erow *row, int v, int ewide::*from,
+                            unsigned char ewide::*fromlen, int ewide::*to,
+                            unsigned char ewide::*tolen)
+{
+    int k = editorRowFindWide(row,from,v);
+    if (k == -1) return v;
+    ewide *w = row->rend->wide+k;
+    if (v < w->*from + w->*fromlen) return w->*to;
+    return w->*to + w->*tolen + (v - w->*from - w->*fromlen);
+}
+
+/* Display column of the char at byte offset 'off' of the row. */
+int editorRowOffToCol(erow *row, int off) {
+    return editorRowConvert(row,off,&ewide::off,&ewide::len,
+                                    &ewide::col,&ewide::width);
+}
+
+/* Byte offset of the char displayed at column 'col' of the row. */
+int editorRowColToOff(erow *row, int col) {
+    return editorRowConvert(row,col,&ewide::col,&ewide::width,
+                                    &ewide::off,&ewide::len);
+}
+
+/* Display column of the char at offset 'roff' of the rendered row. */
+int editorRowRoffToCol(erow *row, int roff) {
+    return editorRowConvert(row,roff,&ewide::roff,&ewide::rlen,
+                                     &ewide::col,&ewide::width);
+}
+
+/* Offset in the rendered row of the char displayed at column 'col'. */
+int editorRowColToRoff(erow *row, int col) {
+    return editorRowConvert(row,col,&ewide::col,&ewide::width,
+                                    &ewide::roff,&ewide::rlen);
+}
+
+/* Index of the first wide char at or after offset 'roff' of the rendered
+ * row, for callers walking the rendered row and the index together. */
+int editorRowWideFrom(erow *row, int roff) {
+    return editorRowFindWide(row,&ewide::roff,roff-1)+1;
+}
+
+/* Update the rendered version and the syntax highlight of a row. */
+void editorUpdateRow(erow *row) {
+    editorUpdateRender(row);
+    editorUpdateSyntax(row);
+}
+
+/* Make room for 'len' bytes in the storage of the row, keeping its content
+ * and null term as far as they fit, and return it. The highlight is not
+ * kept: it is stored again once the row is highlighted. Storage that fits
+ * in the row itself goes there, saving a heap allocation. */
+static char *editorRowStorage(erow *row, int len) {
+    int keep = std::min(row->size+1,len);
+    row->flags &= ~ROW_HL;
+    if (len <= (int) sizeof(row->u.inl)) {
+        if (!(row->flags & ROW_INLINE)) {
+            char *data = row->u.data;
+            memcpy(row->u.inl,data,keep);
+            free(data);
+            row->flags |= ROW_INLINE;
+        }
+        return row->u.inl;
+    }
+    if (row->flags & ROW_INLINE) {
+        char *data = (char*) malloc(len);
+        memcpy(data,row->u.inl,keep);
+        row->u.data = data;
+        row->flags &= ~ROW_INLINE;
+    } else {
+        row->u.data = (char*) realloc(row->u.data,len);
+    }
+    return row->u.data;
+}
+
+/* Store 'hl', the highlight of the rendered row, after the row content.
+ * Nothing is stored if 'hl' is NULL or all HL_NORMAL. */
+static void editorRowStoreHl(erow *row, const unsigned char *hl) {
+    int n = 0;
+    for (int j = 0; hl && j < row->rsize; j++) {
+        if (hl[j] != HL_NORMAL) {
+            n = row->rsize;
+            break;
+        }
+    }
+    char *chars = editorRowStorage(row,row->size+1+n);
+    if (n == 0) return;
+    memcpy(chars+row->size+1,hl,n);
+    row->flags |= ROW_HL;
+}
+
+/* Set up a new row 'idx' of 'size' bytes, null terminated, without
+ * rendering it, and return where its content goes. */
+static char *editorInitRow(erow *row, int idx, int size) {
+    row->idx = idx;
+    row->size = 0;
+    row->rsize = 0;
+    row->hl_oc = 0;
+    row->flags = ROW_INLINE;
+    row->mini = 0;
+    row->u.inl[0] = '\0';
+    row->rend = NULL;
+    editorMinimapRowChanged(row);
+    char *chars = editorRowStorage(row,size+1);
+    chars[size] = '\0';
+    row->size = size;
+    return chars;
+}
+
+/* Insert a row at the specified position, shifting the other rows on the bottom
+ * if required. The row is set up before the rows are moved, as 's' may be
+ * the content of one of them. */
+void editorInsertRow(int at, char *s, size_t len) {
+    if (at > E.numrows) return;
+    if (at != E.numrows) editorIndexInvalidate(at);
+    erow row;
+    memcpy(editorInitRow(&row,at,len),s,len);
+    E.row = (erow*) realloc(E.row,sizeof(erow)*(E.numrows+1));
+    if (at != E.numrows) {
+        memmove(E.row+at+1,E.row+at,sizeof(E.row[0])*(E.numrows-at));
+        for (int j = at+1; j <= E.numrows; j++) E.row[j].idx++;
+    }
+    E.row[at] = row;
+    E.numrows++;
+    editorWordsRowsInserted(at,1);
+    editorGutterEdit(at,0,1);
+    editorUpdateRow(E.row+at);
+    if (at == E.numrows-1) editorIndexRowAppended(E.row+at);
+    E.dirty++;
+}
+
+/* Free row's heap allocated stuff. */
+void editorFreeRow(erow *row) {
+    if (!(row->flags & ROW_INLINE)) free(row->u.data);
+    free(row->rend);
+}
+
+/* Remove the row at the specified position, shifting the remainign on the
+ * top. */
+void editorDelRow(int at) {
+    erow *row;
+
+    if (at >= E.numrows) return;
+    editorIndexRowRemoved(at);
+    editorWordsRowsRemoved(at,1);
+    editorGutterEdit(at,1,0);
+    row = E.row+at;
+    editorFreeRow(row);
+    memmove(E.row+at,E.row+at+1,sizeof(E.row[0])*(E.numrows-at-1));
+    for (int j = at; j < E.numrows-1; j++) E.row[j].idx--;
+    E.numrows--;
+    E.dirty++;
+}
+
+/* Free all the rows, leaving an empty buffer. */
+void editorClearRows(void) {
+    editorUndoClear();
+    for (int j = 0; j < E.numrows; j++) editorFreeRow(E.row+j);
+    free(E.row);
+    E.row = NULL;
+    E.numrows = 0;
+    editorIndexInvalidate(0);
+    editorWordsClear();
+    editorGutterStop();
+    E.cursors.clear();
+}
+
+/* Replace rows, for every entry of 'swaps', in file order: rows [at,at+n)
+ * with the next m rows of 'rows', set up by editorInitRow() and rendered.
+ * The rows are moved in a single pass, in place if every swap keeps its
+ * number of rows. 'swaps' and 'rows' are changed into the swaps undoing it
+ * and the rows taken out, whole, so that putting them back needs no
+ * rendering either. New rows are highlighted, while rows put back, if
+ * 'back' is true, kept their highlight: only the rows after them are, if
+ * the comment state changed. The view is kept in the file. */
+static void editorSwapRows(std::vector<editorRowSwap> &swaps,
+                           std::vector<erow> &rows, int back)
+{
+    if (swaps.empty()) return;
+    int delta = 0, taken = 0, inplace = 1;
+    for (auto &s : swaps) {
+        delta += s.m-s.n;
+        taken += s.n;
+        if (s.n != s.m) inplace = 0;
+    }
+    std::vector<erow> out;
+    out.reserve(taken);
+    size_t k = 0;
+    if (inplace) {
+        for (auto &s : swaps) {
+            out.insert(out.end(),E.row+s.at,E.row+s.at+s.n);
+            std::copy(rows.data()+k,rows.data()+k+s.m,E.row+s.at);
+            k += s.m;
+        }
+    } else {
+        erow *row = (erow*) malloc(sizeof(erow)*std::max(E.numrows+delta,1));
+        int from = 0, to = 0;
+        for (auto &s : swaps) {
+            std::copy(E.row+from,E.row+s.at,row+to);
+            to += s.at-from;
+            out.insert(out.end(),E.row+s.at,E.row+s.at+s.n);
+            std::copy(rows.data()+k,rows.data()+k+s.m,row+to);
+            k += s.m;
+            to += s.m;
+            from = s.at+s.n;
+        }
+        std::copy(E.row+from,E.row+E.numrows,row+to);
+        free(E.row);
+        E.row = row;
+        E.numrows += delta;
+    }
+    rows.swap(out);
+
+    /* Turn every swap into the one undoing it, in the new rows: applied in
+     * file order, each one starts where the ones before left it. */
+    int shift = 0;
+    for (auto &s : swaps) {
+        s.at += shift;
+        shift += s.m-s.n;
+    }
+    editorGutterEdits(swaps);
+    for (auto &s : swaps) std::swap(s.n,s.m);
+    if (!inplace) {
+        for (int j = swaps[0].at; j < E.numrows; j++) E.row[j].idx = j;
+        editorIndexInvalidate(swaps[0].at);
+    }
+    size_t old = 0;
+    for (auto &s : swaps) {
+        for (int j = s.at; j < s.at+s.n; j++) {
+            E.row[j].idx = j;
+            /* Rows put back keep their highlight: tell the word index. */
+            if (back) editorWordsRowChanged(E.row+j);
+            if (inplace) {
+                editorIndexRowChanged(E.row+j);
+                editorMinimapRowChanged(E.row+j);
+            }
+        }
+        /* The last new row starts from the comment state the row after it
+         * was highlighted with, so that it is highlighted again if it
+         * changed. */
+        if (!back && s.n) {
+            erow *last = E.row+s.at+s.n-1;
+            if (s.m) last->hl_oc = rows[old+s.m-1].hl_oc;
+            else last->hl_oc = s.at ? E.row[s.at-1].hl_oc : 0;
+        }
+        old += s.m;
+        if (s.n != s.m) {
+            editorWordsRowsRemoved(s.at,s.m);
+            editorWordsRowsInserted(s.at,s.n);
+        }
+    }
+
+    /* Every row at most once, like editorUpdateSyntaxRows(). */
+    {
+        PROFILE_ZONE("editorUpdateSyntax");
+        int next = 0;
+        old = 0;
+        for (auto &s : swaps) {
+            /* Rows put back ending in the comment state the rows taken out
+             * ended in leave the row after them as it is. */
+            int changed = 1;
+            if (back && s.n && s.m)
+                changed = E.row[s.at+s.n-1].hl_oc != rows[old+s.m-1].hl_oc;
+            old += s.m;
+            int j = std::max(back ? s.at+s.n : s.at,next);
+            while (j < E.numrows && (j < s.at+s.n || changed))
+                changed = editorHighlightRow(E.row+j++);
+            next = j;
+        }
+    }
+    if (E.rowoff > E.numrows)
+        E.rowoff = std::max(E.numrows-E.screenrows+1,0);
+    if (E.rowoff == E.numrows ||
+        E.wrapoff >= editorRowVisualLines(E.row+E.rowoff)) E.wrapoff = 0;
+    E.dirty++;
+}
+
+/* Turn the editor rows into a single heap-allocated string.
+ * Returns the pointer to the heap-allocated string and populate the
+ * integer pointed by 'buflen' with the size of the string, escluding
+ * the final nulterm. */
+char *editorRowsToString(int *buflen) {
+    char *buf = NULL, *p;
+    int totlen = 0;
+    int j;
+
+    /* Compute count of bytes */
+    for (j = 0; j < E.numrows; j++)
+        totlen += E.row[j].size+1; /* +1 is for "\n" at end of every row */
+    *buflen = totlen;
+    totlen++; /* Also make space for nulterm */
+
+    p = buf = (char*) malloc(totlen);
+    for (j = 0; j < E.numrows; j++) {
+        memcpy(p,editorRowChars(E.row+j),E.row[j].size);
+        p += E.row[j].size;
+        *p = '\n';
+        p++;
+    }
+    *p = '\0';
+    return buf;
+}
+
+/* Insert a character at the specified position in a row, moving the remaining
+ * chars on the right if needed. */
+void editorRowInsertChar(erow *row, int at, int c) {
+    if (at > row->size) {
+        /* Pad the string with spaces if the insert location is outside the
+         * current length by more than a single character. */
+        int padlen = at-row->size;
+        /* In the next line +2 means: new char and null term. */
+        char *chars = editorRowStorage(row,row->size+padlen+2);
+        memset(chars+row->size,' ',padlen);
+        chars[row->size+padlen+1] = '\0';
+        row->size += padlen+1;
+    } else {
+        /* If we are in the middle of the string just make space for 1 new
+         * char plus the (already existing) null term. */
+        char *chars = editorRowStorage(row,row->size+2);
+        memmove(chars+at+1,chars+at,row->size-at+1);
+        row->size++;
+    }
+    editorRowChars(row)[at] = c;
+    editorUpdateRow(row);
+    E.dirty++;
+}
+
+/* Append the string 's' at the end of a row */
+void editorRowAppendString(erow *row, char *s, size_t len) {
+    char *chars = editorRowStorage(row,row->size+len+1);
+    memcpy(chars+row->size,s,len);
+    row->size += len;
+    chars[row->size] = '\0';
+    editorUpdateRow(row);
+    E.dirty++;
+}
+
+/* Delete the byte at offset 'at' from the specified row. */
+void editorRowDelChar(erow *row, int at) {
+    editorRowDelRange(row,at,1);
+}
+
+/* Delete 'len' bytes starting at offset 'at' from the specified row. */
+void editorRowDelRange(erow *row, int at, int len) {
+    if (row->size <= at) return;
+    if (len > row->size-at) len = row->size-at;
+    char *chars = editorRowChars(row);
+    memmove(chars+at,chars+at+len,row->size-at-len+1);
+    row->size -= len;
+    editorUpdateRow(row);
+    E.dirty++;
+}
+
+/* ================================ Soft wrap ===============================
+ *
+ * When wrapping, a row of 'rwidth' columns takes rwidth/screencols+1 visual
+ * lines on screen (the last one has room for the cursor at the end of the
+ * row). E.wrapidx holds the visual lines of every row in a Fenwick tree, so
+ * that the visual line where a row starts, and the row shown at a given
+ * visual line, are found in O(log n). Editing a row updates its count in
+ * O(log n), while adding or removing rows, or resizing the screen, makes
+ * the tree rebuild the next time it is used. The view starts at visual line
+ * 'wrapoff' of row 'rowoff', and the cursor column is never scrolled. */
+
+static int editorRowVisualLines(erow *row) {
+    return editorRowWidth(row)/E.screencols + 1;
+}
+
+/* Rebuild the wrap index if rows were added or removed, or the screen width
+ * changed, since it was built. */
+static void editorWrapValidate(void) {
+    if (E.wrapvalid && E.wrapcols == E.screencols &&
+        E.wrapidx.size() == E.numrows) return;
+    PROFILE_ZONE("editorWrapBuild");
+    E.wrapidx.build(E.numrows,[](int j) {
+        return editorRowVisualLines(E.row+j);
+    });
+    E.wrapcols = E.screencols;
+    E.wrapvalid = 1;
+}
+
+/* Keep the wrap index in sync with the new width of 'row'. */
+static void editorWrapRowChanged(erow *row) {
+    if (!E.wrap || !E.wrapvalid || E.wrapcols != E.screencols ||
+        row->idx >= E.wrapidx.size()) return;
+    int64_t delta = editorRowVisualLines(row) - E.wrapidx.get(row->idx);
+    if (delta) E.wrapidx.add(row->idx,delta);
+}
+
+/* First visual line of 'filerow'. Rows past the end of the file take a
+ * single line. */
+static int64_t editorRowVisualStart(int filerow) {
+    if (filerow <= E.numrows) return E.wrapidx.prefix(filerow);
+    return E.wrapidx.prefix(E.numrows) + (filerow-E.numrows);
+}
+
+/* Total number of visual lines, including the one just past the end of the
+ * file where the cursor can go. */
+static int64_t editorVisualLines(void) {
+    return E.wrapidx.prefix(E.numrows)+1;
+}
+
+/* Make visual line 'top' the first one shown. */
+static void editorWrapSetTop(int64_t top) {
+    E.rowoff = E.wrapidx.find(top);
+    E.wrapoff = top - E.wrapidx.prefix(E.rowoff);
+}
+
+/* Scroll just enough to show column 'col' of 'filerow', and put the cursor
+ * there. */
+static void editorWrapScrollTo(int filerow, int col) {
+    editorWrapValidate();
+    int64_t v = editorRowVisualStart(filerow) + col/E.screencols;
+    int64_t top = editorRowVisualStart(E.rowoff) + E.wrapoff;
+    if (v < top)
+        top = v;
+    else if (v >= top+E.screenrows)
+        top = v-E.screenrows+1;
+    editorWrapSetTop(top);
+    E.cy = filerow-E.rowoff;
+    E.cx = col;
+    E.coloff = 0;
+}
+
+/* Position of the cursor on screen, in columns and rows. */
+void editorCursorScreen(int *x, int *y) {
+    if (!E.wrap) {
+        *x = E.cx;
+        *y = E.cy;
+        return;
+    }
+    editorWrapValidate();
+    int filerow = E.rowoff+E.cy;
+    *x = E.cx % E.screencols;
+    *y = editorRowVisualStart(filerow) + E.cx/E.screencols -
+         (editorRowVisualStart(E.rowoff) + E.wrapoff);
+}
+
+/* Move the cursor 'delta' visual lines down, or up if negative, keeping its
+ * column on screen when possible. */
+static void editorWrapMoveLines(int64_t delta) {
+    editorWrapValidate();
+    int filerow = E.rowoff+E.cy;
+    int64_t v = editorRowVisualStart(filerow) + E.cx/E.screencols + delta;
+    int64_t total = editorVisualLines();
+    if (v >= total) v = total-1;
+    if (v < 0) v = 0;
+    int target = E.wrapidx.find(v);
+    int col = (v - E.wrapidx.prefix(target))*E.screencols + E.cx%E.screencols;
+    editorWrapScrollTo(target,col);
+    editorFixCursorCol();
+}
+
+/* Move the cursor at the start of visual line 'line', shown at the top of
+ * the screen. Without wrapping visual lines are just rows. */
+void editorGotoVisualLine(int64_t line) {
+    if (!E.wrap) {
+        if (line > E.numrows) line = E.numrows;
+        if (line < 0) line = 0;
+        E.rowoff = line;
+        editorSetCursor(line,0);
+        return;
+    }
+    editorWrapValidate();
+    int64_t total = editorVisualLines();
+    if (line >= total) line = total-1;
+    if (line < 0) line = 0;
+    editorWrapSetTop(line);
+    int col = E.wrapoff*E.screencols;
+    int off = E.rowoff < E.numrows ?
+              editorRowColToOff(&E.row[E.rowoff],col) : 0;
+    editorSetCursor(E.rowoff,off);
+}
+
+/* Turn soft wrap on or off, keeping the cursor where it is. */
+void editorSetWrap(int on) {
+    int filerow = E.rowoff+E.cy;
+    int filecol = editorCursorOffset();
+    E.wrap = on;
+    E.wrapvalid = 0; /* Not kept up to date while not wrapping. */
+    E.wrapoff = 0;
+    E.coloff = 0;
+    E.cx = 0;
+    editorSetCursor(filerow,filecol);
+}
+
+/* Change the size of the screen, in characters, keeping the cursor
+ * visible. */
+void editorResize(int screenrows, int screencols) {
+    int filerow = E.rowoff+E.cy;
+    int filecol = editorCursorOffset();
+    E.screenrows = screenrows > 1 ? screenrows : 1;
+    E.screencols = screencols > 1 ? screencols : 1;
+    editorSetCursor(filerow,filecol);
+}
+
+/* ============================= Position index ============================
+ *
+ * E.offidx holds the size of every row plus its newline in a Fenwick tree,
+ * so that the byte offset in the file where a row starts, and the row that
+ * contains a given byte offset, are found in O(log n). Like the wrap index,
+ * it is updated in place when a row is edited, and rebuilt when first used
+ * after rows were added or removed, which costs about as much as the shift
+ * of the rows array that adding or removing them already does. */
+
+/* Rebuild the position index if rows were added or removed since it was
+ * built. */
+static void editorOffsetValidate(void) {
+    if (E.offvalid && E.offidx.size() == E.numrows) return;
+    PROFILE_ZONE("editorOffsetBuild");
+    E.offidx.build(E.numrows,[](int j) {
+        return (int64_t) E.row[j].size+1;
+    });
+    E.offvalid = 1;
+}
+
+/* Keep the row indexes in sync with the new content of 'row'. */
+static void editorIndexRowChanged(erow *row) {
+    editorWrapRowChanged(row);
+    if (!E.offvalid || row->idx >= E.offidx.size()) return;
+    int64_t delta = row->size+1 - E.offidx.get(row->idx);
+    if (delta) E.offidx.add(row->idx,delta);
+}
+
+/* A row was added at the end of the file: append it to the row indexes,
+ * unless they need to be rebuilt anyway. */
+static void editorIndexRowAppended(erow *row) {
+    editorMinimapRowsMoved(row->idx);
+    if (E.wrap && E.wrapvalid && E.wrapcols == E.screencols &&
+        E.wrapidx.size() == row->idx)
+        E.wrapidx.push_back(editorRowVisualLines(row));
+    else
+        E.wrapvalid = 0;
+    if (E.offvalid && E.offidx.size() == row->idx)
+        E.offidx.push_back(row->size+1);
+    else
+        E.offvalid = 0;
+}
+
+/* Row 'at' is about to be removed. Removing the last row keeps the indexes
+ * valid. */
+static void editorIndexRowRemoved(int at) {
+    if (at != E.numrows-1) {
+        editorIndexInvalidate(at);
+        return;
+    }
+    editorMinimapRowsMoved(at);
+    if (E.wrapidx.size() == E.numrows) E.wrapidx.pop_back();
+    else E.wrapvalid = 0;
+    if (E.offidx.size() == E.numrows) E.offidx.pop_back();
+    else E.offvalid = 0;
+}
+
+/* Rows from 'from' on were added or removed: the row indexes need to be
+ * rebuilt, and the minimap from there on. */
+static void editorIndexInvalidate(int from) {
+    E.wrapvalid = 0;
+    E.offvalid = 0;
+    editorMinimapRowsMoved(from);
+}
+
+/* Byte offset in the file of the start of 'filerow'. */
+int64_t editorRowFileOffset(int filerow) {
+    editorOffsetValidate();
+    if (filerow > E.numrows) filerow = E.numrows;
+    return E.offidx.prefix(filerow);
+}
+
+/* Byte offset in the file of the cursor. */
+int64_t editorCursorFileOffset(void) {
+    int filerow = E.rowoff+E.cy;
+    if (E.view) {
+        if (filerow > E.numrows) filerow = E.numrows;
+        return E.view->off[filerow] + editorCursorOffset();
+    }
+    return editorRowFileOffset(filerow) + editorCursorOffset();
+}
+
+/* Convert the byte offset 'offset' in the file into a row and a byte offset
+ * in that row. An offset that falls on a newline is at the end of its row,
+ * and one past the end of the file is at the end of the last row. */
+void editorFileOffsetToPos(int64_t offset, int *filerow, int *filecol) {
+    editorOffsetValidate();
+    if (offset < 0) offset = 0;
+    int row = E.offidx.find(offset);
+    if (row >= E.numrows) {
+        *filerow = E.numrows ? E.numrows-1 : 0;
+        *filecol = E.numrows ? E.row[*filerow].size : 0;
+        return;
+    }
+    *filerow = row;
+    *filecol = offset - E.offidx.prefix(row);
+    if (*filecol > E.row[row].size) *filecol = E.row[row].size;
+}
+
+/* ============================ Cursor movement ============================= */
+
+/* Byte offset in its row of the char under the cursor. */
+int editorCursorOffset(void) {
+    int filerow = E.rowoff+E.cy;
+    if (filerow >= E.numrows) return 0;
+    erow *row = &E.row[filerow];
+    int off = editorRowColToOff(row,E.coloff+E.cx);
+    return off > row->size ? row->size : off;
+}
+
+/* Scroll the view vertically just enough to show 'filerow', and put the
+ * cursor on it, leaving the cursor column alone. */
+static void editorScrollToRow(int filerow) {
+    if (filerow < E.rowoff)
+        E.rowoff = filerow;
+    else if (filerow >= E.rowoff+E.screenrows)
+        E.rowoff = filerow-E.screenrows+1;
+    E.cy = filerow-E.rowoff;
+}
+
+/* Move the cursor to the given position in the file, 'filecol' being a byte
+ * offset in the row, scrolling the view just enough to keep it on screen. */
+void editorSetCursor(int filerow, int filecol) {
+    int col = filecol;
+    if (filerow < E.numrows) col = editorRowOffToCol(&E.row[filerow],filecol);
+    if (E.wrap) {
+        editorWrapScrollTo(filerow,col);
+        return;
+    }
+    editorScrollToRow(filerow);
+    if (col < E.coloff)
+        E.coloff = col;
+    else if (col >= E.coloff+E.screencols)
+        E.coloff = col-E.screencols+1;
+    E.cx = col-E.coloff;
+}
+
+/* Put the cursor at the start of the char under it, or at the end of the
+ * line if the current line is too short. */
+void editorFixCursorCol(void) {
+    editorSetCursor(E.rowoff+E.cy,editorCursorOffset());
+}
+
+/* Move the cursor 'delta' rows down, or up if negative, stopping at the
+ * first row or just past the last one, and scroll as needed. The cursor
+ * keeps its display column when the target row is long enough. Costs the
+ * same for a jump of any length. When wrapping, moves by visual lines. */
+void editorMoveRows(int delta) {
+    if (E.wrap) {
+        editorWrapMoveLines(delta);
+        return;
+    }
+
+    int filerow = E.rowoff+E.cy;
+    int target = filerow+delta;
+
+    if (delta > 0 && target > E.numrows)
+        target = filerow > E.numrows ? filerow : E.numrows;
+    if (target < 0) target = 0;
+    editorScrollToRow(target);
+    editorFixCursorCol();
+}
+
+/* Move the cursor to the given position in the file, like editorSetCursor(),
+ * but if the position is not on screen, scroll it at the center of the
+ * screen rather than at the edge. */
+void editorJumpTo(int filerow, int filecol) {
+    if (filerow > E.numrows) filerow = E.numrows;
+    if (filerow < 0) filerow = 0;
+    if (filerow < E.numrows && filecol > E.row[filerow].size)
+        filecol = E.row[filerow].size;
+    if (filecol < 0) filecol = 0;
+
+    if (E.wrap) editorWrapValidate();
+    int64_t top = E.wrap ? editorRowVisualStart(E.rowoff)+E.wrapoff :
+                           E.rowoff;
+    editorSetCursor(filerow,filecol);
+    if (E.wrap) {
+        if (editorRowVisualStart(E.rowoff)+E.wrapoff == top) return;
+        int64_t v = editorRowVisualStart(filerow) + E.cx/E.screencols;
+        v -= E.screenrows/2;
+        editorWrapSetTop(v > 0 ? v : 0);
+    } else {
+        if (E.rowoff == top) return;
+        E.rowoff = filerow-E.screenrows/2;
+        if (E.rowoff < 0) E.rowoff = 0;
+    }
+    E.cy = filerow-E.rowoff;
+}
+
+/* Scroll the view 'delta' rows down, or up if negative, without moving the
+ * cursor unless it would leave the screen, in which case it stays on the
+ * first or last row shown. The view stops at the first row, and at the last
+ * one being the last on screen. When wrapping, scrolls by visual lines.
+ * Returns how far it scrolled. */
+int editorScrollView(int delta) {
+    int filerow = E.rowoff+E.cy;
+    int64_t top, total, moved;
+    if (E.wrap) {
+        editorWrapValidate();
+        top = editorRowVisualStart(E.rowoff)+E.wrapoff;
+        total = editorVisualLines();
+    } else {
+        top = E.rowoff;
+        total = E.numrows+1;
+    }
+    int64_t last = std::max(total-E.screenrows,(int64_t) 0);
+    int64_t newtop = top+delta;
+    if (newtop > std::max(last,top)) newtop = std::max(last,top);
+    if (newtop < 0) newtop = 0;
+    moved = newtop-top;
+    if (moved == 0) return 0;
+
+    if (E.wrap)
+        editorWrapSetTop(newtop);
+    else
+        E.rowoff = newtop;
+    E.cy = filerow-E.rowoff;
+    int x, y;
+    editorCursorScreen(&x,&y);
+    if (y < 0)
+        editorMoveRows(-y);
+    else if (y >= E.screenrows)
+        editorMoveRows(E.screenrows-1-y);
+    return moved;
+}
+
+/* Page up (negative) or down: the cursor goes to the top or bottom row of
+ * the screen first, then every page moves it by a screen. */
+void editorMovePages(int pages) {
+    if (E.wrap) {
+        int x, y;
+        int64_t delta = (int64_t) pages*E.screenrows;
+        editorCursorScreen(&x,&y);
+        if (pages < 0) delta -= y;
+        else if (pages > 0) delta += E.screenrows-1-y;
+        editorWrapMoveLines(delta);
+        return;
+    }
+
+    if (pages < 0 && E.cy != 0) {
+        E.cy = 0;
+    } else if (pages > 0 && E.cy != E.screenrows-1) {
+        E.cy = E.screenrows-1;
+        if (E.rowoff+E.cy > E.numrows) E.cy = E.numrows-E.rowoff;
+        if (E.cy < 0) E.cy = 0;
+    }
+    editorMoveRows(pages*E.screenrows);
+}
+
+/* Insert the specified char at the current prompt position. */
+void editorInsertChar(int c) {
+    if (editorReadOnly()) return;
+    if (!E.cursors.empty()) {
+        char ch = c;
+        editorCursorsEdit(&ch,1);
+        return;
+    }
+    int filerow = E.rowoff+E.cy;
+    int filecol = editorCursorOffset();
+    erow *row = (filerow >= E.numrows) ? NULL : &E.row[filerow];
+
+    /* If the row where the cursor is currently located does not exist in our
+     * logical representaion of the file, add enough empty rows as needed. */
+    if (!row) {
+        while(E.numrows <= filerow)
+            editorInsertRow(E.numrows,"",0);
+    }
+    row = &E.row[filerow];
+    editorRowInsertChar(row,filecol,c);
+    editorSetCursor(filerow,filecol+1);
+    E.dirty++;
+}
+
+/* Inserting a newline is slightly complex as we have to handle inserting a
+ * newline in the middle of a line, splitting the line as needed. */
+void editorInsertNewline(void) {
+    if (editorReadOnly()) return;
+    if (!E.cursors.empty()) {
+        editorCursorsEdit("\n",1);
+        return;
+    }
+    int filerow = E.rowoff+E.cy;
+    int filecol = editorCursorOffset();
+    erow *row = (filerow >= E.numrows) ? NULL : &E.row[filerow];
+
+    if (!row) {
+        if (filerow == E.numrows) {
+            editorInsertRow(filerow,"",0);
+            goto fixcursor;
+        }
+        return;
+    }
+    /* If the cursor is over the current line size, we want to conceptually
+     * think it's just over the last character. */
+    if (filecol >= row->size) filecol = row->size;
+    if (filecol == 0) {
+        editorInsertRow(filerow,"",0);
+    } else {
+        /* We are in the middle of a line. Split it between two rows. */
+        editorInsertRow(filerow+1,editorRowChars(row)+filecol,
+                        row->size-filecol);
+        row = &E.row[filerow];
+        editorRowChars(row)[filecol] = '\0';
+        row->size = filecol;
+        editorUpdateRow(row);
+    }
+fixcursor:
+    editorSetCursor(filerow+1,0);
+}
+
+/* Insert 'len' bytes of text at the cursor position, moving the cursor at
+ * the end of it. This is what pasting and text input use, instead of a
+ * editorInsertChar() call per byte. */
+void editorInsertText(const char *s, size_t len) {
+    int filerow = E.rowoff+E.cy;
+    int filecol = editorCursorOffset();
+
+    if (len == 0 || editorReadOnly()) return;
+    if (!E.cursors.empty()) {
+        editorCursorsEdit(s,len);
+        return;
+    }
+    editorInsertTextAt(&filerow,&filecol,s,len);
+    editorSetCursor(filerow,filecol);
+}
+
+/* Insert 'len' bytes of text at byte 'filecol' of 'filerow', and set them
+ * to the position just after the inserted text. The text may span multiple
+ * lines ("\n" or "\r\n"), and is spliced into the buffer in one go: the
+ * row is reallocated once, all the new rows are inserted with a single
+ * shift of the rows below, and the whole changed range is highlighted in
+ * one pass. Rows added at the end of the file are appended to the row
+ * indexes rather than making them rebuild. */
+void editorInsertTextAt(int *filerowp, int *filecolp, const char *s,
+                        size_t len)
+{
+    int filerow = *filerowp;
+    int filecol = *filecolp;
+
+    if (len == 0) return;
+    while(E.numrows <= filerow)
+        editorInsertRow(E.numrows,"",0);
+    erow *row = &E.row[filerow];
+    if (filecol > row->size) {
+        /* Pad with spaces up to the cursor, like editorRowInsertChar(). */
+        char *chars = editorRowStorage(row,filecol+1);
+        memset(chars+row->size,' ',filecol-row->size);
+        chars[filecol] = '\0';
+        row->size = filecol;
+    }
+
+    /* Count the new lines, so that all the rows are added at once. */
+    int newrows = 0;
+    const char *p = s, *end = s+len, *nl;
+    while ((nl = (const char*) memchr(p,'\n',end-p)) != NULL) {
+        newrows++;
+        p = nl+1;
+    }
+
+    /* Single line: just splice the text into the row. */
+    if (newrows == 0) {
+        char *chars = editorRowStorage(row,row->size+len+1);
+        memmove(chars+filecol+len,chars+filecol,row->size-filecol+1);
+        memcpy(chars+filecol,s,len);
+        row->size += len;
+        editorUpdateRow(row);
+        *filecolp = filecol+len;
+        E.dirty++;
+        return;
+    }
+
+    /* Multiple lines: the part of the row after the cursor ends up at the
+     * end of the last inserted line. */
+    int taillen = row->size-filecol;
+    int oc = row->hl_oc;
+    char *tail = (char*) malloc(taillen+1);
+    memcpy(tail,editorRowChars(row)+filecol,taillen+1);
+
+    int at = filerow+1;
+    int append = at == E.numrows;
+    if (!append) editorIndexInvalidate(at);
+    E.row = (erow*) realloc(E.row,sizeof(erow)*(E.numrows+newrows));
+    if (!append) {
+        memmove(E.row+at+newrows,E.row+at,sizeof(E.row[0])*(E.numrows-at));
+        for (int j = at+newrows; j < E.numrows+newrows; j++)
+            E.row[j].idx += newrows;
+    }
+    E.numrows += newrows;
+    editorWordsRowsInserted(at,newrows);
+    editorGutterEdit(at,0,newrows);
+
+    p = s;
+    for (int j = filerow; j <= filerow+newrows; j++) {
+        nl = (const char*) memchr(p,'\n',end-p);
+        size_t linelen = (nl ? nl : end) - p;
+        const char *next = nl ? nl+1 : end;
+        if (nl && linelen && p[linelen-1] == '\r') linelen--;
+
+        row = E.row+j;
+        if (j == filerow) {
+            char *chars = editorRowStorage(row,filecol+linelen+1);
+            memcpy(chars+filecol,p,linelen);
+            row->size = filecol+linelen;
+            chars[row->size] = '\0';
+        } else {
+            int extra = (j == filerow+newrows) ? taillen : 0;
+            char *chars = editorInitRow(row,j,linelen+extra);
+            memcpy(chars,p,linelen);
+            memcpy(chars+linelen,tail,extra);
+            filecol = linelen; /* Cursor goes at the end of the last line. */
+        }
+        editorUpdateRender(row);
+        p = next;
+    }
+    free(tail);
+    if (append) {
+        for (int j = at; j <= filerow+newrows; j++)
+            editorIndexRowAppended(E.row+j);
+    }
+    /* The last new row ends where the row split did: starting from the
+     * comment state the row after it was highlighted with, the rows after
+     * it are highlighted again if it changed. */
+    E.row[filerow+newrows].hl_oc = oc;
+    editorUpdateSyntaxRange(filerow,filerow+newrows);
+    *filerowp = filerow+newrows;
+    *filecolp = filecol;
+    E.dirty++;
+}
+
+/* Delete the char at the current prompt position. */
+void editorDelChar() {
+    if (editorReadOnly()) return;
+    if (!E.cursors.empty()) {
+        editorCursorsEdit(NULL,0);
+        return;
+    }
+    int filerow = E.rowoff+E.cy;
+    int filecol = editorCursorOffset();
+    erow *row = (filerow >= E.numrows) ? NULL : &E.row[filerow];
+
+    if (!row || (filecol == 0 && filerow == 0)) return;
+    if (filecol == 0) {
+        /* Handle the case of column 0, we need to move the current line
+         * on the right of the previous one. */
+        filecol = E.row[filerow-1].size;
+        editorRowAppendString(&E.row[filerow-1],editorRowChars(row),
+                              row->size);
+        editorDelRow(filerow);
+        editorSetCursor(filerow-1,filecol);
+    } else {
+        /* Delete the whole UTF-8 sequence before the cursor. */
+        int prev = utf8Prev(editorRowChars(row),filecol);
+        editorRowDelRange(row,prev,filecol-prev);
+        editorSetCursor(filerow,prev);
+    }
+    E.dirty++;
+}
+
+/* Modification time of a file, in nanoseconds. */
+static int64_t editorStatMtime(const struct stat *st) {
+#ifdef __APPLE__
+    return st->st_mtimespec.tv_sec*1000000000LL + st->st_mtimespec.tv_nsec;
+#else
+    return st->st_mtim.tv_sec*1000000000LL + st->st_mtim.tv_nsec;
+#endif
+}
+
+/* Remember which file is on disk, and when it was modified. */
+static void editorDiskStat(const struct stat *st) {
+    E.disk.dev = st->st_dev;
+    E.disk.ino = st->st_ino;
+    E.disk.mtime = editorStatMtime(st);
+}
+
+/* Add a line read from the file, newline included if any, as a new row at
+ * the end, or at the end of the last row if it had no newline yet, as when
+ * following the file. The "\r" of a "\r\n" stays in the row, so that the
+ * file is saved as it was. */
+static void editorOpenLine(const char *line, size_t len) {
+    int append = E.disk.partial && E.numrows;
+    E.disk.partial = line[len-1] != '\n';
+    if (line[len-1] == '\n' || line[len-1] == '\r') len--;
+    if (append)
+        editorRowAppendString(E.row+E.numrows-1,(char*) line,len);
+    else
+        editorInsertRow(E.numrows,(char*) line,len);
+}
+
+/* Inflate the gzip compressed file 'fd' in a background thread, splitting
+ * the lines of a chunk while the next one is inflated. */
+static void editorOpenGzip(int fd) {
+    PROFILE_ZONE("editorOpenGzip");
+    gzipStream gz;
+    std::string chunk, line;  /* 'line' holds a line split across chunks. */
+    int ret;
+
+    gzipStreamStart(gz,fd);
+    while ((ret = gzipStreamRead(gz,chunk)) == 1) {
+        const char *p = chunk.data(), *end = p+chunk.size(), *nl;
+        while ((nl = (const char*) memchr(p,'\n',end-p)) != NULL) {
+            if (line.empty()) {
+                editorOpenLine(p,nl+1-p);
+            } else {
+                line.append(p,nl+1-p);
+                editorOpenLine(line.data(),line.size());
+                line.clear();
+            }
+            p = nl+1;
+        }
+        line.append(p,end-p);
+    }
+    gzipStreamStop(gz);
+    if (ret == -1) throw Exception("Decompressing file: " + gz.error);
+    if (!line.empty()) editorOpenLine(line.data(),line.size());
+}
+
+/* Load the specified program in the editor memory and returns 0 on success
+ * or 1 on error. */
+int editorOpen(char *filename) {
+    FILE *fp;
+    struct stat st;
+
+    editorViewClose();
+    editorGutterStop();
+    fp = fopen(filename,"r");
+    int gzip = gzipIsCompressed(filename,fp ? fileno(fp) : -1);
+    if (fp && !gzip && fstat(fileno(fp),&st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size >= editorViewThreshold())
+    {
+        fclose(fp);
+        return editorViewOpen(filename);
+    }
+
+    E.dirty = 0;
+    editorUndoClear();
+    free(E.filename);
+    E.filename = strdup(filename);
+    memset(&E.disk,0,sizeof(E.disk));
+    E.disk.gzip = gzip;
+    fileWatchStart(E.watch,filename);
+    if (E.syntax) editorWordsStart();
+
+    if (!fp) {
+        if (errno != ENOENT) {
+            throw Exception("Opening file");
+        }
+        editorGutterStart();
+        return 1;
+    }
+
+    if (gzip) {
+        editorOpenGzip(fileno(fp));
+    } else {
+        char *line = NULL;
+        size_t linecap = 0;
+        ssize_t linelen;
+        while((linelen = getline(&line,&linecap,fp)) != -1) {
+            E.disk.size += linelen;
+            editorOpenLine(line,linelen);
+        }
+        free(line);
+    }
+    if (fstat(fileno(fp),&st) == 0) {
+        editorDiskStat(&st);
+        if (gzip) E.disk.size = st.st_size;
+    }
+    fclose(fp);
+    E.dirty = 0;
+    editorGutterStart();
+    return 0;
+}
+
+/* Save the current file on disk. Return 0 on success, 1 on error. If the
+ * file changed on disk since it was loaded, the first attempt just warns
+ * the user, and the next one overwrites it. */
+int editorSave(void) {
+    if (editorReadOnly()) return 1;
+    if (!E.disk.stale && editorDiskChanged()) {
+        E.disk.stale = 1;
+        editorSetStatusMessage("File changed on disk! "
+            "Ctrl-S again overwrites it, Ctrl-R reloads it");
+        return 1;
+    }
+
+    int len;
+    char *buf = editorRowsToString(&len);
+    std::string gz;
+    const char *data = buf;
+    size_t size = len;
+    int fd = -1;
+
+    /* Compressed files are compressed again in memory first, so that
+     * what is written is ready in one piece as for plain files. */
+    if (E.disk.gzip) {
+        if (gzipCompress(buf,len,gz) == -1) {
+            errno = ENOMEM;
+            goto writeerr;
+        }
+        data = gz.data();
+        size = gz.size();
+    }
+    fd = open(E.filename,O_RDWR|O_CREAT,0644);
+    if (fd == -1) goto writeerr;
+
+    /* Use truncate + a single write(2) call in order to make saving
+     * a bit safer, under the limits of what we can do in a small editor. */
+    if (ftruncate(fd,size) == -1) goto writeerr;
+    if (write(fd,data,size) != (ssize_t) size) goto writeerr;
+
+    struct stat st;
+    if (fstat(fd,&st) == 0) editorDiskStat(&st);
+    E.disk.size = size;
+    E.disk.partial = 0;
+    E.disk.stale = 0;
+    close(fd);
+    free(buf);
+    /* The last replace all can still be undone if nothing else changed. */
+    if (E.undo.dirty == E.dirty) E.undo.dirty = 0;
+    else editorUndoClear();
+    E.dirty = 0;
+    editorGutterSaved();
+    if (E.disk.gzip)
+        editorSetStatusMessage("%d bytes written on disk, %zu compressed",
+            len, size);
+    else
+        editorSetStatusMessage("%d bytes written on disk", len);
+    return 0;
+
+writeerr:
+    free(buf);
+    if (fd != -1) close(fd);
+    editorSetStatusMessage("Can't save! I/O error: %s",strerror(errno));
+    return 1;
+}
+
+/* ============================== Follow mode ===============================
+ *
+ * Follow mode keeps the file open and, every time it is notified that the
+ * file changed, loads the bytes past the E.disk.size already loaded at the
+ * end of the buffer, like "tail -f": only the new rows are rendered,
+ * highlighted and added to the row indexes. If the cursor is on the last
+ * row, it moves to the new last row, scrolling the view with it. When the
+ * file is truncated it is loaded again from the start, unless there are
+ * unsaved changes: then nothing is loaded until the user reloads the file
+ * or saves over it. When it is replaced by a new file with the same name
+ * (log rotation) what is left of the old one is loaded, then the new one
+ * is followed. */
+
+#define KILO_FOLLOW_CHUNK (1<<20)   /* Bytes read at a time. */
+#define KILO_FOLLOW_MAX (64<<20)    /* Bytes loaded per poll at most. */
+
+static int follow_pending;  /* There may be more data to load. */
+
+/* Append 'len' bytes read from the followed file at the end of the buffer,
+ * split in lines like when the file is loaded, without touching the
+ * cursor, the view or the modified state. */
+static void editorFollowAppend(const char *buf, size_t len) {
+    int dirty = E.dirty;
+    const char *p = buf, *end = buf+len;
+    while (p < end) {
+        const char *nl = (const char*) memchr(p,'\n',end-p);
+        const char *next = nl ? nl+1 : end;
+        editorOpenLine(p,next-p);
+        p = next;
+    }
+    E.dirty = dirty;
+}
+
+/* Load up to 'max' bytes appended to the followed file. Returns true if
+ * anything was loaded. */
+static int editorFollowRead(int64_t max) {
+    static std::vector<char> buf(KILO_FOLLOW_CHUNK);
+    int atbottom = E.rowoff+E.cy >= E.numrows-1;
+    int64_t total = 0;
+    ssize_t n;
+
+    PROFILE_ZONE("editorFollowRead");
+    while (total < max &&
+           (n = pread(E.followfd,buf.data(),buf.size(),E.disk.size)) > 0)
+    {
+        /* A "\r" last may be the start of a "\r\n": it is read again
+         * with what follows it. */
+        if (buf[n-1] == '\r' && --n == 0) break;
+        editorFollowAppend(buf.data(),n);
+        E.disk.size += n;
+        total += n;
+    }
+    follow_pending = total >= max;
+    if (total && atbottom) editorSetCursor(E.numrows ? E.numrows-1 : 0,0);
+    return total > 0;
+}
+
+/* Start following the current file. Returns 0 on success, 1 on error. */
+int editorFollowStart(void) {
+    if (E.follow) return 0;
+    if (editorReadOnly()) return 1;
+    if (E.disk.gzip) {
+        editorSetStatusMessage("Can't follow a compressed file");
+        return 1;
+    }
+    int fd = open(E.filename,O_RDONLY|O_CLOEXEC);
+    if (fd == -1) {
+        editorSetStatusMessage("Can't follow: %s",strerror(errno));
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd,&st) == 0) editorDiskStat(&st);
+    fileWatchStart(E.watch,E.filename);
+    E.follow = 1;
+    E.followfd = fd;
+    editorGutterStop();     /* The rows are the file, as it grows. */
+    follow_pending = 1; /* Load what was appended since the file was read. */
+    editorSetCursor(E.numrows ? E.numrows-1 : 0,0);
+    return 0;
+}
+
+void editorFollowStop(void) {
+    if (!E.follow) return;
+    close(E.followfd);
+    E.followfd = -1;
+    E.follow = 0;
+    editorGutterStart();
+}
+
+/* Called periodically while following: load what changed in the file since
+ * the last call. Returns true if the buffer changed. */
+int editorFollowPoll(void) {
+    if (!E.follow) return 0;
+    int events = fileWatchPoll(E.watch);
+    if ((!events && !follow_pending) || E.disk.stale) return 0;
+
+    int changed = 0;
+    struct stat st;
+    if (stat(E.filename,&st) == 0 &&
+        (st.st_dev != E.disk.dev || st.st_ino != E.disk.ino))
+    {
+        int fd = open(E.filename,O_RDONLY|O_CLOEXEC);
+        if (fd != -1) {
+            changed |= editorFollowRead(INT64_MAX);
+            close(E.followfd);
+            E.followfd = fd;
+            editorDiskStat(&st);
+            E.disk.size = 0;
+            E.disk.partial = 0;
+            editorSetStatusMessage("File replaced, following the new one");
+        }
+    }
+
+    if (fstat(E.followfd,&st) == -1) return changed;
+    if (st.st_size < E.disk.size) {
+        /* Unsaved changes are not thrown away: the user decides, as when
+         * the file changes on disk while not following it. */
+        if (E.dirty) {
+            E.disk.stale = 1;
+            editorSetStatusMessage("File truncated on disk! "
+                "Ctrl-R reloads it, Ctrl-S overwrites it");
+            return 1;
+        }
+        editorClearRows();
+        E.cx = E.cy = E.rowoff = E.coloff = E.wrapoff = 0;
+        E.disk.size = 0;
+        E.disk.partial = 0;
+        E.dirty = 0;
+        editorSetStatusMessage("File truncated, loaded again");
+        changed = 1;
+    }
+    changed |= editorFollowRead(KILO_FOLLOW_MAX);
+    editorDiskStat(&st);
+    return changed;
+}
+
+/* ============================= External changes =============================
+ *
+ * The file is watched from the moment it is opened. When it changes on disk
+ * and there are no unsaved changes, it is loaded again, but instead of
+ * replacing the whole buffer the new lines are diffed against the rows:
+ * after stripping the common prefix and suffix, the lines left are hashed
+ * and compared with diffLines(), and only the rows in the resulting hunks
+ * are freed, created, rendered and highlighted. The cursor and the view
+ * stay on the same text, so reloading a large file after a small change
+ * costs about as much as the change, plus a linear scan comparing rows. */
+
+#define KILO_DIFF_MAXD 4096 /* Past this many changed lines replace them all. */
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
+struct editorLine {
+    const char *s;
+    int len;
+};
+
+/* Move rows [from,to) up or down by 'shift' rows, renumbering them. */
+static void editorShiftRows(int from, int to, int shift) {
+    if (!shift || from == to) return;
+    memmove(E.row+from+shift,E.row+from,sizeof(erow)*(to-from));
+    for (int j = from+shift; j < to+shift; j++) E.row[j].idx = j;
+}
+
+/* Replace the rows in 'hunks' with the new lines they refer to, 'lines'
+ * starting at new row 'first'. The unchanged rows are moved in place: the
+ * runs between hunks going up are moved first to last, then the ones going
+ * down last to first, so that no run overwrites one still to be moved.
+ * Only the new rows are rendered, and the highlight is only updated from
+ * each hunk on while it changes. */
+static void editorPatchRows(const std::vector<diffHunk> &hunks,
+                            const editorLine *lines, int first)
+{
+    int delta = 0, shifted = 0, nh = hunks.size();
+    for (auto &h : hunks) {
+        for (int j = h.a; j < h.a+h.alen; j++) editorFreeRow(E.row+j);
+        delta += h.blen-h.alen;
+        shifted |= h.blen != h.alen;
+    }
+    int numrows = E.numrows+delta;
+    if (delta > 0) E.row = (erow*) realloc(E.row,sizeof(erow)*numrows);
+
+    /* Run i goes from the end of hunk i-1 to the start of hunk i. */
+    auto runStart = [&](int i) {
+        return i ? hunks[i-1].a+hunks[i-1].alen : 0;
+    };
+    auto runEnd = [&](int i) { return i < nh ? hunks[i].a : E.numrows; };
+    for (int i = 0, shift = 0; i <= nh; i++) {
+        if (shift < 0) editorShiftRows(runStart(i),runEnd(i),shift);
+        if (i < nh) shift += hunks[i].blen-hunks[i].alen;
+    }
+    for (int i = nh, shift = delta; i >= 0; i--) {
+        if (shift > 0) editorShiftRows(runStart(i),runEnd(i),shift);
+        if (i) shift -= hunks[i-1].blen-hunks[i-1].alen;
+    }
+
+    for (auto &h : hunks) {
+        for (int j = h.b; j < h.b+h.blen; j++) {
+            const editorLine *l = lines+j-first;
+            memcpy(editorInitRow(E.row+j,j,l->len),l->s,l->len);
+        }
+    }
+    if (delta < 0 && numrows)
+        E.row = (erow*) realloc(E.row,sizeof(erow)*numrows);
+    E.numrows = numrows;
+
+    /* If no row moved, the indexes are updated row by row. The blocks of
+     * the word index are resized hunk by hunk. */
+    if (shifted) editorIndexInvalidate(hunks[0].a);
+    for (auto &h : hunks) {
+        editorWordsRowsRemoved(h.b,h.alen);
+        editorWordsRowsInserted(h.b,h.blen);
+        editorGutterEdit(h.b,h.alen,h.blen);
+    }
+    for (auto &h : hunks)
+        for (int j = h.b; j < h.b+h.blen; j++) editorUpdateRender(E.row+j);
+    for (auto &h : hunks) {
+        if (h.b < E.numrows)
+            editorUpdateSyntaxRange(h.b,std::min(h.b+h.blen,E.numrows-1));
+    }
+}
+
+/* Row where row 'filerow' ends up after applying 'hunks'. A changed row
+ * maps to the row that replaced it, or to the next one if it was removed. */
+static int editorPatchMapRow(const std::vector<diffHunk> &hunks, int filerow) {
+    int shift = 0;
+    for (auto &h : hunks) {
+        if (filerow < h.a) break;
+        if (filerow < h.a+h.alen)
+            return h.b + std::min(filerow-h.a,std::max(h.blen-1,0));
+        shift = h.b+h.blen - (h.a+h.alen);
+    }
+    return filerow+shift;
+}
+
+/* Return true if the file on disk is not the one that was loaded or saved
+ * last. */
+int editorDiskChanged(void) {
+    struct stat st;
+    if (!E.filename || stat(E.filename,&st) == -1) return 0;
+    return st.st_dev != E.disk.dev || st.st_ino != E.disk.ino ||
+           st.st_size != E.disk.size || editorStatMtime(&st) != E.disk.mtime;
+}
+
+/* Load the file again, changing only the rows that differ from it, and
+ * losing the unsaved changes. Returns 0 on success, 1 on error. */
+int editorReload(void) {
+    PROFILE_ZONE("editorReload");
+    if (editorReadOnly()) return 1;
+    int fd = open(E.filename,O_RDONLY|O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd,&st) == -1) {
+        editorSetStatusMessage("Can't reload: %s",strerror(errno));
+        if (fd != -1) close(fd);
+        return 1;
+    }
+    size_t len = st.st_size;
+    char *buf = NULL;
+    int gzip = gzipIsCompressed(E.filename,fd);
+    std::string inflated;
+    if (gzip) {
+        /* Compressed files are inflated in memory first. */
+        gzipStream gz;
+        std::string chunk;
+        int ret;
+        gzipStreamStart(gz,fd);
+        while ((ret = gzipStreamRead(gz,chunk)) == 1) inflated += chunk;
+        gzipStreamStop(gz);
+        if (ret == -1) {
+            editorSetStatusMessage("Can't reload: %s",gz.error.c_str());
+            close(fd);
+            return 1;
+        }
+        buf = &inflated[0];
+        len = inflated.size();
+    } else if (len) {
+        buf = (char*) mmap(NULL,len,PROT_READ,MAP_PRIVATE|MAP_POPULATE,fd,0);
+        if (buf == MAP_FAILED) {
+            editorSetStatusMessage("Can't reload: %s",strerror(errno));
+            close(fd);
+            return 1;
+        }
+    }
+
+    /* Skip the rows equal to the lines at the start and at the end of the
+     * file, comparing them with the file in place. Lines are split like
+     * editorOpen() does, and the last one is only matched at the end when
+     * it ends with a newline. */
+    const char *p = buf, *end = buf+len;
+    int pre = 0, suf = 0;
+    while (pre < E.numrows) {
+        erow *row = E.row+pre;
+        if (end-p <= row->size || p[row->size] != '\n' ||
+            memcmp(p,editorRowChars(row),row->size)) break;
+        p += row->size+1;
+        pre++;
+    }
+    while (suf < E.numrows-pre && end > p && end[-1] == '\n') {
+        erow *row = E.row+E.numrows-1-suf;
+        const char *s = end-1-row->size;
+        if (s < p || (s > p && s[-1] != '\n') ||
+            memcmp(s,editorRowChars(row),row->size)) break;
+        end = s;
+        suf++;
+    }
+
+    /* Diff the rows left with the lines in between. */
+    std::vector<editorLine> lines;
+    while (p < end) {
+        const char *nl = (const char*) memchr(p,'\n',end-p);
+        const char *next = nl ? nl+1 : end;
+        int l = next-p;
+        if (p[l-1] == '\n' || p[l-1] == '\r') l--;
+        lines.push_back({p,l});
+        p = next;
+    }
+    int a = E.numrows-pre-suf, b = lines.size();
+    std::vector<uint64_t> ha(a), hb(b);
+    for (int k = 0; k < a; k++)
+        ha[k] = diffHash(editorRowChars(E.row+pre+k),E.row[pre+k].size);
+    for (int k = 0; k < b; k++)
+        hb[k] = diffHash(lines[k].s,lines[k].len);
+    std::vector<diffHunk> hunks;
+    auto eq = [&](int i, int j) {
+        erow *row = E.row+pre+i;
+        return ha[i] == hb[j] && row->size == lines[j].len &&
+               !memcmp(editorRowChars(row),lines[j].s,row->size);
+    };
+    if (diffLines(a,b,eq,hunks,KILO_DIFF_MAXD) == -1)
+        hunks.assign(1,diffHunk{0,a,0,b});
+    int removed = 0, added = 0;
+    for (auto &h : hunks) {
+        h.a += pre;
+        h.b += pre;
+        removed += h.alen;
+        added += h.blen;
+    }
+
+    /* Patch the rows, keeping the cursor and the view on the same text. The
+     * gutter compares them with the file from now on: the rows taken as
+     * the old file are patched into the new one. */
+    editorGutterSaved();
+    int filerow = E.rowoff+E.cy, filecol = editorCursorOffset();
+    int rowoff = editorPatchMapRow(hunks,E.rowoff);
+    filerow = editorPatchMapRow(hunks,filerow);
+    editorPatchRows(hunks,lines.data(),pre);
+    E.rowoff = rowoff;
+    if (rowoff >= E.numrows ||
+        E.wrapoff >= editorRowVisualLines(E.row+rowoff)) E.wrapoff = 0;
+    if (filerow < E.numrows && filecol > E.row[filerow].size)
+        filecol = E.row[filerow].size;
+    editorSetCursor(filerow,filecol);
+
+    editorDiskStat(&st);
+    E.disk.size = st.st_size;
+    E.disk.partial = len && buf[len-1] != '\n';
+    E.disk.gzip = gzip;
+    E.disk.stale = 0;
+    editorUndoClear();
+    E.dirty = 0;
+    editorGutterSaved();
+    if (len && !gzip) munmap(buf,len);
+    close(fd);
+    editorSetStatusMessage("Reloaded: %d lines removed, %d added",
+        removed,added);
+    return 0;
+}
+
+/* Called periodically: reload the file if it changed on disk, or tell the
+ * user if there are unsaved changes. Follow mode has its own way to load
+ * changes. Returns true if the buffer or the status changed. */
+int editorCheckDisk(void) {
+    if (!E.filename || E.follow || E.view || E.results ||
+        E.filter.pid != -1 || !fileWatchPoll(E.watch))
+        return 0;
+    if (!editorDiskChanged()) return 0;
+    if (!E.dirty) return editorReload() == 0;
+    if (E.disk.stale) return 0;
+    E.disk.stale = 1;
+    editorSetStatusMessage("File changed on disk! "
+        "Ctrl-R reloads it, Ctrl-S overwrites it");
+    return 1;
+}
+
+/* ============================= Read only view =============================
+ *
+ * Files larger than a quarter of the memory are not loaded: they are shown
+ * read only, E.row holding just a window of rows around the cursor, loaded
+ * again around it when it gets close to an edge of the window. The window
+ * has at most KILO_VIEW_ROWS rows and KILO_VIEW_BYTES bytes past the
+ * cursor, and as much before it, and lines longer than KILO_VIEW_MAXLINE
+ * are split in more rows, so memory stays bounded whatever the file.
+ *
+ * A background thread builds a sparse index of the lines (lineindex.h), so
+ * that going to a line reads at most LINEINDEX_EVERY lines from the closest
+ * mark. Going to a byte offset, or a percentage of the file, does not need
+ * the index, but the line number there is only known once the index got
+ * that far. Search reads the file sequentially in large chunks. */
+
+#define KILO_VIEW_ROWS 4096
+#define KILO_VIEW_BYTES (8<<20)
+#define KILO_VIEW_MAXLINE (64<<10)
+#define KILO_VIEW_CHUNK (4<<20)         /* Bytes read at a time. */
+#define KILO_VIEW_FIND_MAX (256<<20)    /* Bytes searched per call. */
+
+/* Refuse to change a read only view, or rows being filtered, telling the
+ * user. */
+static int editorReadOnly(void) {
+    if (E.results) {
+        editorSetStatusMessage("Search results are read only");
+        return 1;
+    }
+    if (E.filter.pid != -1) {
+        editorSetStatusMessage("Filtering through %s, ESC cancels",
+            E.filter.cmd.c_str());
+        return 1;
+    }
+    if (!E.view) return 0;
+    editorSetStatusMessage("Read only view of a large file");
+    return 1;
+}
+
+/* Files at least this large are opened in a read only view, as the rows
+ * take a few times the size of the file in memory. */
+static int64_t editorViewThreshold(void) {
+    long pages = sysconf(_SC_PHYS_PAGES), pagesize = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || pagesize <= 0) return (int64_t) 1 << 30;
+    return (int64_t) pages*pagesize/4;
+}
+
+static std::vector<char> &editorViewBuffer(void) {
+    static thread_local std::vector<char> buf(KILO_VIEW_CHUNK);
+    return buf;
+}
+
+/* Going back from 'offset', find 'lines' newlines and return where the
+ * line after the last one found starts: with 'lines' set to 1, the start of
+ * the line containing 'offset'. Stops at the start of the file, or after
+ * 'maxbytes', returning the start of the last line found, or 'offset' if
+ * none was. */
+static int64_t editorViewLinesBefore(int64_t offset, int lines,
+                                     int64_t maxbytes)
+{
+    std::vector<char> &buf = editorViewBuffer();
+    int64_t start = offset, pos = offset;
+    int64_t limit = std::max<int64_t>(0,offset-maxbytes);
+    int found = 0;
+
+    while (pos > limit) {
+        int64_t from = std::max<int64_t>(limit,pos-(int64_t) buf.size());
+        if (pread(E.view->fd,buf.data(),pos-from,from) != pos-from) break;
+        for (int64_t j = pos-from-1; j >= 0; j--) {
+            if (buf[j] != '\n') continue;
+            start = from+j+1;
+            if (++found == lines) return start;
+        }
+        pos = from;
+    }
+    return pos == 0 ? 0 : start;
+}
+
+/* Number of newlines in the file between 'from' and 'to', or -1 if there
+ * are too many bytes to read. */
+static int64_t editorViewCountLines(int64_t from, int64_t to) {
+    std::vector<char> &buf = editorViewBuffer();
+    int64_t count = 0;
+    if (to-from > KILO_VIEW_FIND_MAX) return -1;
+    while (from < to) {
+        ssize_t n = pread(E.view->fd,buf.data(),
+                          std::min<int64_t>(buf.size(),to-from),from);
+        if (n <= 0) return -1;
+        for (const char *p = buf.data(), *end = p+n;
+             (p = (const char*) memchr(p,'\n',end-p)) != NULL; p++) count++;
+        from += n;
+    }
+    return count;
+}
+
+/* Line containing byte 'offset', or -1 if the index did not get there. */
+static int64_t editorViewLineAt(int64_t offset) {
+    int64_t markline;
+    int64_t mark = lineIndexFindOffset(E.view->index,offset,&markline,
+                                       NULL);
+    if (mark == -1) return -1;
+    int64_t count = editorViewCountLines(mark,offset);
+    return count == -1 ? -1 : markline+count;
+}
+
+/* True if row 'j' of the window starts a line, rather than continuing a
+ * line split because it was too long. */
+static int editorViewRowStartsLine(int j) {
+    return j == 0 || E.view->off[j] != E.view->off[j-1]+E.row[j-1].size;
+}
+
+static void editorViewAddRow(int64_t offset, const char *s, size_t len) {
+    E.view->off.push_back(offset);
+    editorInsertRow(E.numrows,(char*) s,len);
+}
+
+/* Load the window of rows from 'start', a line start, up to the rows
+ * around 'cursor'. */
+static void editorViewLoad(int64_t start, int64_t cursor) {
+    PROFILE_ZONE("editorViewLoad");
+    struct editorView *v = E.view;
+    std::vector<char> &buf = editorViewBuffer();
+    std::string line;
+    int64_t pos = start, linestart = start;
+    int after = 0;   /* Rows past the cursor. */
+
+    /* The first row may start inside a comment. */
+    int state = lineIndexStateAt(v->index,start);
+    v->hlknown = state != -1;
+    v->firstoc = std::max(state,0);
+
+    editorClearRows();
+    v->off.clear();
+    while (pos < v->size && after < KILO_VIEW_ROWS/2 &&
+           (pos < cursor || pos-cursor < KILO_VIEW_BYTES ||
+            after < E.screenrows))
+    {
+        ssize_t n = pread(v->fd,buf.data(),
+                          std::min<int64_t>(buf.size(),v->size-pos),pos);
+        if (n <= 0) break;
+        const char *p = buf.data(), *end = p+n;
+        while (p < end && after < KILO_VIEW_ROWS/2) {
+            const char *nl = (const char*) memchr(p,'\n',end-p);
+            const char *stop = nl ? nl : end;
+            size_t take = std::min<size_t>(stop-p,
+                                           KILO_VIEW_MAXLINE-line.size());
+            line.append(p,take);
+            p += take;
+            if (line.size() == KILO_VIEW_MAXLINE && p < end && p != nl) {
+                /* Split the line, the rest goes in the next row. */
+            } else if (nl) {
+                p = nl+1;
+            } else {
+                break;
+            }
+            editorViewAddRow(linestart,line.data(),line.size());
+            if (linestart > cursor) after++;
+            linestart = pos+(p-buf.data());
+            line.clear();
+        }
+        pos += p-buf.data();
+    }
+    if (pos >= v->size && linestart < v->size)
+        editorViewAddRow(linestart,line.data(),line.size());
+    v->off.push_back(pos >= v->size ? v->size : linestart);
+    E.dirty = 0;
+}
+
+/* Load the window around byte 'cursor' and put the cursor there, on screen
+ * row 'screeny'. 'line' is the line containing 'cursor', or -1 if unknown. */
+static void editorViewShow(int64_t cursor, int64_t line, int screeny) {
+    struct editorView *v = E.view;
+    if (cursor > v->size) cursor = v->size;
+    if (cursor < 0) cursor = 0;
+    int64_t start = editorViewLinesBefore(cursor,KILO_VIEW_ROWS/2,
+                                          KILO_VIEW_BYTES);
+    editorViewLoad(start,cursor);
+
+    int filerow = std::upper_bound(v->off.begin(),v->off.end()-1,cursor) -
+                  v->off.begin() - 1;
+    if (filerow < 0) filerow = 0;
+    if (line != -1) {
+        for (int j = 1; j <= filerow && j < E.numrows; j++)
+            if (editorViewRowStartsLine(j)) line--;
+        v->line = line;
+    } else {
+        v->line = editorViewLineAt(v->off[0]);
+    }
+
+    int filecol = cursor - v->off[filerow];
+    if (filerow < E.numrows && filecol > E.row[filerow].size)
+        filecol = E.row[filerow].size;
+    if (screeny >= E.screenrows) screeny = E.screenrows-1;
+    E.rowoff = std::max(0,filerow-std::max(screeny,0));
+    E.cy = filerow-E.rowoff;
+    E.wrapoff = 0;
+    editorSetCursor(filerow,filecol);
+}
+
+/* Open comment state at the end of a row of a view, as the highlighter
+ * finds it highlighting the 'len' bytes of 's' after a row ending in state
+ * 'state'. Runs in the index thread too: it only reads the syntax. */
+static int editorViewRowState(struct editorSyntax *syn, const char *s,
+                              size_t len, int state)
+{
+    static thread_local std::string render;
+    static thread_local std::vector<unsigned char> hl;
+    /* TABs are the only difference with the rendered row that matters. */
+    render.assign(s,len);
+    std::replace(render.begin(),render.end(),'\t',' ');
+    hl.resize(len);
+    return editorHighlightText(syn,&render[0],len,hl.data(),state);
+}
+
+/* Start indexing the lines of the view, with the highlighter state at every
+ * mark if the syntax has multi line comments, from the cache if there is a
+ * valid one. */
+static void editorViewIndexStart(const char *filename, struct stat *st) {
+    lineIndex &ix = E.view->index;
+    struct editorSyntax *syn = E.syntax;
+    if (syn && syn->multiline_comment_start[0]) {
+        ix.linestate = [syn](const char *s, size_t len, int state) {
+            return editorViewRowState(syn,s,len,state);
+        };
+        ix.maxline = KILO_VIEW_MAXLINE;
+        ix.statekey = diffHash(syn->filematch[0],strlen(syn->filematch[0]));
+    }
+    if (!E.nocache) ix.cachepath = lineIndexCachePath(filename);
+    lineIndexStart(ix,E.view->fd,st->st_size,editorStatMtime(st));
+}
+
+/* Open 'filename' in a read only view. Returns 0 on success, 1 on error. */
+int editorViewOpen(char *filename) {
+    editorViewClose();
+    int fd = open(filename,O_RDONLY|O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd,&st) == -1) {
+        if (fd != -1) close(fd);
+        throw Exception("Opening file");
+    }
+    if (gzipIsCompressed(filename,fd)) {
+        /* Compressed files can't be read at random offsets. */
+        close(fd);
+        editorClearRows();
+        return editorOpen(filename);
+    }
+    free(E.filename);
+    E.filename = strdup(filename);
+    memset(&E.disk,0,sizeof(E.disk));
+    editorDiskStat(&st);
+    E.disk.size = st.st_size;
+
+    E.view = new editorView;
+    E.view->fd = fd;
+    E.view->size = st.st_size;
+    E.view->line = 0;
+    E.view->firstoc = 0;
+    char last;
+    E.disk.partial = st.st_size && pread(fd,&last,1,st.st_size-1) == 1 &&
+                     last != '\n';
+    editorViewIndexStart(filename,&st);
+    editorViewShow(0,0,0);
+    editorSetStatusMessage("Read only view of a %lld MB file%s",
+        (long long) (st.st_size >> 20),
+        E.view->index.cached ? ", index from cache" : "");
+    return 0;
+}
+
+void editorViewClose(void) {
+    if (!E.view) return;
+    lineIndexStop(E.view->index);
+    close(E.view->fd);
+    delete E.view;
+    E.view = NULL;
+    editorClearRows();
+}
+
+/* Called periodically: move the window when the cursor gets close to one
+ * of its edges, and find the line numbers once the index gets there.
+ * Returns true if the screen needs to be updated. */
+int editorViewPoll(void) {
+    struct editorView *v = E.view;
+    if (!v) return 0;
+    int changed = 0;
+    if (v->line == -1) {
+        v->line = editorViewLineAt(v->off[0]);
+        changed = v->line != -1;
+    }
+    if (!v->hlknown) {
+        int state = lineIndexStateAt(v->index,v->off[0]);
+        if (state != -1) {
+            v->hlknown = 1;
+            if (state != v->firstoc) {
+                v->firstoc = state;
+                if (E.numrows) editorUpdateSyntaxRange(0,0);
+                changed = 1;
+            }
+        }
+    }
+
+    int filerow = E.rowoff+E.cy;
+    int margin = std::min(KILO_VIEW_ROWS/4,E.numrows/4);
+    int top = filerow < margin && v->off[0] > 0;
+    int bottom = filerow+margin >= E.numrows && v->off.back() < v->size;
+    if (!top && !bottom) return changed;
+
+    /* Going up, a line too long to find its start stops the window. */
+    int64_t cursor = editorCursorFileOffset();
+    if (!bottom && editorViewLinesBefore(cursor,KILO_VIEW_ROWS/2,
+                                         KILO_VIEW_BYTES) == v->off[0])
+        return changed;
+    editorViewShow(cursor,editorViewCursorLine(),E.cy);
+    return 1;
+}
+
+/* Line of the cursor, 0 based, or -1 if not known yet. */
+int64_t editorViewCursorLine(void) {
+    struct editorView *v = E.view;
+    if (!v || v->line == -1) return -1;
+    int filerow = std::min(E.rowoff+E.cy,E.numrows-1);
+    int64_t line = v->line;
+    for (int j = 1; j <= filerow; j++)
+        if (editorViewRowStartsLine(j)) line++;
+    return line;
+}
+
+/* Lines in the file, or so far if the index is not done, setting '*done'. */
+int64_t editorViewLines(int *done) {
+    int64_t scanned, lines;
+    *done = lineIndexProgress(E.view->index,&scanned,&lines);
+    if (*done && E.disk.partial) lines++;
+    return lines;
+}
+
+/* Show line 'line', 0 based, in the middle of the screen. Lines the index
+ * did not get to yet are reached as far as possible. */
+void editorViewGotoLine(int64_t line) {
+    struct editorView *v = E.view;
+    std::vector<char> &buf = editorViewBuffer();
+    int64_t cur, pos = lineIndexFindLine(v->index,line,&cur);
+
+    /* Skip the lines from the mark, at most the lines between two marks. */
+    int64_t target = std::min<int64_t>(line,cur+LINEINDEX_EVERY);
+    for (int64_t rd = pos; cur < target && rd < v->size; ) {
+        ssize_t n = pread(v->fd,buf.data(),
+                          std::min<int64_t>(buf.size(),v->size-rd),rd);
+        if (n <= 0) break;
+        const char *p = buf.data(), *end = p+n, *nl;
+        while (cur < target && (nl = (const char*) memchr(p,'\n',end-p))) {
+            p = nl+1;
+            cur++;
+            pos = rd+(p-buf.data());
+        }
+        rd += n;
+    }
+    if (cur < line) {
+        int done;
+        editorViewLines(&done);
+        if (!done)
+            editorSetStatusMessage("Line %lld is not indexed yet",
+                (long long) line+1);
+    }
+    editorViewShow(pos,cur,E.screenrows/2);
+}
+
+/* Show byte 'offset' in the middle of the screen. */
+void editorViewGotoOffset(int64_t offset) {
+    editorViewShow(offset,editorViewLineAt(offset),E.screenrows/2);
+}
+
+/* Search 'query' in the file from byte 'from', forward if 'dir' is 1, or
+ * backward before it if -1, reading it sequentially in large chunks.
+ * Returns the offset of the match, or -1 if there is none in the next
+ * KILO_VIEW_FIND_MAX bytes, setting '*next' to where to go on from, or to
+ * -1 when the end (or the start) of the file was reached. */
+int64_t editorViewFind(const char *query, int64_t from, int dir,
+                       int64_t *next)
+{
+    PROFILE_ZONE("editorViewFind");
+    struct editorView *v = E.view;
+    std::vector<char> &buf = editorViewBuffer();
+    int64_t qlen = strlen(query), scanned = 0, pos = from;
+
+    *next = -1;
+    if (qlen == 0 || qlen > (int64_t) buf.size()/2) return -1;
+    while (scanned < KILO_VIEW_FIND_MAX) {
+        /* Chunks overlap by qlen-1 bytes, not to miss matches across. */
+        int64_t lo, hi;
+        if (dir > 0) {
+            if (pos >= v->size) return -1;
+            lo = pos;
+            hi = std::min<int64_t>(v->size,pos+buf.size());
+        } else {
+            if (pos <= 0) return -1;
+            lo = std::max<int64_t>(0,pos-(int64_t) buf.size()+qlen);
+            hi = std::min<int64_t>(v->size,pos+qlen-1);
+        }
+        if (pread(v->fd,buf.data(),hi-lo,lo) != hi-lo) return -1;
+
+        const char *p = buf.data(), *end = p+(hi-lo), *m, *last = NULL;
+        while ((m = (const char*) memmem(p,end-p,query,qlen)) != NULL) {
+            if (dir > 0) return lo+(m-buf.data());
+            if (lo+(m-buf.data()) >= pos) break;
+            last = m;
+            p = m+1;
+        }
+        if (last) return lo+(last-buf.data());
+
+        if (dir > 0) {
+            if (hi == v->size) return -1;
+            scanned += hi-qlen+1-pos;
+            pos = hi-qlen+1;
+        } else {
+            scanned += pos-lo;
+            pos = lo;
+        }
+    }
+    *next = pos;
+    return -1;
+}
+
+/* Set an editor status message for the second line of the status, at the
+ * end of the screen. */
+void editorSetStatusMessage(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap,fmt);
+    vsnprintf(E.statusmsg,sizeof(E.statusmsg),fmt,ap);
+    va_end(ap);
+    E.statusmsg_time = time(NULL);
+}
+
+/* ================================ Buffers =================================
+ *
+ * Several files can be open at once, each in a buffer with its own rows,
+ * cursor, syntax and dirty state. The state of the buffers not shown is
+ * kept aside, and switching moves it in and out of E, so nothing is
+ * highlighted or laid out again. The frontend's font and glyph cache are
+ * shared by all of them.
+ *
+ * Files are opened by a background thread running the same code as for
+ * the first one: E is thread local, so the loader fills its own E and then
+ * hands it over. Until then the buffer can't be shown. Buffers that are
+ * not shown are not checked for changes on disk, nor followed: their file
+ * watch keeps the events until they are shown again. */
+
+struct editorBuffer {
+    struct editorConfig ed;     /* Editor state, while not shown. */
+    std::string filename;       /* As given to editorBufferOpen(). */
+    int show;                   /* Switch to it once loaded. */
+    int gotorow = -1;           /* Where to put the cursor once shown, see */
+    int gotocol = 0;            /* editorBufferOpenAt(). */
+    std::atomic<bool> loading{false};
+    std::string error;          /* Why it could not be opened. */
+    std::thread loader;
+};
+
+static std::vector<editorBuffer*> buffers;  /* buffers[curbuf] is in E. */
+static int curbuf;
+
+/* The first buffer is the file opened the usual way, already in E. */
+static void editorBufferInit(void) {
+    if (!buffers.empty()) return;
+    editorBuffer *b = new editorBuffer;
+    b->filename = E.filename ? E.filename : "";
+    b->show = 0;
+    buffers.push_back(b);
+    curbuf = 0;
+}
+
+/* Open 'filename' (in a read only view if 'view' is true) in a new editor
+ * state of the calling thread, a background one. Sets 'error' if it could
+ * not be opened. */
+static void editorLoad(const std::string &name, int view, int screenrows,
+                       int screencols, int nocache, std::string &error)
+{
+    profileMuted = true;
+    initEditor(screenrows,screencols);
+    E.nocache = nocache;
+    char *filename = strdup(name.c_str());
+    try {
+        editorSelectSyntaxHighlight(filename);
+        if (view)
+            editorViewOpen(filename);
+        else
+            editorOpen(filename);
+    } catch (const std::exception &e) {
+        error = e.what();
+        editorViewClose();
+        editorClearRows();
+        fileWatchStop(E.watch);
+    }
+    free(filename);
+}
+
+/* Background thread: open the file of 'b' in a new editor state. */
+static void editorBufferLoad(editorBuffer *b, int screenrows, int screencols,
+                             int nocache)
+{
+    editorLoad(b->filename,0,screenrows,screencols,nocache,b->error);
+    b->ed = std::move(E);
+    b->loading = false;
+}
+
+/* The first file is opened in the background too, while the frontend
+ * starts up, so that its loading and the window creation overlap. If it
+ * takes longer, the first screen of the file is shown meanwhile, see
+ * editorOpenPreview(). */
+#define KILO_PREVIEW_BYTES (64<<10)     /* Read at most for the preview. */
+
+static struct {
+    std::thread loader;
+    std::atomic<bool> loading{false};
+    struct editorConfig ed;
+    std::string error;
+} first;
+
+/* Start opening the first file in the background, as if by editorOpen(),
+ * or editorViewOpen() if 'view' is true. 'screenrows' and 'screencols' are
+ * a guess, see editorOpenWait(). */
+void editorOpenStart(const char *filename, int view, int screenrows,
+                     int screencols, int nocache)
+{
+    first.loading = true;
+    first.loader = std::thread([=]() {
+        editorLoad(filename,view,screenrows,screencols,nocache,first.error);
+        first.ed = std::move(E);
+        first.loading = false;
+    });
+}
+
+/* If the file opened by editorOpenStart() is still loading, fill E with
+ * the rows of its first screen, read directly, so that a frame can be
+ * drawn before it is loaded. Returns true if it did. */
+int editorOpenPreview(const char *filename, int screenrows, int screencols) {
+    PROFILE_ZONE("editorOpenPreview");
+    if (!first.loading) return 0;
+    int fd = open(filename,O_RDONLY|O_CLOEXEC);
+    if (fd == -1) return 0;
+    std::vector<char> buf(KILO_PREVIEW_BYTES);
+    ssize_t n = gzipIsCompressed(filename,fd) ? -1 :
+                read(fd,buf.data(),buf.size());
+    close(fd);
+    if (n <= 0) return 0;
+
+    initEditor(screenrows,screencols);
+    E.filename = strdup(filename);
+    editorSelectSyntaxHighlight(E.filename);
+    const char *p = buf.data(), *end = p+n, *nl;
+    while (E.numrows < screenrows &&
+           (nl = (const char*) memchr(p,'\n',end-p)) != NULL)
+    {
+        editorOpenLine(p,nl+1-p);
+        p = nl+1;
+    }
+    if (E.numrows < screenrows && p < end && n < (ssize_t) buf.size())
+        editorOpenLine(p,end-p);    /* Last line, without a newline. */
+    editorSetStatusMessage("Loading %s...",filename);
+    return 1;
+}
+
+/* Wait for the file opened by editorOpenStart() and show it, resized to
+ * the actual screen. Throws the error that prevented opening it. */
+void editorOpenWait(int screenrows, int screencols) {
+    PROFILE_ZONE("editorOpenWait");
+    first.loader.join();
+    editorClearRows();      /* The preview, if any. */
+    free(E.filename);
+    E = std::move(first.ed);
+    if (!first.error.empty()) throw Exception(first.error);
+    editorResize(screenrows,screencols);
+}
+
+/* Show a new empty buffer, not backed by a file. */
+static void editorBufferScratch(const char *name) {
+    editorBufferInit();
+    int screenrows = E.screenrows, screencols = E.screencols;
+    int nocache = E.nocache;
+    buffers[curbuf]->ed = std::move(E);
+    E = editorConfig();
+    initEditor(screenrows,screencols);
+    E.nocache = nocache;
+    E.filename = strdup(name);
+    editorBuffer *b = new editorBuffer;
+    b->filename = name;
+    b->show = 0;
+    buffers.push_back(b);
+    curbuf = buffers.size()-1;
+}
+
+static int editorBufferFind(const char *filename) {
+    for (int j = 0; j < (int) buffers.size(); j++)
+        if (buffers[j]->filename == filename) return j;
+    return -1;
+}
+
+/* Move the cursor where editorBufferOpenAt() asked, once 'b' is shown. */
+static void editorBufferJump(editorBuffer *b) {
+    if (b->gotorow == -1) return;
+    if (E.view) {
+        editorViewGotoLine(b->gotorow);
+        editorSetCursor(E.rowoff+E.cy,b->gotocol);
+    } else {
+        editorJumpTo(b->gotorow,b->gotocol);
+    }
+    b->gotorow = -1;
+}
+
+/* Open 'filename' in a new buffer, loading it in the background. If 'show'
+ * is true, the new buffer is shown once loaded. A file that is already
+ * open is not loaded again, its buffer is shown. Returns 0 on success, 1
+ * on error. */
+int editorBufferOpen(const char *filename, int show) {
+    editorBufferInit();
+    int j = editorBufferFind(filename);
+    if (j != -1) return show ? editorBufferSwitch(j) : 0;
+    editorBuffer *b = new editorBuffer;
+    b->filename = filename;
+    b->show = show;
+    b->loading = true;
+    b->loader = std::thread(editorBufferLoad,b,E.screenrows,E.screencols,
+                            E.nocache);
+    buffers.push_back(b);
+    editorSetStatusMessage("Loading %s...",filename);
+    return 0;
+}
+
+/* Like editorBufferOpen(), showing the file with the cursor at 'filerow'
+ * and 'filecol' (a byte offset in the row) once loaded. */
+int editorBufferOpenAt(const char *filename, int filerow, int filecol) {
+    editorBufferInit();
+    int j = editorBufferFind(filename);
+    if (j == -1) {
+        editorBufferOpen(filename,1);
+        j = buffers.size()-1;
+    }
+    buffers[j]->gotorow = filerow;
+    buffers[j]->gotocol = filecol;
+    if (buffers[j]->loader.joinable())
+        buffers[j]->show = 1;   /* Once loaded. */
+    else if (j != curbuf)
+        editorBufferSwitch(j);
+    else
+        editorBufferJump(buffers[j]);
+    return 0;
+}
+
+/* Called periodically: take the buffers whose loading ended, showing
+ * them if asked to. Returns true if the screen needs to be updated. */
+int editorBufferPoll(void) {
+    int changed = 0;
+    for (int j = 0; j < (int) buffers.size(); j++) {
+        editorBuffer *b = buffers[j];
+        if (b->loading || !b->loader.joinable()) continue;
+        b->loader.join();
+        changed = 1;
+        if (!b->error.empty()) {
+            editorSetStatusMessage("%s: %s",b->filename.c_str(),
+                b->error.c_str());
+            delete b;
+            buffers.erase(buffers.begin()+j);
+            if (curbuf > j) curbuf--;
+            j--;
+        } else if (b->show) {
+            editorBufferSwitch(j);
+        } else {
+            editorSetStatusMessage("%s loaded in buffer %d",
+                b->filename.c_str(),j+1);
+        }
+    }
+    return changed;
+}
+
+/* Show buffer 'j'. Returns 0 on success, 1 on error. */
+int editorBufferSwitch(int j) {
+    editorBufferInit();
+    if (j < 0 || j >= (int) buffers.size()) return 1;
+    if (j == curbuf) return 0;
+    if (buffers[j]->loader.joinable()) {
+        buffers[j]->show = 1;   /* Once loaded. */
+        editorSetStatusMessage("Still loading %s...",
+            buffers[j]->filename.c_str());
+        return 1;
+    }
+    int screenrows = E.screenrows, screencols = E.screencols;
+    buffers[curbuf]->ed = std::move(E);
+    E = std::move(buffers[j]->ed);
+    E.minimap.redraw = 1;   /* What is drawn is the other buffer. */
+    curbuf = j;
+    buffers[j]->show = 0;
+
+    /* The window may have been resized while it was not shown. */
+    if (E.screenrows != screenrows || E.screencols != screencols)
+        editorResize(screenrows,screencols);
+    follow_pending = E.follow;
+    editorBufferJump(buffers[j]);
+    editorSetStatusMessage("Buffer %d/%d: %s",j+1,(int) buffers.size(),
+        E.filename ? E.filename : "");
+    return 0;
+}
+
+/* Show the next loaded buffer, 'dir' being 1 or -1. */
+int editorBufferNext(int dir) {
+    int n = editorBufferCount();
+    for (int k = 1; k < n; k++) {
+        int j = ((curbuf+dir*k) % n + n) % n;
+        if (!buffers[j]->loader.joinable()) return editorBufferSwitch(j);
+    }
+    editorSetStatusMessage(n > 1 ? "Files still loading" : "No other buffer");
+    return 1;
+}
+
+/* Close the buffer shown, and show another one. The last buffer can't be
+ * closed. Returns 0 on success, 1 on error. */
+int editorBufferClose(void) {
+    int n = editorBufferCount(), next = -1;
+    for (int k = 1; k < n && next == -1; k++) {
+        int j = (curbuf+k) % n;
+        if (!buffers[j]->loader.joinable()) next = j;
+    }
+    if (next == -1) {
+        editorSetStatusMessage(n > 1 ? "Files still loading" :
+                                       "Can't close the last buffer");
+        return 1;
+    }
+    if (E.results) editorGrepStop();
+    editorFilterStop();
+    editorViewClose();
+    editorClearRows();
+    editorFollowStop();
+    fileWatchStop(E.watch);
+    free(E.filename);
+    E.filename = NULL;
+    delete buffers[curbuf];
+    buffers.erase(buffers.begin()+curbuf);
+    if (next > curbuf) next--;
+    curbuf = next;
+
+    int screenrows = E.screenrows, screencols = E.screencols;
+    E = std::move(buffers[curbuf]->ed);
+    E.minimap.redraw = 1;
+    if (E.screenrows != screenrows || E.screencols != screencols)
+        editorResize(screenrows,screencols);
+    follow_pending = E.follow;
+    editorSetStatusMessage("Buffer %d/%d: %s",curbuf+1,(int) buffers.size(),
+        E.filename ? E.filename : "");
+    return 0;
+}
+
+/* Buffers open, and the one shown, counting from 0. */
+int editorBufferCount(void) {
+    return buffers.empty() ? 1 : buffers.size();
+}
+
+int editorBufferCurrent(void) {
+    return curbuf;
+}
+
+/* Number of buffers still loading. */
+int editorBufferLoading(void) {
+    int loading = 0;
+    for (editorBuffer *b : buffers) loading += b->loader.joinable();
+    return loading;
+}
+
+/* Number of buffers with unsaved changes, the one shown included. */
+int editorBufferDirty(void) {
+    int dirty = E.dirty != 0;
+    for (int j = 0; j < (int) buffers.size(); j++) {
+        if (j != curbuf && !buffers[j]->loader.joinable())
+            dirty += buffers[j]->ed.dirty != 0;
+    }
+    return dirty;
+}
+
+/* ============================= Project search =============================
+ *
+ * A search for a string in every file under a directory (see grep.h) shows
+ * the matches in a read only buffer, one "path:line:col: text" row each,
+ * added as they are found while the buffer is shown. Enter on a match
+ * opens its file there, in a buffer of its own. */
+
+#define KILO_GREP_BUFFER "*search*"
+
+static grepSearch grep_search;
+static int grep_running;
+static int64_t grep_matches;
+static uint64_t grep_start;     /* Time the search started. */
+
+/* Search 'query' in the files under 'root', in the search results buffer.
+ * Returns 0 on success, 1 on error. */
+int editorGrepStart(const char *root, const char *query) {
+    if (*query == '\0') return 1;
+    editorGrepStop();
+    if (!E.results) {
+        editorBufferInit();
+        int found = -1;
+        for (int j = 0; j < (int) buffers.size(); j++)
+            if (j != curbuf && buffers[j]->filename == KILO_GREP_BUFFER &&
+                !buffers[j]->loader.joinable()) found = j;
+        if (found != -1)
+            editorBufferSwitch(found);
+        else
+            editorBufferScratch(KILO_GREP_BUFFER);
+        E.results = 1;
+    }
+    editorClearRows();
+    E.cx = E.cy = E.rowoff = E.coloff = E.wrapoff = 0;
+    std::string header = std::string("Searching \"")+query+"\" in "+root;
+    editorInsertRow(0,&header[0],header.size());
+    E.dirty = 0;
+
+    grepStart(grep_search,root,query,0);
+    grep_running = 1;
+    grep_matches = 0;
+    grep_start = profileNow();
+    editorSetStatusMessage("Searching...");
+    return 0;
+}
+
+/* Called periodically: add the matches found since the last call to the
+ * search results, if shown. Returns true if the screen needs to be
+ * updated. */
+int editorGrepPoll(void) {
+    if (!grep_running || !E.results) return 0;
+    std::vector<grepMatch> found;
+    int running = grepPoll(grep_search,found);
+    std::string line;
+    for (auto &m : found) {
+        line = m.path+":"+std::to_string(m.line+1)+":"+
+               std::to_string(m.col+1)+": "+m.text;
+        editorInsertRow(E.numrows,&line[0],line.size());
+    }
+    grep_matches += found.size();
+    E.dirty = 0;
+    if (!running) {
+        grep_running = 0;
+        editorSetStatusMessage("%lld matches in %lld files (%lld MB) "
+            "in %.0f ms", (long long) grep_matches,
+            (long long) grep_search.files, (long long) (grep_search.bytes>>20),
+            (profileNow()-grep_start)/1e6);
+    }
+    return !found.empty() || !running;
+}
+
+void editorGrepStop(void) {
+    grepStop(grep_search);
+    grep_running = 0;
+}
+
+int editorGrepRunning(void) {
+    return grep_running;
+}
+
+/* Open the file of the match under the cursor, in the search results.
+ * Returns 0 on success, 1 if there is no match there. */
+int editorGrepOpen(void) {
+    int filerow = E.rowoff+E.cy;
+    if (!E.results || filerow >= E.numrows) return 1;
+
+    /* The path may contain colons, the line and column follow the first
+     * one that is followed by them. */
+    char *chars = editorRowChars(E.row+filerow);
+    for (char *p = chars; (p = strchr(p,':')) != NULL; p++) {
+        if (!isdigit(p[1])) continue;
+        char *end;
+        long line = strtol(p+1,&end,10);
+        if (*end != ':' || !isdigit(end[1])) continue;
+        long col = strtol(end+1,&end,10);
+        if (*end != ':') continue;
+        std::string path(chars,p-chars);
+        return editorBufferOpenAt(path.c_str(),line-1,col-1);
+    }
+    return 1;
+}
+
+/* ================================ Minimap =================================
+ *
+ * The minimap is drawn from E.minimap.pixels, built from the row summaries
+ * that are computed along with the highlight, see editorRowSummarize(). A
+ * pixel row covers 'scale' file rows, the smallest power of two that fits
+ * the whole file, so that editing a row only changes the pixel row that
+ * covers it, while adding or removing rows changes the pixel rows from
+ * there to the end. Only these are built again, in time proportional to the
+ * rows they cover, and the tiles they are in reported to the caller. A
+ * change of the height or of the scale builds everything again. */
+
+/* The summary of 'row' changed, or it is a new row: its pixel row needs to
+ * be built again. */
+static void editorMinimapRowChanged(erow *row) {
+    struct editorMinimap &m = E.minimap;
+    if (!m.height) return;
+    size_t y = row->idx/m.scale;
+    if (y < m.stale.size()) m.stale[y] = 1;
+}
+
+/* Rows from 'from' on were added or removed: their pixel rows need to be
+ * built again. */
+static void editorMinimapRowsMoved(int from) {
+    struct editorMinimap &m = E.minimap;
+    if (m.moved == -1 || from < m.moved) m.moved = from;
+}
+
+/* Build pixel row 'y'. The rows covering every cell, and how many of them
+ * are of each class, are counted as differences from the cell before, so
+ * that every row costs the same whatever its length. */
+static void editorMinimapBuildRow(int y) {
+    struct editorMinimap &m = E.minimap;
+    int cover[MINIMAP_WIDTH+1];
+    int count[HL_MATCH+1][MINIMAP_WIDTH+1];
+    unsigned char *pixel = m.pixels.data()+(size_t) y*MINIMAP_WIDTH;
+    int from = y*m.scale, to = std::min(from+m.scale,E.numrows);
+    int used = 0;   /* Classes seen, a bit each. */
+
+    memset(cover,0,sizeof(cover));
+    for (int j = from; j < to; j++) {
+        unsigned short mini = E.row[j].mini;
+        if (!mini) continue;
+        int hl = MINIMAP_HL(mini);
+        int first = MINIMAP_FIRST(mini), end = MINIMAP_END(mini);
+        if (!(used & 1<<hl)) {
+            memset(count[hl],0,sizeof(count[hl]));
+            used |= 1<<hl;
+        }
+        cover[first]++;
+        cover[end]--;
+        count[hl][first]++;
+        count[hl][end]--;
+    }
+
+    int rows = 0, n[HL_MATCH+1] = {0};
+    for (int x = 0; x < MINIMAP_WIDTH; x++) {
+        int best = HL_NORMAL;
+        rows += cover[x];
+        for (int hl = 0; hl <= HL_MATCH; hl++) {
+            if (!(used & 1<<hl)) continue;
+            n[hl] += count[hl][x];
+            if (n[hl] > n[best]) best = hl;
+        }
+        pixel[x] = rows ? best<<4 | std::max(1,rows*15/m.scale) : 0;
+    }
+}
+
+/* Bring the minimap up to date for a height of 'height' pixel rows, adding
+ * to 'tiles' the ones that changed since the last update, or all of them
+ * if E.minimap.redraw is set. Returns the pixel rows covered by the file. */
+int editorMinimapUpdate(int height, std::vector<int> &tiles) {
+    PROFILE_ZONE("editorMinimapUpdate");
+    struct editorMinimap &m = E.minimap;
+    if (height < 1) height = 1;
+    int scale = 1;
+    while ((int64_t) scale*height < E.numrows) scale *= 2;
+
+    if (height != m.height || scale != m.scale) {
+        m.height = height;
+        m.scale = scale;
+        m.rows = 0;
+        m.moved = 0;
+        m.pixels.assign((size_t) height*MINIMAP_WIDTH,0);
+        m.stale.assign(height,0);
+    }
+
+    /* The pixel rows covering the file now, or before some rows were
+     * removed. */
+    int rows = (E.numrows+scale-1)/scale;
+    int used = std::max(rows,m.rows);
+    if (m.moved != -1) {
+        for (int y = m.moved/scale; y < used; y++) m.stale[y] = 1;
+        m.moved = -1;
+    }
+    for (int t = 0; t*MINIMAP_TILE < used; t++) {
+        int changed = m.redraw;
+        int last = std::min((t+1)*MINIMAP_TILE,used);
+        for (int y = t*MINIMAP_TILE; y < last; y++) {
+            if (!m.stale[y]) continue;
+            editorMinimapBuildRow(y);
+            m.stale[y] = 0;
+            changed = 1;
+        }
+        if (changed) tiles.push_back(t);
+    }
+    m.rows = rows;
+    m.redraw = 0;
+    return rows;
+}
+
+/* ============================== Word index ================================
+ *
+ * E.words counts the identifiers of the buffer for word completion: runs
+ * of is_word_char() chars not starting with a digit, where the highlight
+ * shows code or keywords, so that strings, comments and numbers are left
+ * out. The rows are split in blocks that remember the words they added to
+ * the counts. A changed row only marks its block, and rows added or removed
+ * grow or shrink their block, which is split once it is too large, leaving
+ * the other blocks alone. A marked block is indexed again taking its words
+ * out of the counts and scanning its rows, a slice of time at a time from
+ * the main loop, or right away around the cursor when completing. Buffers
+ * with a syntax are indexed from when they are opened, the others from the
+ * first completion. */
+
+#define WORDS_SLICE 4000000     /* Nanoseconds indexing in a poll. */
+
+/* Block that contains row 'filerow', setting '*start' to its first row, or
+ * -1 if there is none. The search starts from the block found last, when
+ * it is not after the row, as rows are mostly changed in order. */
+static int editorWordsFindBlock(int filerow, int *start) {
+    struct editorWords &w = E.words;
+    int k = 0, first = 0;
+    if (w.cached != -1 && w.cachedstart <= filerow) {
+        k = w.cached;
+        first = w.cachedstart;
+    }
+    for (; k < (int) w.blocks.size(); k++) {
+        if (filerow < first+w.blocks[k].rows) {
+            w.cached = k;
+            w.cachedstart = first;
+            *start = first;
+            return k;
+        }
+        first += w.blocks[k].rows;
+    }
+    return -1;
+}
+
+/* Mark block 'k' to be indexed again. */
+static void editorWordsMark(int k) {
+    if (E.words.blocks[k].dirty) return;
+    E.words.blocks[k].dirty = 1;
+    E.words.dirty++;
+}
+
+/* The content or the highlight of 'row' changed. */
+static void editorWordsRowChanged(erow *row) {
+    if (!E.words.on) return;
+    int start, k = editorWordsFindBlock(row->idx,&start);
+    if (k != -1) editorWordsMark(k);
+}
+
+/* 'n' rows were added at 'at': they join the block of the row that was
+ * there, or the last block if added at the end. */
+static void editorWordsRowsInserted(int at, int n) {
+    struct editorWords &w = E.words;
+    if (!w.on || n == 0) return;
+    int start, k = editorWordsFindBlock(at,&start);
+    if (k == -1) {
+        if (w.blocks.empty()) w.blocks.push_back(editorWordBlock());
+        k = w.blocks.size()-1;
+    }
+    w.blocks[k].rows += n;
+    editorWordsMark(k);
+    if (k < w.cached) w.cached = -1;
+}
+
+/* 'n' rows were removed at 'at'. */
+static void editorWordsRowsRemoved(int at, int n) {
+    struct editorWords &w = E.words;
+    if (!w.on) return;
+    while (n > 0) {
+        int start, k = editorWordsFindBlock(at,&start);
+        if (k == -1) return;
+        int del = std::min(n,start+w.blocks[k].rows-at);
+        w.blocks[k].rows -= del;
+        n -= del;
+        editorWordsMark(k);
+        if (k < w.cached) w.cached = -1;
+    }
+}
+
+/* All the rows were removed. */
+static void editorWordsClear(void) {
+    struct editorWords &w = E.words;
+    w.words.clear();
+    w.blocks.clear();
+    w.dirty = 0;
+    w.cached = -1;
+}
+
+/* A word found in a block being indexed, in a hash table of the words
+ * left in place in the rendered rows: the words the block already had only
+ * have their counts updated, and only the new ones are copied. */
+struct editorWordSlot {
+    const char *s;      /* NULL if the slot is free. */
+    int len;
+    int count;
+    uint32_t hash;
+    int known;          /* Already in the block. */
+};
+
+static uint32_t editorWordHash(const char *s, int len) {
+    uint32_t hash = 2166136261u;    /* FNV-1a. */
+    for (int j = 0; j < len; j++)
+        hash = (hash ^ (unsigned char) s[j])*16777619u;
+    return hash;
+}
+
+/* Slot of the word 's' of 'len' bytes, free if it was not found. */
+static size_t editorWordsSlot(std::vector<editorWordSlot> &slots,
+                              const char *s, int len, uint32_t hash)
+{
+    size_t mask = slots.size()-1, i = hash & mask;
+    while (slots[i].s && (slots[i].hash != hash || slots[i].len != len ||
+                          memcmp(slots[i].s,s,len)))
+        i = (i+1) & mask;
+    return i;
+}
+
+/* Count the words of 'row' in 'slots', whose size is a power of two larger
+ * than the rendered rows counted, adding the slots taken to 'used'. */
+static void editorWordsScanRow(erow *row, std::vector<editorWordSlot> &slots,
+                               std::vector<int> &used)
+{
+    static thread_local unsigned char wordchar[256];
+    if (!wordchar['a']) {
+        for (int c = 0; c < 256; c++) wordchar[c] = is_word_char(c);
+    }
+    const char *s = editorRowRender(row);
+    const unsigned char *hl = editorRowHl(row);
+    auto inword = [&](int j) {
+        return wordchar[(unsigned char) s[j]] &&
+               (!hl || hl[j] == HL_NORMAL || hl[j] == HL_KEYWORD1 ||
+                hl[j] == HL_KEYWORD2);
+    };
+    for (int j = 0; j < row->rsize; ) {
+        if (!inword(j)) {
+            j++;
+            continue;
+        }
+        int start = j;
+        while (j < row->rsize && inword(j)) j++;
+        int len = j-start;
+        if (len < WORDS_MIN || len > WORDS_MAX ||
+            isdigit((unsigned char) s[start])) continue;
+
+        uint32_t hash = editorWordHash(s+start,len);
+        size_t i = editorWordsSlot(slots,s+start,len,hash);
+        if (!slots[i].s) {
+            slots[i].s = s+start;
+            slots[i].len = len;
+            slots[i].count = 0;
+            slots[i].hash = hash;
+            slots[i].known = 0;
+            used.push_back(i);
+        }
+        slots[i].count++;
+    }
+}
+
+/* Index block 'k', whose first row is 'start': count the words of its
+ * rows and update the counts by the difference with what it had. A block
+ * grown too large is split first, and an empty one removed. Returns the
+ * rows indexed. */
+static int editorWordsIndexBlock(int k, int start) {
+    static thread_local std::vector<editorWordSlot> slots;
+    static thread_local std::vector<int> used;
+    struct editorWords &w = E.words;
+    editorWordBlock *b = &w.blocks[k];
+    b->dirty = 0;
+    w.dirty--;
+    if (b->rows == 0) {
+        for (auto &word : b->words) {
+            if ((word.first->second -= word.second) == 0)
+                w.words.erase(word.first);
+        }
+        w.blocks.erase(w.blocks.begin()+k);
+        w.cached = -1;
+        return 0;
+    }
+    int bytes = 0;
+    for (int j = start; j < start+b->rows; j++) bytes += E.row[j].rsize+1;
+    if (b->rows > 2*WORDS_BLOCK ||
+        (b->rows > 1 && bytes > 2*WORDS_BLOCK_BYTES))
+    {
+        /* Cut it in blocks of WORDS_BLOCK rows, or fewer rows making up
+         * WORDS_BLOCK_BYTES, the first one staying here with the words. */
+        std::vector<editorWordBlock> more;
+        int end = start+b->rows;
+        for (int j = start; j < end; ) {
+            editorWordBlock piece;
+            piece.rows = 0;
+            piece.dirty = 1;
+            for (bytes = 0; j < end && piece.rows < WORDS_BLOCK &&
+                            bytes < WORDS_BLOCK_BYTES; j++, piece.rows++)
+                bytes += E.row[j].rsize+1;
+            more.push_back(piece);
+        }
+        bytes = 0;
+        for (int j = start; j < start+more[0].rows; j++)
+            bytes += E.row[j].rsize+1;
+        b->rows = more[0].rows;
+        w.dirty += more.size()-1;
+        w.blocks.insert(w.blocks.begin()+k+1,more.begin()+1,more.end());
+        w.cached = -1;
+        b = &w.blocks[k];
+    }
+
+    size_t size = 64;
+    while (size <= (size_t) bytes) size *= 2;
+    if (slots.size() < size) slots.resize(size);
+    for (int j = start; j < start+b->rows; j++)
+        editorWordsScanRow(E.row+j,slots,used);
+
+    /* The words the block had: counted again or gone. */
+    size_t kept = 0;
+    for (auto &word : b->words) {
+        const std::string &s = word.first->first;
+        size_t i = editorWordsSlot(slots,s.data(),s.size(),
+                                   editorWordHash(s.data(),s.size()));
+        if (slots[i].s) {
+            slots[i].known = 1;
+            word.first->second += slots[i].count-word.second;
+            word.second = slots[i].count;
+            b->words[kept++] = word;
+        } else if ((word.first->second -= word.second) == 0) {
+            w.words.erase(word.first);
+        }
+    }
+    b->words.resize(kept);
+
+    /* The new ones. */
+    for (int i : used) {
+        if (!slots[i].known) {
+            std::string word(slots[i].s,slots[i].len);
+            auto it = w.words.lower_bound(word);
+            if (it == w.words.end() || it->first != word)
+                it = w.words.emplace_hint(it,word,0);
+            it->second += slots[i].count;
+            b->words.push_back({it,slots[i].count});
+        }
+        slots[i].s = NULL;
+    }
+    used.clear();
+    return b->rows;
+}
+
+/* Start indexing the words of the buffer, if it is not already. */
+void editorWordsStart(void) {
+    struct editorWords &w = E.words;
+    if (w.on) return;
+    editorWordsClear();
+    w.on = 1;
+    editorWordsRowsInserted(0,E.numrows);
+}
+
+/* Index the blocks marked since the last call, for WORDS_SLICE at most.
+ * Returns true if some are left for the next call. */
+int editorWordsPoll(void) {
+    struct editorWords &w = E.words;
+    if (!w.dirty) return 0;
+    PROFILE_ZONE("editorWordsPoll");
+    uint64_t deadline = profileNow()+WORDS_SLICE;
+    int start = 0;
+    for (size_t k = 0; w.dirty && k < w.blocks.size(); ) {
+        int rows = w.blocks[k].rows;
+        int indexed = w.blocks[k].dirty;
+        if (indexed) {
+            rows = editorWordsIndexBlock(k,start);
+            if (rows == 0) continue;    /* Removed. */
+        }
+        start += rows;
+        k++;
+        if (indexed && profileNow() > deadline) break;
+    }
+    return w.dirty != 0;
+}
+
+/* Find up to 'max' completions of the word 'prefix' of 'len' bytes, typed
+ * at row 'filerow', and store them in 'words', best first. Words rank by
+ * how many times they occur, and higher if they are within WORDS_NEAR rows
+ * of 'filerow', the closer the higher. The blocks there are indexed first,
+ * and so is the whole buffer if it was not indexed yet. Returns the number
+ * of completions. */
+int editorComplete(const char *prefix, int len, int filerow,
+                   std::vector<std::string> &words, int max)
+{
+    PROFILE_ZONE("editorComplete");
+    struct editorWords &w = E.words;
+    words.clear();
+    if (!w.on) {
+        editorWordsStart();
+        while (editorWordsPoll());
+    }
+    auto matches = [&](const std::string &word) {
+        return (int) word.size() > len && !word.compare(0,len,prefix,len);
+    };
+
+    /* Closeness of the words around 'filerow', from 0 to 1. */
+    std::unordered_map<const std::string*,float> near;
+    int start = 0;
+    for (size_t k = 0; k < w.blocks.size(); ) {
+        int rows = w.blocks[k].rows;
+        if (start > filerow+WORDS_NEAR) break;
+        if (start+rows > filerow-WORDS_NEAR) {
+            if (w.blocks[k].dirty) {
+                rows = editorWordsIndexBlock(k,start);
+                if (rows == 0) continue;
+            }
+            int dist = filerow < start ? start-filerow :
+                       std::max(0,filerow-(start+rows-1));
+            float closeness = 1-(float) dist/WORDS_NEAR;
+            for (auto &word : w.blocks[k].words) {
+                if (!matches(word.first->first)) continue;
+                float &c = near[&word.first->first];
+                c = std::max(c,closeness);
+            }
+        }
+        start += rows;
+        k++;
+    }
+
+    /* Ties go in alphabetical order. */
+    std::vector<std::pair<float,const std::string*>> ranked;
+    for (auto it = w.words.lower_bound(std::string(prefix,len));
+         it != w.words.end() && !it->first.compare(0,len,prefix,len); it++)
+    {
+        if ((int) it->first.size() == len) continue;
+        auto n = near.find(&it->first);
+        float score = log2f(1+it->second) +
+                      4*(n != near.end() ? n->second : 0);
+        ranked.push_back({-score,&it->first});
+    }
+    int n = std::min((int) ranked.size(),max);
+    std::partial_sort(ranked.begin(),ranked.begin()+n,ranked.end(),
+        [](const std::pair<float,const std::string*> &a,
+           const std::pair<float,const std::string*> &b) {
+            return a.first != b.first ? a.first < b.first :
+                                        *a.second < *b.second;
+        });
+    for (int j = 0; j < n; j++) words.push_back(*ranked[j].second);
+    return n;
+}
+
+/* ============================ Modified lines ==============================
+ *
+ * E.gutter compares the rows with the file as it was last read or saved,
+ * for the gutter to mark the rows added or changed, and where lines were
+ * removed. The file is kept as the hashes of its lines, taken when it is
+ * opened, and when it is saved from the ones kept and the changed rows.
+ * The hunks always turn these lines into the rows: an edit replacing some
+ * rows merges the hunks it touches, or the unchanged rows it replaces,
+ * into a single dirty hunk, and shifts the hunks after it, so editing
+ * costs a binary search and nothing else when the rows don't move. Dirty
+ * hunks are not the smallest changes: editorGutterPoll() hashes their rows
+ * and hands them to a thread of the buffer, that strips the common prefix
+ * and suffix and diffs what is left with diffLines(), giving up past
+ * KILO_DIFF_MAXD. Only the dirty hunks are diffed, so that after a small
+ * edit to a large file only a few lines are compared. A hunk edited again
+ * while it is diffed is dirty again, and the result for it is dropped.
+ * Read only buffers, and followed files, have no gutter. */
+
+/* A dirty hunk to diff: the lines on disk and the hashes of its rows. The
+ * result is relative to the hunk. */
+struct gutterJob {
+    unsigned id;
+    int a, alen;
+    std::vector<uint64_t> rows;
+    std::vector<diffHunk> hunks;
+};
+
+/* The thread diffing the hunks of a buffer, one batch of jobs at a time:
+ * while 'busy' and not 'done', the jobs belong to the thread. */
+struct gutterWorker {
+    std::mutex lock;
+    std::condition_variable wake;
+    std::shared_ptr<const std::vector<uint64_t>> disk;
+    std::vector<gutterJob> jobs;
+    int busy = 0;
+    int done = 0;
+    int stop = 0;
+    unsigned nextid = 0;
+    std::thread thread;
+
+    ~gutterWorker() {
+        {
+            std::lock_guard<std::mutex> l(lock);
+            stop = 1;
+        }
+        wake.notify_one();
+        if (thread.joinable()) thread.join();
+    }
+};
+
+/* Diff the lines of 'job' with its rows, as hashes. */
+static void editorGutterDiff(const std::vector<uint64_t> &disk,
+                             gutterJob &job)
+{
+    const uint64_t *a = disk.data()+job.a, *b = job.rows.data();
+    int n = job.alen, m = job.rows.size(), pre = 0, suf = 0;
+    while (pre < n && pre < m && a[pre] == b[pre]) pre++;
+    while (suf < n-pre && suf < m-pre && a[n-1-suf] == b[m-1-suf]) suf++;
+    a += pre;
+    b += pre;
+    auto eq = [&](int i, int j) { return a[i] == b[j]; };
+    if (diffLines(n-pre-suf,m-pre-suf,eq,job.hunks,KILO_DIFF_MAXD) == -1)
+        job.hunks.assign(1,diffHunk{0,n-pre-suf,0,m-pre-suf});
+    for (auto &h : job.hunks) {
+        h.a += pre;
+        h.b += pre;
+    }
+}
+
+static void editorGutterThread(gutterWorker *w) {
+    profileMuted = true;
+    std::unique_lock<std::mutex> l(w->lock);
+    for (;;) {
+        w->wake.wait(l,[w]() { return w->stop || (w->busy && !w->done); });
+        if (w->stop) return;
+        l.unlock();
+        for (auto &job : w->jobs) editorGutterDiff(*w->disk,job);
+        l.lock();
+        w->done = 1;
+    }
+}
+
+/* Rows [at,at+n) were replaced by 'm' rows. */
+static void editorGutterEdit(int at, int n, int m) {
+    struct editorGutter &g = E.gutter;
+    if (!g.on) return;
+    std::vector<gutterHunk> &h = g.hunks;
+
+    /* Hunks [i,k) touch the rows replaced. Between two hunks, rows map to
+     * lines at a constant distance. */
+    auto i = std::lower_bound(h.begin(),h.end(),at,
+        [](const gutterHunk &x, int row) { return x.b+x.blen < row; });
+    auto k = i;
+    while (k != h.end() && k->b <= at+n) k++;
+    int delta = i == h.begin() ? 0 :
+        (i-1)->a+(i-1)->alen - ((i-1)->b+(i-1)->blen);
+    int a = at+delta, b = at, aend = at+n+delta, bend = at+n;
+    if (i != k) {
+        auto last = k-1;
+        if (i->b < b) {
+            a = i->a;
+            b = i->b;
+        }
+        aend = bend + last->a+last->alen - (last->b+last->blen);
+        if (last->b+last->blen > bend) {
+            aend = last->a+last->alen;
+            bend = last->b+last->blen;
+        }
+    }
+
+    gutterHunk merged = {a,aend-a,b,bend-b+m-n,0,1};
+    if (m != n) for (auto j = k; j != h.end(); ++j) j->b += m-n;
+    if (i == k) {
+        h.insert(i,merged);
+    } else {
+        *i = merged;
+        h.erase(i+1,k);
+    }
+    g.dirty = 1;
+}
+
+/* Like editorGutterEdit() for every edit of 'edits', in file order, each
+ * one starting where the ones before left the rows, in a single pass over
+ * the hunks instead of shifting them at every edit. */
+static void editorGutterEdits(const std::vector<editorRowSwap> &edits) {
+    struct editorGutter &g = E.gutter;
+    if (!g.on || edits.empty()) return;
+    if (edits.size() == 1) {
+        editorGutterEdit(edits[0].at,edits[0].n,edits[0].m);
+        return;
+    }
+    std::vector<gutterHunk> &h = g.hunks, out;
+    out.reserve(h.size()+edits.size());
+    size_t r = 0;   /* Next hunk of 'h', 'shift' rows off by now. */
+    int shift = 0;
+    for (auto &e : edits) {
+        int at = e.at, n = e.n, m = e.m;
+        while (r < h.size() && h[r].b+shift+h[r].blen < at) {
+            out.push_back(h[r++]);
+            out.back().b += shift;
+        }
+
+        /* Hunks [from,end) of 'out' touch the rows replaced: the last one
+         * out, if an edit before made it so, and the next ones. */
+        size_t from = out.size();
+        if (from && out[from-1].b+out[from-1].blen >= at) from--;
+        while (r < h.size() && h[r].b+shift <= at+n) {
+            out.push_back(h[r++]);
+            out.back().b += shift;
+        }
+        int delta = from == 0 ? 0 :
+            out[from-1].a+out[from-1].alen - (out[from-1].b+out[from-1].blen);
+        int a = at+delta, b = at, aend = at+n+delta, bend = at+n;
+        if (from != out.size()) {
+            const gutterHunk &first = out[from], &last = out.back();
+            if (first.b < b) {
+                a = first.a;
+                b = first.b;
+            }
+            aend = bend + last.a+last.alen - (last.b+last.blen);
+            if (last.b+last.blen > bend) {
+                aend = last.a+last.alen;
+                bend = last.b+last.blen;
+            }
+        }
+        out.resize(from);
+        out.push_back({a,aend-a,b,bend-b+m-n,0,1});
+        shift += m-n;
+    }
+    for (; r < h.size(); r++) {
+        out.push_back(h[r]);
+        out.back().b += shift;
+    }
+    h.swap(out);
+    g.dirty = 1;
+}
+
+/* Compare the rows with the file from now on, taking them as its lines. */
+static void editorGutterStart(void) {
+    struct editorGutter &g = E.gutter;
+    if (E.follow) return;
+    PROFILE_ZONE("editorGutterStart");
+    auto disk = std::make_shared<std::vector<uint64_t>>(E.numrows);
+    for (int j = 0; j < E.numrows; j++)
+        (*disk)[j] = diffHash(editorRowChars(E.row+j),E.row[j].size);
+    g.disk = disk;
+    g.hunks.clear();
+    g.dirty = 0;
+    g.on = 1;
+}
+
+static void editorGutterStop(void) {
+    struct editorGutter &g = E.gutter;
+    g.on = 0;
+    g.disk.reset();
+    g.hunks.clear();
+    g.dirty = 0;
+}
+
+/* The rows were written to the file, or are taken as its content: the
+ * lines are the ones kept outside of the hunks, and the hashes of the rows
+ * in them. */
+static void editorGutterSaved(void) {
+    struct editorGutter &g = E.gutter;
+    if (!g.on) return;
+    const std::vector<uint64_t> &old = *g.disk;
+    auto disk = std::make_shared<std::vector<uint64_t>>();
+    disk->reserve(E.numrows);
+    int a = 0;
+    for (auto &h : g.hunks) {
+        disk->insert(disk->end(),old.begin()+a,old.begin()+h.a);
+        for (int j = h.b; j < h.b+h.blen; j++)
+            disk->push_back(diffHash(editorRowChars(E.row+j),E.row[j].size));
+        a = h.a+h.alen;
+    }
+    disk->insert(disk->end(),old.begin()+a,old.end());
+    if ((int) disk->size() != E.numrows) {
+        editorGutterStart();    /* Can't happen, but start over if so. */
+        return;
+    }
+    g.disk = disk;
+    g.hunks.clear();
+    g.dirty = 0;
+}
+
+/* Replace the hunks diffed by 'jobs', sent in row order, with the result,
+ * unless they were edited since. */
+static void editorGutterApply(std::vector<gutterJob> &jobs) {
+    std::vector<gutterHunk> &h = E.gutter.hunks, out;
+    size_t j = 0;
+    out.reserve(h.size());
+    for (auto &x : h) {
+        while (x.id && j < jobs.size() && jobs[j].id < x.id) j++;
+        if (x.id && j < jobs.size() && jobs[j].id == x.id) {
+            for (auto &d : jobs[j].hunks)
+                out.push_back({x.a+d.a,d.alen,x.b+d.b,d.blen,0,0});
+        } else {
+            out.push_back(x);
+            out.back().id = 0;
+        }
+    }
+    h.swap(out);
+}
+
+/* Take the result of the last diff, and start diffing the hunks edited
+ * since, if any. Called from the main loop. Returns true if the marks
+ * changed. */
+int editorGutterPoll(void) {
+    struct editorGutter &g = E.gutter;
+    if (!g.worker) {
+        if (!g.dirty || !g.on) return 0;
+        g.worker = std::make_shared<gutterWorker>();
+        g.worker->thread = std::thread(editorGutterThread,g.worker.get());
+    }
+    gutterWorker &w = *g.worker;
+    std::vector<gutterJob> jobs;
+    {
+        std::lock_guard<std::mutex> l(w.lock);
+        if (w.busy && !w.done) return 0;
+        jobs.swap(w.jobs);
+        w.busy = 0;
+    }
+    int changed = !jobs.empty();
+    if (changed) {
+        PROFILE_ZONE("editorGutterApply");
+        editorGutterApply(jobs);
+        jobs.clear();
+    }
+    if (!g.dirty || !g.on) return changed;
+
+    PROFILE_ZONE("editorGutterPoll");
+    for (auto &x : g.hunks) {
+        if (!x.dirty) continue;
+        x.dirty = 0;
+        x.id = ++w.nextid;
+        jobs.push_back({x.id,x.a,x.alen,{},{}});
+        std::vector<uint64_t> &rows = jobs.back().rows;
+        rows.resize(x.blen);
+        for (int j = 0; j < x.blen; j++) {
+            erow *row = E.row+x.b+j;
+            rows[j] = diffHash(editorRowChars(row),row->size);
+        }
+    }
+    g.dirty = 0;
+    {
+        std::lock_guard<std::mutex> l(w.lock);
+        w.disk = g.disk;
+        w.jobs.swap(jobs);
+        w.busy = 1;
+        w.done = 0;
+    }
+    w.wake.notify_one();
+    return changed;
+}
+
+/* True while hunks are being diffed, or wait to be. */
+int editorGutterBusy(void) {
+    struct editorGutter &g = E.gutter;
+    if (g.dirty && g.on) return 1;
+    if (!g.worker) return 0;
+    std::lock_guard<std::mutex> l(g.worker->lock);
+    return g.worker->busy;
+}
+
+/* How the gutter marks row 'filerow': GUTTER_CHANGED or GUTTER_ADDED, and
+ * GUTTER_REMOVED or GUTTER_REMOVED_END. Rows of dirty hunks are marked as
+ * changed as far as they replace lines, then as added. */
+int editorGutterMark(int filerow) {
+    struct editorGutter &g = E.gutter;
+    if (!g.on) return 0;
+    auto i = std::lower_bound(g.hunks.begin(),g.hunks.end(),filerow,
+        [](const gutterHunk &x, int row) { return x.b+x.blen < row; });
+    int mark = 0;
+    for (; i != g.hunks.end() && i->b <= filerow+1; ++i) {
+        if (i->blen == 0) {
+            if (i->b == filerow && i->alen) mark |= GUTTER_REMOVED;
+            if (i->b == filerow+1 && i->b == E.numrows && i->alen)
+                mark |= GUTTER_REMOVED_END;
+        } else if (i->b <= filerow && filerow < i->b+i->blen) {
+            mark |= filerow-i->b < i->alen ? GUTTER_CHANGED : GUTTER_ADDED;
+        }
+    }
+    return mark;
+}
+
+/* =============================== Find mode ================================ */
+
+/* Search 'query' in the rendered rows, starting from the row after 'from'
+ * (or the one before it when 'dir' is -1) and wrapping around the file.
+ * Returns the index of the matching row and sets '*offset' to the match
+ * position inside the rendered row, or returns -1 if nothing matches. */
+int editorFindRow(const char *query, int from, int dir, int *offset) {
+    int current = from;
+    for (int i = 0; i < E.numrows; i++) {
+        current += dir;
+        if (current == -1) current = E.numrows-1;
+        else if (current == E.numrows) current = 0;
+        char *render = editorRowRender(E.row+current);
+        char *match = strstr(render,query);
+        if (match) {
+            *offset = match-render;
+            return current;
+        }
+    }
+    return -1;
+}
+
+/* ================================ Replace =================================
+ *
+ * Replace all scans every row once, and builds the new content of the rows
+ * that change in one go. They are rendered as they are built, and
+ * highlighted once at the end, in a single forward pass that also carries
+ * the comment state over. The previous content of the changed rows is kept
+ * aside rather than freed, so that the whole replacement is undone as a
+ * single edit by putting it back. */
+
+/* Take the content of a row away, as a heap allocated null terminated
+ * string, leaving the row empty. */
+static char *editorRowTake(erow *row) {
+    char *chars;
+    if (row->flags & ROW_INLINE) {
+        chars = (char*) malloc(row->size+1);
+        memcpy(chars,row->u.inl,row->size+1);
+    } else {
+        chars = row->u.data;
+    }
+    row->size = 0;
+    row->flags = ROW_INLINE;
+    row->u.inl[0] = '\0';
+    return chars;
+}
+
+/* Forget the last replace all, filter or edit at multiple cursors: it
+ * can't be undone anymore. */
+static void editorUndoClear(void) {
+    for (auto &u : E.undo.rows) free(u.chars);
+    E.undo.rows.clear();
+    E.undo.swaps.clear();
+    for (auto &r : E.undo.removed) editorFreeRow(&r);
+    E.undo.removed.clear();
+    E.undo.inplace = 0;
+    E.undo.merged = 0;
+    E.undo.cursors.clear();
+}
+
+/* Highlight the rows in 'rows', in order, and the following ones while the
+ * open comment state keeps changing, every row at most once. */
+static void editorUpdateSyntaxRows(const std::vector<editorUndoRow> &rows) {
+    PROFILE_ZONE("editorUpdateSyntax");
+    int next = 0;
+    for (auto &u : rows) {
+        if (u.idx < next) continue;
+        int j = u.idx, changed = 1;
+        while (changed && j < E.numrows)
+            changed = editorHighlightRow(E.row+j++);
+        next = j;
+    }
+}
+
+/* Append 'repl' to 'out', "\0" to "\9" standing for the whole match and its
+ * groups, and "\\" for a backslash. */
+static void editorReplaceExpand(std::string &out, const char *repl,
+                                const char *s, const regmatch_t *pm)
+{
+    for (const char *p = repl; *p; p++) {
+        if (p[0] == '\\' && isdigit(p[1])) {
+            const regmatch_t &g = pm[p[1]-'0'];
+            if (g.rm_so != -1) out.append(s+g.rm_so,g.rm_eo-g.rm_so);
+            p++;
+        } else if (p[0] == '\\' && p[1] == '\\') {
+            out.push_back('\\');
+            p++;
+        } else {
+            out.push_back(*p);
+        }
+    }
+}
+
+/* Build in 'out' the row 's' of 'len' bytes with every match of 'query'
+ * replaced. Returns the number of replacements. */
+static int editorReplaceLiteral(std::string &out, const char *s, size_t len,
+                                const char *query, const char *repl)
+{
+    size_t qlen = strlen(query), rlen = strlen(repl);
+    const char *p = s, *end = s+len, *m;
+    int count = 0;
+    while ((m = grepFind(p,end-p,query,qlen)) != NULL) {
+        if (!count) out.clear();
+        out.append(p,m-p);
+        out.append(repl,rlen);
+        p = m+qlen;
+        count++;
+    }
+    if (count) out.append(p,end-p);
+    return count;
+}
+
+/* Like editorReplaceLiteral(), with a compiled regular expression. Empty
+ * matches are replaced too, but not right after another match, like sed
+ * does. */
+static int editorReplaceRegex(std::string &out, const char *s, size_t len,
+                              const regex_t *re, const char *repl)
+{
+    regmatch_t pm[10];
+    const char *p = s, *end = s+len, *last = NULL;
+    int count = 0, flags = 0;
+    while (p <= end && regexec(re,p,10,pm,flags) == 0) {
+        const char *m = p+pm[0].rm_so, *mend = p+pm[0].rm_eo;
+        flags = REG_NOTBOL;
+        if (m == mend && m == last) {
+            /* Empty match where the last one ended: skip a char. */
+            if (m == end) break;
+            int next = utf8Next(s,len,m-s);
+            out.append(m,s+next-m);
+            p = s+next;
+            continue;
+        }
+        if (!count) out.clear();
+        out.append(p,m-p);
+        editorReplaceExpand(out,repl,p,pm);
+        count++;
+        last = p = mend;
+        if (m == mend) {
+            /* Go past an empty match, keeping the char after it. */
+            if (m == end) break;
+            int next = utf8Next(s,len,m-s);
+            out.append(m,s+next-m);
+            p = s+next;
+        }
+    }
+    if (count && p < end) out.append(p,end-p);
+    return count;
+}
+
+/* Replace every match of 'query' with 'repl' in the whole file. If 'regex'
+ * is true, 'query' is a POSIX extended regular expression, matched in every
+ * row, and "\0" to "\9" in 'repl' stand for the match and its groups.
+ * Rows are replaced one by one, so 'repl' can't contain a newline. The
+ * previous undo state is kept if nothing matches. Returns the number of
+ * replacements, or -1 on error. */
+int64_t editorReplaceAll(const char *query, const char *repl, int regex) {
+    if (editorReadOnly()) return -1;
+    if (*query == '\0') return 0;
+    if (strchr(repl,'\n')) {
+        editorSetStatusMessage("Can't replace with a new line");
+        return -1;
+    }
+    regex_t re;
+    if (regex) {
+        int err = regcomp(&re,query,REG_EXTENDED);
+        if (err) {
+            char msg[64];
+            regerror(err,&re,msg,sizeof(msg));
+            editorSetStatusMessage("Bad regular expression: %s",msg);
+            return -1;
+        }
+    }
+
+    int filerow = E.rowoff+E.cy, filecol = editorCursorOffset();
+    std::vector<editorUndoRow> changed;
+    std::string out;
+    int64_t count = 0;
+    for (int j = 0; j < E.numrows; j++) {
+        erow *row = E.row+j;
+        char *chars = editorRowChars(row);
+        int n = regex ? editorReplaceRegex(out,chars,row->size,&re,repl) :
+                        editorReplaceLiteral(out,chars,row->size,query,repl);
+        if (!n) continue;
+        count += n;
+        int size = row->size;
+        changed.push_back({j,size,editorRowTake(row)});
+        memcpy(editorRowStorage(row,out.size()+1),out.data(),out.size()+1);
+        row->size = out.size();
+        editorUpdateRender(row);
+    }
+    if (regex) regfree(&re);
+    if (!count) return 0;
+
+    editorUndoClear();
+    E.undo.rows.swap(changed);
+    E.undo.filerow = filerow;
+    E.undo.filecol = filecol;
+    editorUpdateSyntaxRows(E.undo.rows);
+    E.dirty++;
+    E.undo.dirty = E.dirty;
+    editorSetCursor(E.undo.filerow,E.undo.filecol);
+    return count;
+}
+
+/* Undo the last replace all, filter or edit at multiple cursors, if
+ * nothing else changed since. Returns 0 on success, 1 if there is nothing
+ * to undo. */
+int editorUndo(void) {
+    if (editorReadOnly()) return 1;
+    if ((E.undo.rows.empty() && E.undo.swaps.empty()) ||
+        E.undo.dirty != E.dirty)
+    {
+        editorSetStatusMessage("Nothing to undo");
+        return 1;
+    }
+    if (!E.undo.swaps.empty()) {
+        /* The rows replaced go back, and the rows swapped in take their
+         * place in the undo state, to be freed below. */
+        editorSwapRows(E.undo.swaps,E.undo.removed,!E.undo.merged);
+    }
+    if (!E.undo.cursors.empty()) E.cursors.swap(E.undo.cursors);
+    for (auto &u : E.undo.rows) {
+        erow *row = E.row+u.idx;
+        free(editorRowTake(row));
+        memcpy(editorRowStorage(row,u.size+1),u.chars,u.size+1);
+        row->size = u.size;
+        editorUpdateRender(row);
+    }
+    editorUpdateSyntaxRows(E.undo.rows);
+    int filerow = E.undo.filerow, filecol = E.undo.filecol;
+    editorUndoClear();
+    E.dirty++;
+    editorSetCursor(filerow,filecol);
+    return 0;
+}
+
+/* ================================= Filter =================================
+ *
+ * Rows, all of them or a range, can be piped through a shell command like
+ * sort or a formatter, and replaced by what it prints. The main loop polls
+ * the command: the rows are written to its standard input straight from
+ * their storage with writev(), while its output is read and split into new
+ * rows aside, so that neither the rows nor the output are ever copied
+ * whole, and the editor keeps drawing. The rows are read only meanwhile.
+ * When the command exits successfully its rows are swapped in as a single
+ * edit, undone like a replace all. Otherwise its output is dropped, and the
+ * start of its standard error shown. Like follow mode, a buffer not shown
+ * is not polled: its command waits until it is shown again. */
+
+#define KILO_FILTER_SLICE_MS 8      /* Time spent per poll, at most. */
+#define KILO_FILTER_SHOW_MS 250     /* Progress shown this often. */
+#define KILO_FILTER_IOV 256         /* Buffers written at a time. */
+#define KILO_FILTER_READ (64<<10)   /* Bytes read at a time. */
+
+extern char **environ;
+
+/* Milliseconds from an arbitrary point, for the time slices. */
+static int64_t editorFilterNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec*1000LL + ts.tv_nsec/1000000;
+}
+
+static void editorFilterClose(int &fd) {
+    if (fd != -1) close(fd);
+    fd = -1;
+}
+
+/* Free the output read so far. */
+static void editorFilterDrop(void) {
+    struct editorFilter &f = E.filter;
+    for (auto &r : f.rows) editorFreeRow(&r);
+    std::vector<erow>().swap(f.rows);
+    f.line.clear();
+}
+
+/* Pipe rows [first,last) through the shell command 'cmd', to replace them
+ * with its output once it exits, see editorFilterPoll(). The command runs
+ * in a process group of its own, so that a pipeline is killed whole when
+ * cancelled. Returns 0 if it started, 1 on error. */
+int editorFilterStart(const char *cmd, int first, int last) {
+    struct editorFilter &f = E.filter;
+    if (editorReadOnly()) return 1;
+    if (E.follow) {
+        editorSetStatusMessage("Can't filter a file being followed");
+        return 1;
+    }
+    last = std::min(last,E.numrows);
+    first = std::max(std::min(first,last),0);
+
+    /* Its stdin, stdout and stderr. SIGPIPE is ignored here, so that
+     * writing to a command that exited early, like head, fails with EPIPE
+     * instead of killing the editor, but not in the command. */
+    int p[3][2] = {{-1,-1},{-1,-1},{-1,-1}};
+    int ret = 0;
+    pid_t pid;
+    for (int j = 0; j < 3 && ret == 0; j++) {
+        if (pipe(p[j]) == -1) {
+            ret = errno;
+            break;
+        }
+        fcntl(p[j][0],F_SETFD,FD_CLOEXEC);
+        fcntl(p[j][1],F_SETFD,FD_CLOEXEC);
+    }
+    if (ret == 0) {
+        signal(SIGPIPE,SIG_IGN);
+        posix_spawn_file_actions_t fa;
+        posix_spawn_file_actions_init(&fa);
+        posix_spawn_file_actions_adddup2(&fa,p[0][0],0);
+        posix_spawn_file_actions_adddup2(&fa,p[1][1],1);
+        posix_spawn_file_actions_adddup2(&fa,p[2][1],2);
+        posix_spawnattr_t attr;
+        sigset_t sigdef;
+        posix_spawnattr_init(&attr);
+        sigemptyset(&sigdef);
+        sigaddset(&sigdef,SIGPIPE);
+        posix_spawnattr_setsigdefault(&attr,&sigdef);
+        posix_spawnattr_setpgroup(&attr,0);
+        posix_spawnattr_setflags(&attr,POSIX_SPAWN_SETSIGDEF|
+                                       POSIX_SPAWN_SETPGROUP);
+        char *argv[] = {(char*) "sh", (char*) "-c", (char*) cmd, NULL};
+        ret = posix_spawn(&pid,"/bin/sh",&fa,&attr,argv,environ);
+        posix_spawn_file_actions_destroy(&fa);
+        posix_spawnattr_destroy(&attr);
+    }
+    editorFilterClose(p[0][0]);
+    editorFilterClose(p[1][1]);
+    editorFilterClose(p[2][1]);
+    if (ret != 0) {
+        editorFilterClose(p[0][1]);
+        editorFilterClose(p[1][0]);
+        editorFilterClose(p[2][0]);
+        editorSetStatusMessage("Can't run %s: %s",cmd,strerror(ret));
+        return 1;
+    }
+    for (int j = 0; j < 3; j++) {
+        int fd = j ? p[j][0] : p[j][1];
+        fcntl(fd,F_SETFL,fcntl(fd,F_GETFL)|O_NONBLOCK);
+    }
+
+    f.pid = pid;
+    f.in = p[0][1];
+    f.out = p[1][0];
+    f.err = p[2][0];
+    f.first = f.next = first;
+    f.last = last;
+    f.written = 0;
+    editorFilterDrop();
+    f.rows.reserve(last-first);
+    f.error.clear();
+    f.cmd = cmd;
+    f.shown = editorFilterNow();
+    editorSetStatusMessage("Filtering through %s, ESC cancels",cmd);
+    return 0;
+}
+
+/* Write to the command as many rows as the pipe takes, a newline after
+ * each one, and close its stdin after the last one, or if it exited. */
+static void editorFilterWrite(void) {
+    struct editorFilter &f = E.filter;
+    struct iovec iov[KILO_FILTER_IOV];
+    int n = 0, written = f.written;
+    for (int j = f.next; j < f.last && n+2 <= KILO_FILTER_IOV; j++) {
+        erow *row = E.row+j;
+        if (written < row->size) {
+            iov[n].iov_base = editorRowChars(row)+written;
+            iov[n++].iov_len = row->size-written;
+        }
+        iov[n].iov_base = (char*) "\n";
+        iov[n++].iov_len = 1;
+        written = 0;
+    }
+    ssize_t w = n ? writev(f.in,iov,n) : 0;
+    if (w == -1 && (errno == EINTR || errno == EAGAIN ||
+                    errno == EWOULDBLOCK)) return;
+    if (w == -1) {
+        /* It does not read anymore: what is left is not needed. */
+        f.next = f.last;
+    }
+    while (w > 0) {
+        int left = E.row[f.next].size+1-f.written;
+        if (w < left) {
+            f.written += w;
+            break;
+        }
+        w -= left;
+        f.next++;
+        f.written = 0;
+    }
+    if (f.next == f.last) editorFilterClose(f.in);
+}
+
+/* Add an output line as a new row, aside, rendered already so that
+ * swapping the rows in costs less. */
+static void editorFilterAddRow(const char *s, size_t len) {
+    struct editorFilter &f = E.filter;
+    erow row;
+    memcpy(editorInitRow(&row,f.first+f.rows.size(),len),s,len);
+    editorRenderRow(&row);
+    f.rows.push_back(row);
+}
+
+/* Read what the command printed, splitting the lines in new rows. */
+static void editorFilterRead(void) {
+    struct editorFilter &f = E.filter;
+    static char buf[KILO_FILTER_READ];
+    ssize_t n = read(f.out,buf,sizeof(buf));
+    if (n == -1 && (errno == EINTR || errno == EAGAIN ||
+                    errno == EWOULDBLOCK)) return;
+    if (n <= 0) {
+        editorFilterClose(f.out);
+        return;
+    }
+    const char *p = buf, *end = buf+n, *nl;
+    while ((nl = (const char*) memchr(p,'\n',end-p)) != NULL) {
+        if (f.line.empty()) {
+            editorFilterAddRow(p,nl-p);
+        } else {
+            f.line.append(p,nl-p);
+            editorFilterAddRow(f.line.data(),f.line.size());
+            f.line.clear();
+        }
+        p = nl+1;
+    }
+    f.line.append(p,end-p);
+}
+
+/* Read the standard error of the command, keeping its start. */
+static void editorFilterReadError(void) {
+    struct editorFilter &f = E.filter;
+    char buf[4096];
+    ssize_t n = read(f.err,buf,sizeof(buf));
+    if (n == -1 && (errno == EINTR || errno == EAGAIN ||
+                    errno == EWOULDBLOCK)) return;
+    if (n <= 0) {
+        editorFilterClose(f.err);
+        return;
+    }
+    size_t room = FILTER_ERROR_MAX-std::min(f.error.size(),
+                                            (size_t) FILTER_ERROR_MAX);
+    f.error.append(buf,std::min((size_t) n,room));
+}
+
+/* The command exited successfully: replace the rows with its output, as a
+ * single edit that can be undone. The cursor stays where it was, as far as
+ * the file goes. */
+static void editorFilterApply(void) {
+    struct editorFilter &f = E.filter;
+    if (!f.line.empty()) editorFilterAddRow(f.line.data(),f.line.size());
+    f.line.clear();
+    int filerow = E.rowoff+E.cy, filecol = editorCursorOffset();
+    int lines = f.last-f.first, added = f.rows.size();
+
+    editorUndoClear();
+    E.undo.filerow = filerow;
+    E.undo.filecol = filecol;
+    E.undo.swaps.push_back({f.first,lines,added});
+    editorSwapRows(E.undo.swaps,f.rows,0);
+    E.undo.removed.swap(f.rows);
+    E.undo.dirty = E.dirty;
+    E.cursors.clear();
+
+    if (filerow > E.numrows) filerow = E.numrows;
+    if (filerow < E.numrows && filecol > E.row[filerow].size)
+        filecol = E.row[filerow].size;
+    editorSetCursor(filerow,filecol);
+    editorSetStatusMessage("Filtered %d lines into %d, Ctrl-Z to undo",
+        lines,added);
+}
+
+/* Called periodically while filtering: feed the command and read its
+ * output for up to KILO_FILTER_SLICE_MS, waiting for it meanwhile, and once
+ * it exited replace the rows with the output. Returns true if the buffer or
+ * the status changed. */
+int editorFilterPoll(void) {
+    PROFILE_ZONE("editorFilterPoll");
+    struct editorFilter &f = E.filter;
+    if (f.pid == -1) return 0;
+    int64_t start = editorFilterNow(), now = start;
+    while ((f.in != -1 || f.out != -1 || f.err != -1) &&
+           now-start < KILO_FILTER_SLICE_MS)
+    {
+        struct pollfd fds[3] = {
+            {f.in,POLLOUT,0}, {f.out,POLLIN,0}, {f.err,POLLIN,0}
+        };
+        int n = poll(fds,3,KILO_FILTER_SLICE_MS-(now-start));
+        if (n > 0) {
+            if (fds[0].revents) editorFilterWrite();
+            if (fds[1].revents) editorFilterRead();
+            if (fds[2].revents) editorFilterReadError();
+        }
+        now = editorFilterNow();
+    }
+
+    int status;
+    if (f.in != -1 || f.out != -1 || f.err != -1 ||
+        waitpid(f.pid,&status,WNOHANG) <= 0)
+    {
+        if (now-f.shown < KILO_FILTER_SHOW_MS) return 0;
+        f.shown = now;
+        int total = f.last-f.first;
+        editorSetStatusMessage("Filtering: %d%% in, %d lines out, "
+            "ESC cancels",total ? (int) ((int64_t) (f.next-f.first)*100/total)
+            : 100,(int) f.rows.size());
+        return 1;
+    }
+
+    f.pid = -1;
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        editorFilterApply();
+        return 1;
+    }
+    editorFilterDrop();
+    std::string msg = f.error.substr(0,f.error.find('\n'));
+    if (WIFSIGNALED(status))
+        editorSetStatusMessage("%s: killed by signal %d",f.cmd.c_str(),
+            WTERMSIG(status));
+    else
+        editorSetStatusMessage("%s: exit status %d%s%s",f.cmd.c_str(),
+            WEXITSTATUS(status),msg.empty() ? "" : ": ",msg.c_str());
+    return 1;
+}
+
+/* Stop filtering, killing the command and dropping its output. */
+void editorFilterStop(void) {
+    struct editorFilter &f = E.filter;
+    if (f.pid == -1) return;
+    kill(-f.pid,SIGTERM);
+    editorFilterClose(f.in);
+    editorFilterClose(f.out);
+    editorFilterClose(f.err);
+    waitpid(f.pid,NULL,0);
+    f.pid = -1;
+    editorFilterDrop();
+}
+
+int editorFilterRunning(void) {
+    return E.filter.pid != -1;
+}
+
+/* ============================ Multiple cursors ============================
+ *
+ * Besides the main cursor, E.cursors holds more of them, put at every match
+ * of a string, and every edit applies at all of them. Rather than an edit
+ * per cursor, each one shifting the rows below and highlighting its row
+ * again, the edit is done as a batch: the cursors are sorted, the new
+ * content of the rows they are in is built in a single pass over each row,
+ * and the new rows are swapped in at once by editorSwapRows(), that
+ * highlights every row once. The rows replaced are kept whole as the undo
+ * state, and the edits keeping every row, like typing, are merged into it,
+ * so that a single undo takes back all of them. */
+
+/* A cursor of an edit, and where it ends up. */
+struct editorEditCursor {
+    int row, col;
+    int main;       /* The main cursor. */
+    size_t off;     /* Where it ends up in the content of its run. */
+};
+
+static bool editorEditCursorLess(const editorEditCursor &a,
+                                 const editorEditCursor &b)
+{
+    return a.row < b.row || (a.row == b.row && a.col < b.col);
+}
+
+/* Sort the cursors and merge the ones at the same place. */
+static void editorEditCursorsMerge(std::vector<editorEditCursor> &cur) {
+    std::sort(cur.begin(),cur.end(),editorEditCursorLess);
+    size_t n = 0;
+    for (size_t j = 0; j < cur.size(); j++) {
+        if (n && cur[n-1].row == cur[j].row && cur[n-1].col == cur[j].col)
+            cur[n-1].main |= cur[j].main;
+        else
+            cur[n++] = cur[j];
+    }
+    cur.resize(n);
+}
+
+/* Merge the undo state of an edit that kept every row, as editorSwapRows()
+ * left it, into the undo state of the edits of the same kind before it: a
+ * row changed again keeps its oldest content. */
+static void editorUndoMerge(std::vector<editorRowSwap> &swaps,
+                            std::vector<erow> &rows)
+{
+    struct editorUndo &u = E.undo;
+    std::vector<editorRowSwap> mswaps;
+    std::vector<erow> mrows;
+    mswaps.reserve(u.swaps.size()+swaps.size());
+    mrows.reserve(u.swaps.size()+swaps.size());
+    size_t i = 0, j = 0;
+    while (i < u.swaps.size() || j < swaps.size()) {
+        if (j == swaps.size() ||
+            (i < u.swaps.size() && u.swaps[i].at <= swaps[j].at))
+        {
+            if (j < swaps.size() && u.swaps[i].at == swaps[j].at)
+                editorFreeRow(&rows[j++]);
+            mswaps.push_back(u.swaps[i]);
+            mrows.push_back(u.removed[i++]);
+        } else {
+            mswaps.push_back(swaps[j]);
+            mrows.push_back(rows[j++]);
+        }
+    }
+    u.swaps.swap(mswaps);
+    u.removed.swap(mrows);
+}
+
+/* Edit at every cursor, the main one included: insert 'len' bytes of 's',
+ * that may span lines ("\n" or "\r\n"), or if 's' is NULL delete the char
+ * before the cursor, joining its row to the one above at its start. The
+ * rows a cursor is in, joined rows together, are a run, whose new content
+ * is built and split into new rows. */
+static void editorCursorsEdit(const char *s, size_t len) {
+    PROFILE_ZONE("editorCursorsEdit");
+    if (!s && E.numrows == 0) return;
+    std::vector<editorEditCursor> cur;
+    cur.reserve(E.cursors.size()+1);
+    for (auto &c : E.cursors) cur.push_back({c.row,c.col,0,0});
+    cur.push_back({E.rowoff+E.cy,editorCursorOffset(),1,0});
+    for (auto &c : cur) {
+        if (c.row >= E.numrows) {
+            c.row = E.numrows;
+            c.col = 0;
+        } else {
+            c.col = std::min(std::max(c.col,0),E.row[c.row].size);
+        }
+    }
+    editorEditCursorsMerge(cur);
+
+    std::string text;
+    for (size_t j = 0; s && j < len; j++)
+        if (s[j] != '\r' || j+1 == len || s[j+1] != '\n') text.push_back(s[j]);
+
+    std::vector<editorRowSwap> swaps;
+    std::vector<erow> rows;
+    std::string buf;
+    size_t k = 0;
+    int shift = 0;  /* Rows added so far, less the ones removed. */
+    while (k < cur.size()) {
+        /* Rows past the end are empty: the cursor can be just past it. */
+        int first = cur[k].row, last = first;
+        if (!s && cur[k].col == 0 && first > 0) first--;
+        size_t from = k, end = k;
+        while (end < cur.size() && (cur[end].row == last ||
+               (!s && cur[end].row == last+1 && cur[end].col == 0)))
+            last = cur[end++].row;
+
+        buf.clear();
+        for (int r = first; r <= last; r++) {
+            erow *row = r < E.numrows ? E.row+r : NULL;
+            const char *chars = row ? editorRowChars(row) : "";
+            int size = row ? row->size : 0, pos = 0;
+            for (; k < end && cur[k].row == r; k++) {
+                int col = cur[k].col;
+                if (s) {
+                    buf.append(chars+pos,col-pos);
+                    buf.append(text);
+                } else if (col > 0) {
+                    int prev = std::max(utf8Prev(chars,col),pos);
+                    buf.append(chars+pos,prev-pos);
+                }
+                pos = col;
+                cur[k].off = buf.size();
+            }
+            buf.append(chars+pos,size-pos);
+        }
+
+        /* Split the run into rows, and put the cursors in them. */
+        size_t start = 0, c = from;
+        int m = 0;
+        for (;;) {
+            const char *nl = (const char*) memchr(buf.data()+start,'\n',
+                                                  buf.size()-start);
+            size_t stop = nl ? nl-buf.data() : buf.size();
+            erow row;
+            memcpy(editorInitRow(&row,first+shift+m,stop-start),
+                   buf.data()+start,stop-start);
+            editorRenderRow(&row);
+            rows.push_back(row);
+            for (; c < end && cur[c].off <= stop; c++) {
+                cur[c].row = first+shift+m;
+                cur[c].col = cur[c].off-start;
+            }
+            m++;
+            if (!nl) break;
+            start = stop+1;
+        }
+        int n = std::min(last,E.numrows-1)-first+1;
+        swaps.push_back({first,n,m});
+        shift += m-n;
+    }
+
+    /* Edits that keep every row merge into the undo state of the ones just
+     * before them. */
+    int inplace = 1;
+    for (auto &w : swaps) if (w.n != 1 || w.m != 1) inplace = 0;
+    int merge = inplace && E.undo.inplace && E.undo.dirty == E.dirty;
+    if (!merge) {
+        editorUndoClear();
+        E.undo.filerow = E.rowoff+E.cy;
+        E.undo.filecol = editorCursorOffset();
+        E.undo.cursors = E.cursors;
+    }
+    editorSwapRows(swaps,rows,0);
+    if (merge) {
+        editorUndoMerge(swaps,rows);
+        E.undo.merged = 1;
+    } else {
+        E.undo.swaps.swap(swaps);
+        E.undo.removed.swap(rows);
+        E.undo.inplace = inplace;
+    }
+    E.undo.dirty = E.dirty;
+
+    editorEditCursorsMerge(cur);
+    E.cursors.clear();
+    int filerow = 0, filecol = 0;
+    for (auto &c : cur) {
+        if (c.main) {
+            filerow = c.row;
+            filecol = c.col;
+        } else {
+            E.cursors.push_back({c.row,c.col});
+        }
+    }
+    editorSetCursor(filerow,filecol);
+}
+
+/* Put a cursor at the start of every match of 'query', replacing the other
+ * cursors, the main one going to the first match at or after it. Returns
+ * the number of matches, or -1 if the file can't be changed. */
+int editorCursorsAdd(const char *query) {
+    PROFILE_ZONE("editorCursorsAdd");
+    if (editorReadOnly()) return -1;
+    size_t qlen = strlen(query);
+    if (qlen == 0) return 0;
+    std::vector<editorCursor> found;
+    for (int j = 0; j < E.numrows; j++) {
+        const char *chars = editorRowChars(E.row+j), *p = chars, *m;
+        const char *end = chars+E.row[j].size;
+        while ((m = grepFind(p,end-p,query,qlen)) != NULL) {
+            found.push_back({j,(int) (m-chars)});
+            p = m+qlen;
+        }
+    }
+    if (found.empty()) return 0;
+
+    editorCursor main = {E.rowoff+E.cy,editorCursorOffset()};
+    auto it = std::lower_bound(found.begin(),found.end(),main,
+        [](const editorCursor &a, const editorCursor &b) {
+            return a.row < b.row || (a.row == b.row && a.col < b.col);
+        });
+    if (it == found.end()) it = found.begin();
+    main = *it;
+    found.erase(it);
+    E.cursors.swap(found);
+    editorSetCursor(main.row,main.col);
+    return E.cursors.size()+1;
+}
+
+/* Leave only the main cursor. */
+void editorCursorsClear(void) {
+    E.cursors.clear();
+}
+
+/* Number of cursors besides the main one. */
+int editorCursorsCount(void) {
+    return E.cursors.size();
+}
+
+/* Move the other cursors 'rows' rows down, or up if negative, keeping their
+ * display column as far as the row is long, then 'chars' chars right, or
+ * left, going on at the next or previous row at the end of a row, like the
+ * main cursor. Cursors ending up together, or with the main one, merge. */
+void editorCursorsMove(int rows, int chars) {
+    std::vector<editorEditCursor> cur;
+    cur.reserve(E.cursors.size()+1);
+    for (auto &c : E.cursors) {
+        int row = c.row, col = c.col;
+        if (rows) {
+            int dcol = row < E.numrows ? editorRowOffToCol(E.row+row,col) : 0;
+            row = std::min(std::max(row+rows,0),E.numrows);
+            col = row < E.numrows ? std::min(editorRowColToOff(E.row+row,
+                  dcol),E.row[row].size) : 0;
+        }
+        for (int j = 0; j < chars; j++) {
+            if (row < E.numrows && col < E.row[row].size) {
+                col = utf8Next(editorRowChars(E.row+row),E.row[row].size,col);
+            } else if (row < E.numrows) {
+                row++;
+                col = 0;
+            }
+        }
+        for (int j = 0; j > chars; j--) {
+            if (row < E.numrows && col > 0) {
+                col = utf8Prev(editorRowChars(E.row+row),col);
+            } else if (row > 0) {
+                row--;
+                col = E.row[row].size;
+            }
+        }
+        cur.push_back({row,col,0,0});
+    }
+    cur.push_back({E.rowoff+E.cy,editorCursorOffset(),1,0});
+    editorEditCursorsMerge(cur);
+    E.cursors.clear();
+    for (auto &c : cur) if (!c.main) E.cursors.push_back({c.row,c.col});
+}
+
+/* Screen positions of the other cursors that are on screen, as rows and
+ * columns. */
+void editorCursorsScreen(std::vector<editorCursor> &pos) {
+    pos.clear();
+    if (E.cursors.empty()) return;
+    int64_t top = 0;
+    if (E.wrap) {
+        editorWrapValidate();
+        top = editorRowVisualStart(E.rowoff)+E.wrapoff;
+    }
+    auto it = std::lower_bound(E.cursors.begin(),E.cursors.end(),E.rowoff,
+        [](const editorCursor &c, int row) { return c.row < row; });
+    for (; it != E.cursors.end(); ++it) {
+        int col = it->row < E.numrows ?
+                  editorRowOffToCol(E.row+it->row,it->col) : 0;
+        int64_t y;
+        int x;
+        if (E.wrap) {
+            y = editorRowVisualStart(it->row) + col/E.screencols - top;
+            x = col%E.screencols;
+        } else {
+            y = it->row-E.rowoff;
+            x = col-E.coloff;
+        }
+        if (y >= E.screenrows) break;
+        if (y >= 0 && x >= 0 && x < E.screencols) pos.push_back({(int) y,x});
+    }
+}
+
+int editorFileWasModified(void) {
+    return E.dirty;
+}
+
+/* Reset the editor state for a screen of the given size, in characters. */
+void initEditor(int screenrows, int screencols) {
+    E.cx = 0;
+    E.cy = 0;
+    E.rowoff = 0;
+    E.coloff = 0;
+    E.wrap = 0;
+    E.wrapoff = 0;
+    E.wrapvalid = 0;
+    E.offvalid = 0;
+    E.numrows = 0;
+    E.row = NULL;
+    E.dirty = 0;
+    E.filename = NULL;
+    E.syntax = NULL;
+    memset(&E.disk,0,sizeof(E.disk));
+    E.follow = 0;
+    E.followfd = -1;
+    E.view = NULL;
+    E.nocache = 0;
+    E.results = 0;
+    E.cursors.clear();
+    E.undo.rows.clear();
+    E.undo.swaps.clear();
+    E.undo.removed.clear();
+    E.undo.inplace = 0;
+    E.undo.merged = 0;
+    E.undo.cursors.clear();
+    E.undo.dirty = 0;
+    E.filter.pid = -1;
+    E.minimap.height = 0;
+    E.minimap.moved = -1;
+    E.minimap.redraw = 1;
+    editorWordsClear();
+    E.words.on = 0;
+    editorGutterStop();
+    E.screenrows = screenrows;
+    E.screencols = screencols;
+}
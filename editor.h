@@ -0,0 +1,483 @@
+/* Kilo editor core: rows, syntax highlighting, file I/O and search.
+ *
+ * Everything here works on the editor state 'E' of the buffer shown (see
+ * editorBufferOpen() for the others) and does not depend on SDL, so it is
+ * shared by the SDL frontend (kilo.cpp) and the micro benchmarks
+ * (bench/bench.cpp). */
+
+#ifndef KILO_EDITOR_H
+#define KILO_EDITOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <exception>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "fenwick.h"
+#include "filewatch.h"
+#include "lineindex.h"
+
+#define KILO_VERSION "0.0.1"
+
+class Exception : public std::exception {
+	std::string msg;
+public:
+	Exception(std::string amsg) : msg(amsg) {}
+	const char* what() const noexcept {
+		return msg.c_str();
+	}
+};
+
+#define TAB_SIZE 4
+#define TAB '\t'
+
+/* Syntax highlight types */
+#define HL_NORMAL 0
+#define HL_NONPRINT 1
+#define HL_COMMENT 2   /* Single line comment. */
+#define HL_MLCOMMENT 3 /* Multi-line comment. */
+#define HL_KEYWORD1 4
+#define HL_KEYWORD2 5
+#define HL_STRING 6
+#define HL_NUMBER 7
+#define HL_MATCH 8      /* Search match. */
+
+#define HL_HIGHLIGHT_STRINGS (1<<0)
+#define HL_HIGHLIGHT_NUMBERS (1<<1)
+
+struct editorSyntax {
+    char **filematch;
+    char **keywords;
+    char singleline_comment_start[3];
+    char multiline_comment_start[3];
+    char multiline_comment_end[3];
+    int flags;
+};
+
+/* A char of a row that is not one byte wide in every representation: a TAB
+ * or a non ASCII (possibly invalid) UTF-8 sequence. Every row keeps the
+ * list of these, in order, so that byte offsets in 'chars', byte offsets in
+ * 'render' and display columns can be converted into each other with a
+ * binary search: between two entries all the three advance together. Pure
+ * ASCII rows, the common case, have no entries at all. */
+typedef struct ewide {
+    int off;                /* Offset in chars. */
+    int roff;               /* Offset in render. */
+    int col;                /* Display column. */
+    unsigned char len;      /* Bytes in chars. */
+    unsigned char rlen;     /* Bytes in render. */
+    unsigned char width;    /* Display columns: 0 to TAB_SIZE. */
+} ewide;
+
+/* The rendered version of a row with TABs or non ASCII chars, and the index
+ * of these chars. It is allocated in one piece, 'wide' and 'render' pointing
+ * right after the structure. Rows without such chars, the common case, have
+ * none: what is rendered is their content. */
+typedef struct erender {
+    int rwidth;         /* Display columns of the rendered row. */
+    int nwide;          /* Number of entries in 'wide'. */
+    ewide *wide;        /* TABs and non ASCII chars of the row, see ewide. */
+    char *render;       /* Row content "rendered" for screen (for TABs), or
+                           NULL if the same as the content: valid UTF-8
+                           without TABs. */
+} erender;
+
+#define ROW_INLINE (1<<0)   /* Storage in the row itself, see erow. */
+#define ROW_HL (1<<1)       /* Highlight stored after the content. */
+
+/* This structure represents a single line of the file we are editing.
+ *
+ * Rows are kept small, as files have millions of them, most of them short:
+ * the content, its null term and its syntax highlight share a single heap
+ * allocation, or no allocation at all if they fit in the row itself. The
+ * highlight is not stored when every char is HL_NORMAL, as is all the text
+ * without a syntax, and the rendered row only when it differs from the
+ * content. Use the editorRowChars(), editorRowRender() and editorRowHl()
+ * accessors below. */
+typedef struct erow {
+    int idx;            /* Row index in the file, zero-based. */
+    int size;           /* Size of the row, excluding the null term. */
+    int rsize;          /* Size of the rendered row. */
+    unsigned char hl_oc;    /* Row had open comment at end in last syntax
+                               highlight check. */
+    unsigned char flags;    /* ROW_INLINE, ROW_HL. */
+    unsigned short mini;    /* The row in the minimap, see MINIMAP_ROW(). */
+    union {
+        char *data;     /* Content, null term and highlight. */
+        char inl[8];    /* The same when it fits, if ROW_INLINE. */
+    } u;
+    erender *rend;      /* Rendered row, NULL if the same as the content. */
+} erow;
+
+/* Row content, null terminated. */
+static inline char *editorRowChars(erow *row) {
+    return (row->flags & ROW_INLINE) ? row->u.inl : row->u.data;
+}
+
+/* Row content "rendered" for screen, null terminated. */
+static inline char *editorRowRender(erow *row) {
+    return row->rend && row->rend->render ? row->rend->render :
+                                            editorRowChars(row);
+}
+
+/* Syntax highlight type for each byte in render, or NULL if they are all
+ * HL_NORMAL. */
+static inline unsigned char *editorRowHl(erow *row) {
+    if (!(row->flags & ROW_HL)) return NULL;
+    return (unsigned char*) editorRowChars(row)+row->size+1;
+}
+
+/* Display columns of the rendered row. */
+static inline int editorRowWidth(erow *row) {
+    return row->rend ? row->rend->rwidth : row->size;
+}
+
+/* The minimap is an overview of the whole file, one pixel row for one or
+ * more file rows, and MINIMAP_WIDTH cells across, one for MINIMAP_COLS
+ * display columns. Every row is summarized by the highlight class most of
+ * its chars have, and the cells from its first non blank char to its end:
+ * see MINIMAP_ROW(), 0 being a blank row. */
+#define MINIMAP_WIDTH 60    /* Cells across, at most 63. */
+#define MINIMAP_COLS 2      /* Display columns in a cell. */
+#define MINIMAP_TILE 64     /* Pixel rows drawn again as a unit. */
+#define MINIMAP_ROW(hl,first,end) (((hl)+1) | (first)<<4 | (end)<<10)
+#define MINIMAP_HL(mini) (((mini)&15)-1)
+#define MINIMAP_FIRST(mini) ((mini)>>4 & 63)
+#define MINIMAP_END(mini) ((mini)>>10 & 63)
+
+/* The file on disk, as of the last time the editor read or wrote it. */
+struct editorDiskState {
+    int64_t size;   /* Bytes read or written. */
+    int partial;    /* The last line has no newline at the end. */
+    dev_t dev;      /* Device and inode, to notice when the file is */
+    ino_t ino;      /* replaced by another one. */
+    int64_t mtime;  /* Modification time, in nanoseconds. */
+    int stale;      /* Changed on disk, and the user was told. */
+    int gzip;       /* Compressed with gzip: decompressed on load, and
+                       compressed again on save. */
+};
+
+/* Read only view of a file too large to load: only a window of rows around
+ * the cursor is in E.row, see editorViewOpen(). */
+struct editorView {
+    int fd;
+    int64_t size;               /* Bytes in the file. */
+    lineIndex index;            /* Sparse index of the lines. */
+    std::vector<int64_t> off;   /* Offset of every row in the window, and
+                                   where the window ends. */
+    int64_t line;               /* Line of the first row, -1 if unknown. */
+    int firstoc;                /* The first row starts inside a comment. */
+    int hlknown;                /* The highlight of the first row started
+                                   from the right comment state. */
+};
+
+/* A row changed by the last replace all, with its previous content. */
+struct editorUndoRow {
+    int idx;
+    int size;
+    char *chars;    /* Heap allocated, null terminated. */
+};
+
+/* Rows [at,at+n) replaced by m rows, see editorSwapRows(). */
+struct editorRowSwap {
+    int at, n, m;
+};
+
+/* A cursor besides the main one, see editorCursorsAdd(). */
+struct editorCursor {
+    int row;
+    int col;        /* Byte offset in the row. */
+};
+
+/* What the last replace all, filter or edit at multiple cursors changed, to
+ * undo it as a single edit. */
+struct editorUndo {
+    std::vector<editorUndoRow> rows;    /* In file order. */
+    std::vector<editorRowSwap> swaps;   /* Rows swapped in, in file order,
+                                           by a filter or cursors... */
+    std::vector<erow> removed;  /* ...and the rows they replaced, whole. */
+    int inplace;        /* Edits at cursors that kept every row: more of
+                           them can be merged in. */
+    int merged;         /* Some were: the rows taken out after the first
+                           one were highlighted in between, not as they
+                           were before, and need highlighting again. */
+    std::vector<editorCursor> cursors;  /* Other cursors before them. */
+    int dirty;          /* E.dirty right after the change: other edits
+                           since make it impossible to undo. */
+    int filerow, filecol;   /* Cursor before the change. */
+};
+
+/* The minimap of the file, built from the row summaries, and updated a
+ * pixel row at a time as rows change. Every pixel is the highlight class
+ * of most of the rows covering it in the high 4 bits, and how many of them
+ * cover it, from 0 (empty) to 15 (all), in the low 4 bits. */
+struct editorMinimap {
+    int height;     /* Pixel rows, 0 if not built yet. */
+    int scale;      /* File rows in a pixel row, a power of two. */
+    int rows;       /* Pixel rows covered by the file. */
+    int moved;      /* First row added or removed since the last update,
+                       or -1. */
+    int redraw;     /* Report every tile on the next update. */
+    std::vector<unsigned char> pixels;  /* MINIMAP_WIDTH per pixel row. */
+    std::vector<unsigned char> stale;   /* Pixel rows to build again. */
+};
+
+/* Identifiers of the buffer, for word completion, and how many times each
+ * one occurs. The rows are split in blocks of about WORDS_BLOCK rows or
+ * WORDS_BLOCK_BYTES bytes that remember what they added to the counts, so
+ * that a changed row only has its block indexed again, see
+ * editorWordsPoll(). */
+#define WORDS_BLOCK 64              /* Rows in a block... */
+#define WORDS_BLOCK_BYTES 2048      /* ...or bytes, up to twice as many. */
+#define WORDS_MIN 2         /* Shorter words are not indexed... */
+#define WORDS_MAX 64        /* ...and neither are longer ones. */
+#define WORDS_NEAR 2048     /* Rows around the cursor whose words rank
+                               higher when completing. */
+
+typedef std::map<std::string,int> editorWordMap;
+
+struct editorWordBlock {
+    int rows;       /* Rows in the block. */
+    int dirty;      /* Rows changed since it was indexed. */
+    std::vector<std::pair<editorWordMap::iterator,int>> words;  /* And how
+                                   many times they are in the block. */
+};
+
+struct editorWords {
+    int on;                 /* The buffer is being indexed. */
+    editorWordMap words;    /* Every word, and how many times it occurs. */
+    std::vector<editorWordBlock> blocks;    /* In row order. */
+    int dirty;              /* Blocks to index again. */
+    int cached;             /* Block found last, or -1... */
+    int cachedstart;        /* ...and its first row. */
+};
+
+/* Lines changed since the file was read or saved, for the gutter. The lines
+ * on disk are kept as hashes, and 'hunks' is an edit script turning them
+ * into the rows, though not always the shortest one: an edit merges the
+ * hunks it touches into a dirty one, and a background thread diffs the
+ * dirty hunks again, see editorGutterPoll(). */
+#define GUTTER_CHANGED (1<<0)   /* The row replaced a line on disk. */
+#define GUTTER_ADDED (1<<1)     /* The row is new. */
+#define GUTTER_REMOVED (1<<2)   /* Lines were removed above the row... */
+#define GUTTER_REMOVED_END (1<<3)   /* ...or below it, the last one. */
+
+struct gutterHunk {
+    int a, alen;    /* Lines [a,a+alen) on disk are replaced by */
+    int b, blen;    /* rows [b,b+blen). */
+    unsigned id;    /* Job diffing it, or 0. */
+    int dirty;      /* Edited since it was last diffed. */
+};
+
+struct gutterWorker;
+
+struct editorGutter {
+    int on;         /* The buffer is a file, and is compared with it. */
+    std::shared_ptr<const std::vector<uint64_t>> disk;  /* Line hashes. */
+    std::vector<gutterHunk> hunks;  /* In row order. */
+    int dirty;      /* Hunks were edited since the last diff started. */
+    std::shared_ptr<gutterWorker> worker;   /* Started on the first diff. */
+};
+
+/* A command some rows are piped through, their replacement being its
+ * output, see editorFilterStart(). */
+#define FILTER_ERROR_MAX 256    /* Bytes kept of its standard error. */
+
+struct editorFilter {
+    pid_t pid;          /* The command, or -1 if not filtering. */
+    int in, out, err;   /* Its stdin, stdout and stderr, -1 once closed. */
+    int first, last;    /* Rows [first,last) are piped through it. */
+    int next;           /* Row being written... */
+    int written;        /* ...and its bytes written, newline included. */
+    std::vector<erow> rows;     /* Output lines read so far. */
+    std::string line;           /* Output after the last newline. */
+    std::string error;          /* Start of its standard error. */
+    std::string cmd;
+    int64_t shown;      /* When the progress was last shown, in ms. */
+};
+
+typedef struct hlcolor {
+    int r,g,b;
+} hlcolor;
+
+struct editorConfig {
+    int cx,cy;  /* Cursor x and y position on screen, in display columns
+                   and rows. When wrapping, cx is the column in the row and
+                   cy the row relative to rowoff. */
+    int rowoff;     /* Offset of row displayed. */
+    int coloff;     /* First display column shown. */
+    int wrap;       /* Soft wrap rows longer than the screen. */
+    int wrapoff;    /* Visual line of row 'rowoff' shown first, when
+                       wrapping. */
+    fenwick wrapidx;    /* Visual lines of every row, when wrapping. */
+    int wrapcols;   /* Screen columns 'wrapidx' was built for. */
+    int wrapvalid;  /* False if rows were added or removed since 'wrapidx'
+                       was built. */
+    fenwick offidx; /* Bytes of every row, newline included. */
+    int offvalid;   /* False if rows were added or removed since 'offidx'
+                       was built. */
+    int screenrows; /* Number of rows that we can show */
+    int screencols; /* Number of cols that we can show */
+    int numrows;    /* Number of rows */
+    int rawmode;    /* Is terminal raw mode enabled? */
+    erow *row;      /* Rows */
+    int dirty;      /* File modified but not saved. */
+    char *filename; /* Currently open filename */
+    char statusmsg[80];
+    time_t statusmsg_time;
+    struct editorSyntax *syntax;    /* Current syntax highlight, or NULL. */
+    struct editorDiskState disk;    /* The file on disk. */
+    int follow;     /* Follow mode: load what is appended to the file. */
+    int followfd;   /* File being followed, or -1. */
+    fileWatch watch;    /* Change notifications for the file. */
+    struct editorView *view;    /* Read only view, or NULL. */
+    int nocache;    /* Don't use the cache of the line index of views. */
+    int results;    /* Project search results, read only. */
+    std::vector<editorCursor> cursors;  /* Other cursors, sorted. */
+    struct editorUndo undo;     /* Last replace all, filter or edit at
+                                   multiple cursors. */
+    struct editorFilter filter; /* Command the rows are piped through. */
+    struct editorMinimap minimap;
+    struct editorWords words;   /* Word index, for completion. */
+    struct editorGutter gutter; /* Lines changed since the file was saved. */
+};
+
+extern thread_local struct editorConfig E;
+
+/* Syntax highlighting. */
+int is_separator(int c);
+int is_word_char(int c);
+int editorRowHasOpenComment(erow *row);
+void editorUpdateSyntax(erow *row);
+void editorRowSetHighlight(erow *row, int roff, int len, int hl);
+void editorUpdateSyntaxRange(int first, int last);
+void editorSelectSyntaxHighlight(char *filename);
+
+/* Rows. */
+void editorUpdateRow(erow *row);
+void editorInsertRow(int at, char *s, size_t len);
+void editorFreeRow(erow *row);
+void editorDelRow(int at);
+void editorClearRows(void);
+char *editorRowsToString(int *buflen);
+void editorRowInsertChar(erow *row, int at, int c);
+void editorRowAppendString(erow *row, char *s, size_t len);
+void editorRowDelChar(erow *row, int at);
+void editorRowDelRange(erow *row, int at, int len);
+void editorInsertTextAt(int *filerow, int *filecol, const char *s, size_t len);
+int editorRowOffToCol(erow *row, int off);
+int editorRowColToOff(erow *row, int col);
+int editorRowRoffToCol(erow *row, int roff);
+int editorRowColToRoff(erow *row, int col);
+int editorRowWideFrom(erow *row, int roff);
+
+/* Editing at the cursor position. */
+int editorCursorOffset(void);
+void editorSetCursor(int filerow, int filecol);
+void editorFixCursorCol(void);
+void editorMoveRows(int delta);
+void editorMovePages(int pages);
+int editorScrollView(int delta);
+void editorJumpTo(int filerow, int filecol);
+void editorCursorScreen(int *x, int *y);
+void editorGotoVisualLine(int64_t line);
+void editorSetWrap(int on);
+void editorResize(int screenrows, int screencols);
+
+/* Byte offsets in the file. */
+int64_t editorRowFileOffset(int filerow);
+int64_t editorCursorFileOffset(void);
+void editorFileOffsetToPos(int64_t offset, int *filerow, int *filecol);
+void editorInsertChar(int c);
+void editorInsertNewline(void);
+void editorInsertText(const char *s, size_t len);
+void editorDelChar(void);
+
+/* Files. */
+int editorOpen(char *filename);
+void editorOpenStart(const char *filename, int view, int screenrows,
+                     int screencols, int nocache);
+int editorOpenPreview(const char *filename, int screenrows, int screencols);
+void editorOpenWait(int screenrows, int screencols);
+int editorSave(void);
+int editorFileWasModified(void);
+int editorDiskChanged(void);
+int editorReload(void);
+int editorCheckDisk(void);
+
+/* Follow mode. */
+int editorFollowStart(void);
+void editorFollowStop(void);
+int editorFollowPoll(void);
+
+/* Read only view of large files. */
+int editorViewOpen(char *filename);
+void editorViewClose(void);
+int editorViewPoll(void);
+int64_t editorViewCursorLine(void);
+int64_t editorViewLines(int *done);
+void editorViewGotoLine(int64_t line);
+void editorViewGotoOffset(int64_t offset);
+int64_t editorViewFind(const char *query, int64_t from, int dir, int64_t *next);
+
+/* Buffers. */
+int editorBufferOpen(const char *filename, int show);
+int editorBufferOpenAt(const char *filename, int filerow, int filecol);
+int editorBufferPoll(void);
+int editorBufferSwitch(int j);
+int editorBufferNext(int dir);
+int editorBufferClose(void);
+int editorBufferCount(void);
+int editorBufferCurrent(void);
+int editorBufferLoading(void);
+int editorBufferDirty(void);
+
+/* Project search. */
+int editorGrepStart(const char *root, const char *query);
+int editorGrepPoll(void);
+void editorGrepStop(void);
+int editorGrepRunning(void);
+int editorGrepOpen(void);
+
+/* Minimap. */
+int editorMinimapUpdate(int height, std::vector<int> &tiles);
+
+/* Word completion. */
+void editorWordsStart(void);
+int editorWordsPoll(void);
+int editorComplete(const char *prefix, int len, int filerow,
+                   std::vector<std::string> &words, int max);
+
+/* Modified lines gutter. */
+int editorGutterPoll(void);
+int editorGutterBusy(void);
+int editorGutterMark(int filerow);
+
+/* Search. */
+int editorFindRow(const char *query, int from, int dir, int *offset);
+
+/* Replace. */
+int64_t editorReplaceAll(const char *query, const char *repl, int regex);
+int editorUndo(void);
+
+/* Filter through an external command. */
+int editorFilterStart(const char *cmd, int first, int last);
+int editorFilterPoll(void);
+void editorFilterStop(void);
+int editorFilterRunning(void);
+
+/* Multiple cursors. */
+int editorCursorsAdd(const char *query);
+void editorCursorsClear(void);
+int editorCursorsCount(void);
+void editorCursorsMove(int rows, int chars);
+void editorCursorsScreen(std::vector<editorCursor> &pos);
+
+void editorSetStatusMessage(const char *fmt, ...);
+void initEditor(int screenrows, int screencols);
+
+#endif
@@ -0,0 +1,75 @@
+/* Fenwick tree (binary indexed tree) over a sequence of non negative counts,
+ * used to index the rows by prefix sums of a per-row quantity.
+ *
+ * Changing a count and computing a prefix sum both cost O(log n), and so
+ * does finding the element that contains a given position, and adding or
+ * removing an element at the end. Inserting or removing elements elsewhere
+ * is not supported: callers rebuild the tree, which takes linear time. */
+
+#ifndef KILO_FENWICK_H
+#define KILO_FENWICK_H
+
+#include <stdint.h>
+#include <vector>
+
+struct fenwick {
+    std::vector<int64_t> t;     /* 1-based partial sums, t[0] is unused. */
+
+    int size() const {
+        return t.empty() ? 0 : (int) t.size()-1;
+    }
+
+    /* Rebuild the tree with 'n' counts, count(i) giving the i-th one. */
+    template<typename F> void build(int n, F count) {
+        t.assign(n+1,0);
+        for (int i = 1; i <= n; i++) {
+            t[i] += count(i-1);
+            int parent = i + (i & -i);
+            if (parent <= n) t[parent] += t[i];
+        }
+    }
+
+    /* Append a count at the end. */
+    void push_back(int64_t count) {
+        if (t.empty()) t.push_back(0);
+        int i = t.size();
+        t.push_back(count + prefix(i-1) - prefix(i - (i & -i)));
+    }
+
+    /* Remove the last count. */
+    void pop_back() {
+        if (size()) t.pop_back();
+    }
+
+    /* Add 'delta' to the i-th count. */
+    void add(int i, int64_t delta) {
+        for (i++; i < (int) t.size(); i += i & -i) t[i] += delta;
+    }
+
+    /* Sum of the first 'i' counts. */
+    int64_t prefix(int i) const {
+        int64_t sum = 0;
+        for (; i > 0; i -= i & -i) sum += t[i];
+        return sum;
+    }
+
+    int64_t get(int i) const {
+        return prefix(i+1) - prefix(i);
+    }
+
+    /* Index of the element containing position 'pos', that is the last i
+     * such that prefix(i) <= pos, or size() if 'pos' is past the total. */
+    int find(int64_t pos) const {
+        int i = 0, n = size(), step = 1;
+        while (step*2 <= n) step *= 2;
+        for (; step; step /= 2) {
+            if (i+step <= n && t[i+step] <= pos) {
+                i += step;
+                pos -= t[i];
+            }
+        }
+        return i;
+    }
+};
+
+#endif
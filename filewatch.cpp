@@ -0,0 +1,84 @@
+/* File change notifications, see filewatch.h. */
+
+#include <unistd.h>
+#include <string.h>
+#include "filewatch.h"
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+using namespace std;
+
+#ifdef __linux__
+
+#define FW_FILE_EVENTS (IN_MODIFY|IN_ATTRIB|IN_CLOSE_WRITE|IN_MOVE_SELF| \
+                        IN_DELETE_SELF)
+#define FW_DIR_EVENTS (IN_CREATE|IN_MOVED_TO)
+
+/* Start watching 'path'. The file does not need to exist yet. Returns 0 on
+ * success, 1 on error. */
+int fileWatchStart(fileWatch &w, const char *path) {
+    fileWatchStop(w);
+    w.path = path;
+    size_t slash = w.path.rfind('/');
+    string dir = slash == string::npos ? "." : w.path.substr(0,slash+1);
+    w.name = slash == string::npos ? w.path : w.path.substr(slash+1);
+
+    w.fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if (w.fd == -1) return 1;
+    w.dirwd = inotify_add_watch(w.fd,dir.c_str(),FW_DIR_EVENTS);
+    w.wd = inotify_add_watch(w.fd,path,FW_FILE_EVENTS);
+    return 0;
+}
+
+/* Collect the pending notifications without blocking. Returns a mask of
+ * FW_* flags, 0 if nothing happened. */
+int fileWatchPoll(fileWatch &w) {
+    if (w.fd == -1) return FW_CHANGED;
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int flags = 0;
+    ssize_t n;
+    while ((n = read(w.fd,buf,sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf+n; ) {
+            struct inotify_event *ev = (struct inotify_event*) p;
+            if (ev->wd == w.wd) {
+                if (ev->mask & (IN_MOVE_SELF|IN_DELETE_SELF|IN_IGNORED))
+                    flags |= FW_REPLACED;
+                else
+                    flags |= FW_CHANGED;
+            } else if (ev->wd == w.dirwd && ev->len &&
+                       !strcmp(ev->name,w.name.c_str())) {
+                flags |= FW_REPLACED;
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+
+    /* Watch the file that now has our name, if any. */
+    if (flags & FW_REPLACED) {
+        if (w.wd != -1) inotify_rm_watch(w.fd,w.wd);
+        w.wd = inotify_add_watch(w.fd,w.path.c_str(),FW_FILE_EVENTS);
+    }
+    return flags;
+}
+
+void fileWatchStop(fileWatch &w) {
+    if (w.fd != -1) close(w.fd);
+    w.fd = w.wd = w.dirwd = -1;
+}
+
+#else
+
+int fileWatchStart(fileWatch &w, const char *path) {
+    w.path = path;
+    return 0;
+}
+
+int fileWatchPoll(fileWatch &w) {
+    return FW_CHANGED;
+}
+
+void fileWatchStop(fileWatch &w) {
+}
+
+#endif
@@ -0,0 +1,28 @@
+/* Watch a file for changes with inotify, also noticing when it is replaced
+ * by another file with the same name (log rotation, editors and tools that
+ * write a new file and rename it over the old one).
+ *
+ * Without inotify, fileWatchPoll() always reports a change, so that callers
+ * fall back to checking the file themselves every time. */
+
+#ifndef KILO_FILEWATCH_H
+#define KILO_FILEWATCH_H
+
+#include <string>
+
+#define FW_CHANGED (1<<0)   /* The file was written or its attributes changed. */
+#define FW_REPLACED (1<<1)  /* The file was moved, deleted or created anew. */
+
+struct fileWatch {
+    int fd = -1;            /* inotify instance, -1 if not watching. */
+    int wd = -1;            /* Watch of the file, -1 if it does not exist. */
+    int dirwd = -1;         /* Watch of the directory of the file. */
+    std::string path;       /* Path of the watched file. */
+    std::string name;       /* File name, without the directory. */
+};
+
+int fileWatchStart(fileWatch &w, const char *path);
+int fileWatchPoll(fileWatch &w);
+void fileWatchStop(fileWatch &w);
+
+#endif
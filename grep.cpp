@@ -0,0 +1,364 @@
+/* Project wide search, see grep.h. */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include "grep.h"
+using namespace std;
+
+/* ============================== Substring search ========================== */
+
+/* Find 'needle' in the 'len' bytes at 's'. Returns a pointer to the first
+ * match, or NULL.
+ *
+ * With SSE2, 16 candidate positions are checked at a time comparing the
+ * first and the last byte of the needle, and only the positions where both
+ * match are compared in full: on text the filter leaves very few of them,
+ * whatever the first byte of the needle. */
+const char *grepFind(const char *s, size_t len, const char *needle,
+                     size_t nlen)
+{
+    if (nlen == 0) return s;
+    if (nlen > len) return NULL;
+    if (nlen == 1) return (const char*) memchr(s,needle[0],len);
+
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[nlen-1]);
+    for (; i+nlen-1+16 <= len; i += 16) {
+        __m128i bf = _mm_loadu_si128((const __m128i*) (s+i));
+        __m128i bl = _mm_loadu_si128((const __m128i*) (s+i+nlen-1));
+        unsigned mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(bf,first),_mm_cmpeq_epi8(bl,last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (!memcmp(s+i+bit+1,needle+1,nlen-2)) return s+i+bit;
+            mask &= mask-1;
+        }
+    }
+#endif
+    return (const char*) memmem(s+i,len-i,needle,nlen);
+}
+
+/* ============================== Ignore rules ============================== */
+
+/* A pattern of a .gitignore file. Without a slash it matches the name of a
+ * file or directory at any depth under the .gitignore, with one it matches
+ * the path relative to it. */
+struct grepRule {
+    string pattern;
+    bool negate;        /* "!pattern": not ignored after all. */
+    bool dironly;       /* "pattern/": only matches directories. */
+    bool anchored;      /* Matched against the relative path. */
+};
+
+/* The rules of a .gitignore file, and those of the directories above. */
+struct grepIgnore {
+    shared_ptr<const grepIgnore> parent;
+    string rel;         /* Directory of the .gitignore, like grepWork.rel. */
+    vector<grepRule> rules;
+};
+
+/* Load the .gitignore in 'path', on top of 'parent'. */
+static shared_ptr<const grepIgnore> grepLoadIgnore(const string &path,
+    const string &rel, const shared_ptr<const grepIgnore> &parent)
+{
+    FILE *fp = fopen((path+"/.gitignore").c_str(),"r");
+    if (!fp) return parent;
+    auto ig = make_shared<grepIgnore>();
+    ig->parent = parent;
+    ig->rel = rel;
+
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t len;
+    while ((len = getline(&line,&linecap,fp)) != -1) {
+        while (len && (line[len-1] == '\n' || line[len-1] == '\r' ||
+                       line[len-1] == ' ')) len--;
+        if (len == 0 || line[0] == '#') continue;
+        grepRule r;
+        r.pattern.assign(line,len);
+        r.negate = r.pattern[0] == '!';
+        if (r.negate) r.pattern.erase(0,1);
+        r.dironly = !r.pattern.empty() && r.pattern.back() == '/';
+        if (r.dironly) r.pattern.pop_back();
+        r.anchored = r.pattern.find('/') != string::npos;
+        if (!r.pattern.empty() && r.pattern[0] == '/') r.pattern.erase(0,1);
+        if (!r.pattern.empty()) ig->rules.push_back(r);
+    }
+    free(line);
+    fclose(fp);
+    return ig;
+}
+
+/* True if 'name', in the directory 'rel', is ignored: the last rule that
+ * matches it decides, the rules of the closest .gitignore going first. */
+static bool grepIgnored(const grepIgnore *ig, const string &rel,
+                        const char *name, bool isdir)
+{
+    string path;
+    for (; ig; ig = ig->parent.get()) {
+        for (size_t j = ig->rules.size(); j-- > 0; ) {
+            const grepRule &r = ig->rules[j];
+            if (r.dironly && !isdir) continue;
+            int nomatch;
+            if (r.anchored) {
+                path = rel.substr(ig->rel.size()) + name;
+                nomatch = fnmatch(r.pattern.c_str(),path.c_str(),FNM_PATHNAME);
+            } else {
+                nomatch = fnmatch(r.pattern.c_str(),name,0);
+            }
+            if (!nomatch) return !r.negate;
+        }
+    }
+    return false;
+}
+
+/* ================================= Search ================================= */
+
+static void grepPush(grepSearch *gs, int self, grepWork &&w) {
+    gs->pending++;
+    grepQueue &q = *gs->queues[self];
+    lock_guard<mutex> guard(q.lock);
+    q.work.push_back(move(w));
+}
+
+/* Take work from the back of our own queue, or steal it from the front of
+ * another one. Returns false if all the queues are empty. */
+static bool grepTake(grepSearch *gs, int self, grepWork &w) {
+    int n = gs->queues.size();
+    for (int k = 0; k < n; k++) {
+        grepQueue &q = *gs->queues[(self+k) % n];
+        lock_guard<mutex> guard(q.lock);
+        if (q.work.empty()) continue;
+        if (k == 0) {
+            w = move(q.work.back());
+            q.work.pop_back();
+        } else {
+            w = move(q.work.front());
+            q.work.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+/* Search the file 'name' of the directory of 'w', appending the matching
+ * lines to 'found', one per line. */
+static void grepFile(grepSearch *gs, const grepWork &w, const string &name,
+                     vector<grepMatch> &found)
+{
+    static thread_local vector<char> buf;
+    string path = w.path == "." ? name : w.path+"/"+name;
+    int fd = open(path.c_str(),O_RDONLY|O_CLOEXEC);
+    if (fd == -1) return;
+    struct stat st;
+    if (fstat(fd,&st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return;
+    }
+
+    /* Small files cost less to read than to map. */
+    size_t size = st.st_size;
+    const char *data;
+    void *map = MAP_FAILED;
+    if (size >= GREP_MMAP_MIN) {
+        map = mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return;
+        }
+        madvise(map,size,MADV_SEQUENTIAL);
+        data = (const char*) map;
+    } else {
+        buf.resize(size);
+        ssize_t n = pread(fd,buf.data(),size,0);
+        size = n > 0 ? n : 0;
+        data = buf.data();
+    }
+    close(fd);
+
+    bool binary = memchr(data,'\0',
+        size < GREP_BINARY_CHECK ? size : GREP_BINARY_CHECK) != NULL;
+    if (!binary) {
+        const char *q = gs->query.data(), *end = data+size, *p = data;
+        size_t qlen = gs->query.size();
+        const char *counted = data, *linestart = data, *m;
+        int64_t line = 0;
+        while (p < end && (m = grepFind(p,end-p,q,qlen)) != NULL) {
+            /* Count the lines up to the match. */
+            const char *nl;
+            while ((nl = (const char*) memchr(counted,'\n',m-counted))) {
+                line++;
+                linestart = counted = nl+1;
+            }
+            counted = m;
+            const char *lineend = (const char*) memchr(m,'\n',end-m);
+            if (!lineend) lineend = end;
+            size_t len = lineend-linestart;
+            if (len && linestart[len-1] == '\r') len--;
+            found.push_back({path,line,(int) (m-linestart),
+                string(linestart,len < GREP_LINE_MAX ? len : GREP_LINE_MAX)});
+            p = counted = lineend;   /* The rest of the line is skipped. */
+        }
+    }
+    if (map != MAP_FAILED) munmap(map,size);
+    gs->files++;
+    gs->bytes += size;
+}
+
+/* Read the directory of 'w': subdirectories are queued, and files are
+ * searched, except for the batches queued for other threads to steal when
+ * there are many of them. */
+static void grepReadDir(grepSearch *gs, int self, grepWork &w,
+                        vector<grepMatch> &found)
+{
+    DIR *dir = opendir(w.path.c_str());
+    if (!dir) return;
+    vector<pair<string,bool>> entries;  /* Name, is a directory. */
+    bool gitignore = false;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_name[0] == '.') {
+            gitignore |= !strcmp(de->d_name,".gitignore");
+            continue;   /* Hidden, or "." and "..". */
+        }
+        unsigned char type = de->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (fstatat(dirfd(dir),de->d_name,&st,AT_SYMLINK_NOFOLLOW) == -1)
+                continue;
+            type = S_ISDIR(st.st_mode) ? DT_DIR :
+                   S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+        if (type == DT_DIR || type == DT_REG)
+            entries.push_back({de->d_name,type == DT_DIR});
+    }
+    closedir(dir);
+
+    auto ignore = gitignore ? grepLoadIgnore(w.path,w.rel,w.ignore) :
+                              w.ignore;
+    grepWork files;
+    for (auto &e : entries) {
+        if (gs->stop) return;
+        if (ignore && grepIgnored(ignore.get(),w.rel,e.first.c_str(),
+                                  e.second)) continue;
+        if (e.second) {
+            grepWork sub;
+            sub.path = w.path == "." ? e.first : w.path+"/"+e.first;
+            sub.rel = w.rel+e.first+"/";
+            sub.ignore = ignore;
+            grepPush(gs,self,move(sub));
+            continue;
+        }
+        files.files.push_back(move(e.first));
+        if (files.files.size() == GREP_BATCH) {
+            files.path = w.path;
+            files.rel = w.rel;
+            grepPush(gs,self,move(files));
+            files = grepWork();
+        }
+    }
+    for (auto &name : files.files) {
+        if (gs->stop) return;
+        grepFile(gs,w,name,found);
+    }
+}
+
+/* Hand the matches found over to the caller. */
+static void grepFlush(grepSearch *gs, vector<grepMatch> &found) {
+    if (found.empty()) return;
+    lock_guard<mutex> guard(gs->lock);
+    if (gs->matches.empty()) {
+        gs->matches.swap(found);
+    } else {
+        move(found.begin(),found.end(),back_inserter(gs->matches));
+        found.clear();
+    }
+}
+
+static void grepWorker(grepSearch *gs, int self) {
+    vector<grepMatch> found;
+    grepWork w;
+    while (!gs->stop) {
+        if (!grepTake(gs,self,w)) {
+            /* Others may still queue more. */
+            if (gs->pending == 0) break;
+            this_thread::sleep_for(chrono::microseconds(50));
+            continue;
+        }
+        if (w.files.empty()) {
+            grepReadDir(gs,self,w,found);
+        } else {
+            for (auto &name : w.files) {
+                if (gs->stop) break;
+                grepFile(gs,w,name,found);
+            }
+        }
+        grepFlush(gs,found);
+        gs->pending--;
+    }
+    gs->running--;
+}
+
+/* Start searching 'query' in the files under 'root' with 'threads'
+ * threads, 0 for one per core. */
+void grepStart(grepSearch &gs, const char *root, const char *query,
+               int threads)
+{
+    grepStop(gs);
+    if (threads <= 0) threads = thread::hardware_concurrency();
+    if (threads <= 0) threads = 1;
+    gs.query = query;
+    gs.queues.clear();
+    for (int j = 0; j < threads; j++) gs.queues.emplace_back(new grepQueue);
+    gs.matches.clear();
+    gs.files = 0;
+    gs.bytes = 0;
+    gs.stop = false;
+
+    grepWork w;
+    w.path = root;
+    while (w.path.size() > 1 && w.path.back() == '/') w.path.pop_back();
+    grepPush(&gs,0,move(w));
+    gs.running = threads;
+    for (int j = 0; j < threads; j++)
+        gs.workers.emplace_back(grepWorker,&gs,j);
+}
+
+/* Take the matches found since the last call, appending them to 'found'.
+ * Returns 1 while the search goes on, 0 once it ended and every match was
+ * taken. */
+int grepPoll(grepSearch &gs, vector<grepMatch> &found) {
+    bool done = gs.running == 0;
+    {
+        lock_guard<mutex> guard(gs.lock);
+        move(gs.matches.begin(),gs.matches.end(),back_inserter(found));
+        gs.matches.clear();
+    }
+    if (!done) return 1;
+    grepStop(gs);
+    return 0;
+}
+
+void grepStop(grepSearch &gs) {
+    gs.stop = true;
+    for (auto &t : gs.workers) t.join();
+    gs.workers.clear();
+    gs.pending = 0;
+}
+
+grepSearch::~grepSearch() {
+    grepStop(*this);
+}
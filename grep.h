@@ -0,0 +1,78 @@
+/* Project wide search: find a string in every file under a directory.
+ *
+ * A pool of threads walks the tree, each one with its own queue of work:
+ * directories to read, and batches of files of large directories. A thread
+ * takes from the back of its own queue and, when it is empty, steals from
+ * the front of the others, so that deep or flat trees alike keep all the
+ * cores busy. Hidden files and directories, files matched by the
+ * .gitignore files met on the way, and binary files (a NUL byte in the
+ * first GREP_BINARY_CHECK bytes) are skipped. Files are mapped in memory,
+ * or read when small, and scanned with a vectorized substring search.
+ *
+ * Matches are handed over in batches as they are found, the caller polling
+ * for them while the search goes on. */
+
+#ifndef KILO_GREP_H
+#define KILO_GREP_H
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define GREP_BINARY_CHECK 8192      /* Bytes checked for a NUL byte. */
+#define GREP_MMAP_MIN (256<<10)     /* Smaller files are read instead. */
+#define GREP_BATCH 64               /* Files searched as a unit of work. */
+#define GREP_LINE_MAX 256           /* Bytes kept of a matching line. */
+
+struct grepMatch {
+    std::string path;       /* File, under the directory searched. */
+    int64_t line;           /* Line number, zero-based. */
+    int col;                /* Byte offset of the match in the line. */
+    std::string text;       /* The line, clipped to GREP_LINE_MAX bytes. */
+};
+
+struct grepIgnore;
+
+/* A directory to read, or some of its files to search. */
+struct grepWork {
+    std::string path;       /* Directory, as passed to opendir(). */
+    std::string rel;        /* The same, relative to the root, "" or
+                               ending with a slash. */
+    std::shared_ptr<const grepIgnore> ignore;   /* Rules in effect. */
+    std::vector<std::string> files;     /* Names, empty to read 'path'. */
+};
+
+struct grepQueue {
+    std::mutex lock;
+    std::deque<grepWork> work;
+};
+
+struct grepSearch {
+    std::string query;
+    std::vector<std::unique_ptr<grepQueue>> queues;  /* One per thread. */
+    std::vector<std::thread> workers;
+    std::atomic<int> pending{0};    /* Work queued or being done. */
+    std::atomic<int> running{0};    /* Threads not done yet. */
+    std::atomic<bool> stop{false};
+    std::atomic<int64_t> files{0};  /* Files searched so far. */
+    std::atomic<int64_t> bytes{0};  /* Bytes searched so far. */
+
+    std::mutex lock;                /* Guards the fields below. */
+    std::vector<grepMatch> matches; /* Found, not taken yet. */
+
+    ~grepSearch();
+};
+
+const char *grepFind(const char *s, size_t len, const char *needle,
+                     size_t nlen);
+void grepStart(grepSearch &gs, const char *root, const char *query,
+               int threads);
+int grepPoll(grepSearch &gs, std::vector<grepMatch> &found);
+void grepStop(grepSearch &gs);
+
+#endif
@@ -0,0 +1,147 @@
+/* Streaming gzip decompression and compression, see gzip.h. */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <vector>
+#include "gzip.h"
+using namespace std;
+
+/* True if the file is gzip compressed: it starts with the gzip magic bytes
+ * or, when it is empty or does not exist yet ('fd' is -1), its name ends
+ * in ".gz". */
+int gzipIsCompressed(const char *filename, int fd) {
+    unsigned char magic[2];
+    if (fd != -1 && pread(fd,magic,2,0) == 2)
+        return magic[0] == 0x1f && magic[1] == 0x8b;
+    size_t len = strlen(filename);
+    return len > 3 && !strcmp(filename+len-3,".gz");
+}
+
+/* Hand a decompressed chunk over to the reader, waiting while the queue is
+ * full. Returns false if the reader gave up. */
+static bool gzipStreamPush(gzipStream *gz, string &chunk) {
+    unique_lock<mutex> guard(gz->lock);
+    gz->cond.wait(guard,[gz] {
+        return gz->chunks.size() < GZIP_QUEUE || gz->stop;
+    });
+    if (gz->stop) return false;
+    gz->chunks.push_back(move(chunk));
+    gz->cond.notify_all();
+    return true;
+}
+
+static void gzipStreamEnd(gzipStream *gz, int done, const char *error) {
+    lock_guard<mutex> guard(gz->lock);
+    gz->done = done;
+    if (error) gz->error = error;
+    gz->cond.notify_all();
+}
+
+/* Background thread: read the file and inflate it, member after member,
+ * in chunks of GZIP_CHUNK bytes. */
+static void gzipStreamInflate(gzipStream *gz) {
+    vector<unsigned char> in(GZIP_CHUNK);
+    string out(GZIP_CHUNK,'\0');
+    size_t used = 0;
+    z_stream zs;
+    memset(&zs,0,sizeof(zs));
+    if (inflateInit2(&zs,15+16) != Z_OK) {
+        gzipStreamEnd(gz,-1,"out of memory");
+        return;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(gz->fd,0,0,POSIX_FADV_SEQUENTIAL);
+#endif
+
+    const char *error = NULL;
+    int ret = Z_STREAM_END;     /* Nothing read is like a member ended. */
+    while (!gz->stop) {
+        if (zs.avail_in == 0) {
+            ssize_t n = read(gz->fd,in.data(),in.size());
+            if (n == -1) {
+                error = strerror(errno);
+                break;
+            }
+            if (n == 0) {
+                if (ret != Z_STREAM_END) error = "truncated file";
+                break;
+            }
+            zs.next_in = in.data();
+            zs.avail_in = n;
+        }
+        if (ret == Z_STREAM_END) inflateReset(&zs);
+
+        zs.next_out = (unsigned char*) &out[used];
+        zs.avail_out = out.size()-used;
+        ret = inflate(&zs,Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END) {
+            error = zs.msg ? zs.msg : "corrupted data";
+            break;
+        }
+        used = out.size()-zs.avail_out;
+        if (used == out.size()) {
+            if (!gzipStreamPush(gz,out)) break;
+            out.assign(GZIP_CHUNK,'\0');
+            used = 0;
+        }
+    }
+    if (used && !error) {
+        out.resize(used);
+        gzipStreamPush(gz,out);
+    }
+    inflateEnd(&zs);
+    gzipStreamEnd(gz,error ? -1 : 1,error);
+}
+
+/* Start decompressing 'fd', read from its current position, in the
+ * background. The file must stay open until gzipStreamStop() is called. */
+void gzipStreamStart(gzipStream &gz, int fd) {
+    gzipStreamStop(gz);
+    gz.fd = fd;
+    gz.chunks.clear();
+    gz.done = 0;
+    gz.error.clear();
+    gz.stop = false;
+    gz.worker = thread(gzipStreamInflate,&gz);
+}
+
+/* Get the next decompressed chunk, waiting for it. Returns 1 with a chunk,
+ * 0 at the end of the file, or -1 on error, see gz.error. */
+int gzipStreamRead(gzipStream &gz, string &chunk) {
+    unique_lock<mutex> guard(gz.lock);
+    gz.cond.wait(guard,[&gz] { return !gz.chunks.empty() || gz.done; });
+    if (gz.chunks.empty()) return gz.done == 1 ? 0 : -1;
+    chunk = move(gz.chunks.front());
+    gz.chunks.pop_front();
+    gz.cond.notify_all();
+    return 1;
+}
+
+void gzipStreamStop(gzipStream &gz) {
+    {
+        lock_guard<mutex> guard(gz.lock);
+        gz.stop = true;
+        gz.cond.notify_all();
+    }
+    if (gz.worker.joinable()) gz.worker.join();
+}
+
+/* Compress 'len' bytes from 'buf' into a gzip file image in 'out'. Returns
+ * 0 on success, -1 on error. */
+int gzipCompress(const char *buf, size_t len, string &out) {
+    z_stream zs;
+    memset(&zs,0,sizeof(zs));
+    if (deflateInit2(&zs,Z_DEFAULT_COMPRESSION,Z_DEFLATED,15+16,8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) return -1;
+    out.resize(deflateBound(&zs,len));
+    zs.next_in = (unsigned char*) buf;
+    zs.avail_in = len;
+    zs.next_out = (unsigned char*) &out[0];
+    zs.avail_out = out.size();
+    int ret = deflate(&zs,Z_FINISH);
+    out.resize(out.size()-zs.avail_out);
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END ? 0 : -1;
+}
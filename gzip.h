@@ -0,0 +1,40 @@
+/* Streaming gzip decompression and compression with zlib.
+ *
+ * Decompression runs in a background thread that reads the file and
+ * inflates it in large chunks, handing them over through a short queue, so
+ * that the caller splits lines while the next chunk is being inflated, and
+ * loading is bounded by inflate throughput. Files made of several gzip
+ * members one after the other (as "cat a.gz b.gz" gives) are read whole. */
+
+#ifndef KILO_GZIP_H
+#define KILO_GZIP_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#define GZIP_CHUNK (1<<20)      /* Decompressed bytes handed at a time. */
+#define GZIP_QUEUE 4            /* Chunks decompressed ahead at most. */
+
+struct gzipStream {
+    int fd = -1;
+    std::mutex lock;                /* Guards the fields below. */
+    std::condition_variable cond;   /* Signaled when they change. */
+    std::deque<std::string> chunks; /* Decompressed, not read yet. */
+    int done = 0;                   /* 1 at the end, -1 on error. */
+    std::string error;              /* What went wrong. */
+    std::atomic<bool> stop{false};
+    std::thread worker;
+};
+
+int gzipIsCompressed(const char *filename, int fd);
+void gzipStreamStart(gzipStream &gz, int fd);
+int gzipStreamRead(gzipStream &gz, std::string &chunk);
+void gzipStreamStop(gzipStream &gz);
+int gzipCompress(const char *buf, size_t len, std::string &out);
+
+#endif
@@ -32,8 +32,6 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#define KILO_VERSION "0.0.1"
-
 #define _BSD_SOURCE
 #define _GNU_SOURCE
 
@@ -44,11 +42,14 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <unistd.h>
 #include <stdarg.h>
 #include <fcntl.h>
+#include <math.h>
 
 #include <iostream>
 #include <exception>
@@ -56,20 +57,17 @@
 #include <chrono>
 #include <fstream>
 #include <algorithm>
+#include <thread>
+#include <unordered_map>
 #include <SDL.h>
 #include <SDL_ttf.h>
+#include "diff.h"
+#include "editor.h"
+#include "profile.h"
+#include "utf8.h"
 using namespace std;
 using namespace std::chrono;
 
-class Exception : public exception {
-	string msg;
-public:
-	Exception(string amsg) : msg(amsg) {}
-	const char* what() const noexcept {
-		return msg.c_str();
-	}
-};
-
 // SDL Colors
 const SDL_Color CYAN    = {0x00, 0xFF, 0xFF};
 const SDL_Color YELLOW  = {0xFF, 0xFF, 0x00};
@@ -80,6 +78,22 @@ const SDL_Color BLUE    = {0x00, 0x00, 0xFF};
 const SDL_Color WHITE   = {0xFF, 0xFF, 0xFF};
 const SDL_Color BLACK   = {0x00, 0x00, 0x00};
 
+/* The font, embedded in the binary by cmake/Embed.cmake. */
+extern const unsigned char kiloFont[];
+extern const unsigned int kiloFont_len;
+#define KILO_FONT_SIZE 16
+
+/* Pixels left of the text, where the rows changed since the file was saved
+ * are marked, see App::draw_gutter(). */
+#define KILO_GUTTER_WIDTH 4
+
+/* A row on screen drawn in a texture of its own, see App::draw_row(). */
+struct rowTexture {
+	uint64_t key;       /* What is drawn in it, see rowKey(). */
+	uint64_t used;      /* Frame it was last shown in. */
+	SDL_Texture *tex;
+};
+
 // Main application class
 class App {
 	const int DEFAULT_WINDOW_WIDTH = 640;
@@ -90,23 +104,80 @@ class App {
 	bool running = true;
     int &argc;
     char **&argv;
-	TTF_Font *font;
+	TTF_Font *font = NULL;
 	int font_width, font_height;
+	SDL_Surface *atlas_surface = NULL;  /* Built by load_font(). */
+	SDL_Texture *atlas = NULL;  /* Printable ASCII glyphs, see draw_text(). */
+	string font_error;          /* Why load_font() failed. */
+	char *filename = NULL;
+	vector<char*> more_files;   /* Opened in background buffers. */
+	bool headless = false;      /* Dummy video driver, hidden window. */
+	bool follow = false;        /* Start in follow mode. */
+	bool view = false;          /* Open in a read only view. */
+	bool nocache = false;       /* Don't use the line index cache. */
+	char *replay_path = NULL;   /* Event script to replay instead of run(). */
+	char *record_path = NULL;   /* Record incoming events to this script. */
+	char *report_path = NULL;   /* Benchmark report, stdout if NULL. */
+	const char *trace_path = "kilo-trace.json"; /* Profiler trace output. */
+	double budget_p99 = 0;      /* Fail the replay if p99 latency exceeds. */
+	double budget_startup = 0;  /* Fail the replay if startup_ms exceeds. */
+	FILE *record_fp = NULL;
+	double open_ms = 0;
+	high_resolution_clock::time_point started =
+		high_resolution_clock::now();
+	double startup_ms = 0;      /* From started to the first frame shown. */
+	bool minimap = false;       /* Show the minimap, see draw_minimap(). */
+	bool minimap_drag = false;  /* Left button pressed on the minimap. */
+	SDL_Texture *minimap_tex = NULL;
+	int minimap_h = 0;          /* Pixel rows of minimap_tex. */
+	vector<int> minimap_tiles;  /* Tiles changed since the last frame. */
+	vector<Uint32> minimap_argb;    /* A tile, as uploaded to minimap_tex. */
+	float scroll_y = 0;         /* Pixels scrolled past E.rowoff. */
+	float scroll_v = 0;         /* Kinetic scrolling speed, pixels/s. */
+	vector<rowTexture> rows;    /* Rows drawn lately, see draw_row(). */
+	unordered_map<uint64_t, size_t> rows_index;    /* Key to rows[]. */
+	int rows_w = 0;             /* Width of the textures in rows[]. */
+	uint64_t frame = 0;         /* Frames drawn. */
+	bool rows_off = false;      /* No render targets: draw rows directly. */
+	vector<editorCursor> cursors_shown; /* Other cursors on screen. */
+	vector<SDL_Rect> cursors_rects;
 public:
 	App(int &_argc, char **&_argv);
 	~App();
+	void parse_args();
 	void init_sdl();
+	void load_font();
 	void init();
+	void first_frame();
 	void run();
+	bool replaying();
+	int replay();
+	void record_event(int repeat);
+	void toggle_profiler_overlay();
+	void toggle_profiler_trace();
+	void draw_profiler_overlay();
+	int text_cols(int ww);
+	void toggle_minimap();
+	void draw_minimap();
+	bool minimap_jump(int x, int y);
+	void draw_gutter(int y, int mark);
+	void draw_row(erow *r, int firstcol, int y);
+	void flush_rows();
+	void clip(const SDL_Rect *r) { SDL_RenderSetClipRect(renderer, r); }
+	void scroll_wheel(float steps);
+	void scroll_stop();
+	bool scrolling() { return scroll_v != 0; }
+	int scroll_pixels() { return (int) scroll_y; }
 	void finish();
 	void update(float dt);
 	void draw();
+	bool draw_glyphs(int x, int y, const string &s, SDL_Color c);
 	void draw_text(int x, int y, string s, SDL_Color c = WHITE);
 	void draw_text(int x, int y, char ch, SDL_Color c = WHITE) {
         string s(1, ch);
         draw_text(x, y, s, c);
     }
-	void on_event();
+	void on_event(int repeat = 1);
     void getWindowSize(int &ww, int &wh);
     void getFontSize(int &fw, int &fh);
 };
@@ -120,8 +191,174 @@ void App::getFontSize(int &fw, int &fh) {
     fh = font_height;
 }
 
+/* ============================== Glyph atlas =============================== */
+
+/* The printable ASCII chars are rendered once, white on transparent, in a
+ * single texture, the atlas: text is drawn copying them from there, tinted
+ * with the texture color, instead of rendering a new texture for every
+ * string. Other chars are still rendered by SDL_ttf. The atlas is built by
+ * load_font() while the window is created, and cached on disk, so that
+ * later starts skip rasterizing the glyphs. */
+
+#define ATLAS_FIRST ' '
+#define ATLAS_LAST '~'
+#define ATLAS_COLS 16           /* Glyphs per row of the atlas. */
+#define ATLAS_ROWS ((ATLAS_LAST-ATLAS_FIRST+1+ATLAS_COLS-1)/ATLAS_COLS)
+#define ATLAS_MAGIC "KILOATL1"
+
+struct atlasHeader {
+    char magic[8];
+    uint64_t key;               /* Font and size it was rendered from. */
+    int32_t w, h;               /* Size of a glyph. */
+};
+
+/* Cache file of the atlas, and what it depends on in 'key'. */
+static string atlasCachePath(uint64_t *key) {
+    *key = diffHash((const char *) kiloFont, kiloFont_len) ^
+        (KILO_FONT_SIZE * 0x9e3779b97f4a7c15ULL) ^
+        (SDL_TTF_MAJOR_VERSION << 16 | SDL_TTF_MINOR_VERSION << 8 |
+         SDL_TTF_PATCHLEVEL);
+    const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    string dir;
+    if (xdg && *xdg) {
+        dir = xdg;
+    } else if (home && *home) {
+        dir = string(home) + "/.cache";
+        mkdir(dir.c_str(), 0755);
+    } else {
+        return "";
+    }
+    dir += "/kilo";
+    mkdir(dir.c_str(), 0755);
+    return dir + "/atlas.bin";
+}
+
+static SDL_Surface *atlasCreate(int fw, int fh) {
+    return SDL_CreateRGBSurfaceWithFormat(0, ATLAS_COLS * fw, ATLAS_ROWS * fh,
+        32, SDL_PIXELFORMAT_ARGB8888);
+}
+
+/* Load the cached atlas of glyphs 'fw' x 'fh' pixels, or return NULL. */
+static SDL_Surface *atlasLoad(const string &path, uint64_t key, int fw,
+                              int fh)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (fp == NULL) return NULL;
+    atlasHeader h;
+    SDL_Surface *atlas = NULL;
+    if (fread(&h, sizeof(h), 1, fp) == 1 &&
+        !memcmp(h.magic, ATLAS_MAGIC, sizeof(h.magic)) && h.key == key &&
+        h.w == fw && h.h == fh && (atlas = atlasCreate(fw, fh)) != NULL)
+    {
+        for (int y = 0; y < atlas->h; y++) {
+            char *row = (char *) atlas->pixels + y * atlas->pitch;
+            if (fread(row, 4, atlas->w, fp) != (size_t) atlas->w) {
+                SDL_FreeSurface(atlas);
+                atlas = NULL;
+                break;
+            }
+        }
+    }
+    fclose(fp);
+    return atlas;
+}
+
+/* Write the atlas to the cache, replacing it at once. */
+static void atlasSave(const string &path, uint64_t key, SDL_Surface *atlas,
+                      int fw, int fh)
+{
+    string tmp = path + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (fp == NULL) return;
+    atlasHeader h;
+    memcpy(h.magic, ATLAS_MAGIC, sizeof(h.magic));
+    h.key = key;
+    h.w = fw;
+    h.h = fh;
+    bool ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+    for (int y = 0; ok && y < atlas->h; y++) {
+        char *row = (char *) atlas->pixels + y * atlas->pitch;
+        ok = fwrite(row, 4, atlas->w, fp) == (size_t) atlas->w;
+    }
+    if (fclose(fp) == 0 && ok)
+        rename(tmp.c_str(), path.c_str());
+    else
+        unlink(tmp.c_str());
+}
+
+/* Render the glyphs of 'font' in a new atlas, each one in a cell of 'fw' x
+ * 'fh' pixels. */
+static SDL_Surface *atlasRender(TTF_Font *font, int fw, int fh) {
+    SDL_Surface *atlas = atlasCreate(fw, fh);
+    if (atlas == NULL) {
+        throw Exception(SDL_GetError());
+    }
+    for (int c = ATLAS_FIRST; c <= ATLAS_LAST; c++) {
+        SDL_Surface *glyph = TTF_RenderGlyph_Blended(font, c, WHITE);
+        if (glyph == NULL) continue;    /* Left blank. */
+        /* Copied as it is, not blended over the transparent atlas. */
+        SDL_SetSurfaceBlendMode(glyph, SDL_BLENDMODE_NONE);
+        int j = c - ATLAS_FIRST;
+        SDL_Rect src = {0, 0, min(glyph->w, fw), min(glyph->h, fh)};
+        SDL_Rect dst = {j % ATLAS_COLS * fw, j / ATLAS_COLS * fh, 0, 0};
+        SDL_BlitSurface(glyph, &src, atlas, &dst);
+        SDL_FreeSurface(glyph);
+    }
+    return atlas;
+}
+
+/* Open the embedded font and get the atlas, from the cache or rendering
+ * it. Runs in a thread of its own while init_sdl() creates the window, so
+ * errors are left in font_error. */
+void App::load_font() {
+	profileMuted = true;
+	try {
+		if (TTF_Init() < 0) {
+			throw Exception(TTF_GetError());
+		}
+		font = TTF_OpenFontRW(SDL_RWFromConstMem(kiloFont, kiloFont_len),
+			1, KILO_FONT_SIZE);
+		if (font == NULL) {
+			throw Exception(TTF_GetError());
+		}
+		if (TTF_SizeUTF8(font, "W", &font_width, &font_height) < 0) {
+			throw Exception(TTF_GetError());
+		}
+		uint64_t key;
+		string cache = atlasCachePath(&key);
+		if (!cache.empty())
+			atlas_surface = atlasLoad(cache, key, font_width, font_height);
+		if (atlas_surface == NULL) {
+			atlas_surface = atlasRender(font, font_width, font_height);
+			if (!cache.empty())
+				atlasSave(cache, key, atlas_surface, font_width, font_height);
+		}
+	} catch (const exception &e) {
+		font_error = e.what();
+	}
+}
+
+/* Draw 's' from the atlas, if it has all its chars. Returns false if not,
+ * drawing nothing. */
+bool App::draw_glyphs(int x, int y, const string &s, SDL_Color c) {
+    for (char ch : s) {
+        if (ch < ATLAS_FIRST || ch > ATLAS_LAST) return false;
+    }
+    SDL_SetTextureColorMod(atlas, c.r, c.g, c.b);
+    for (size_t k = 0; k < s.size(); k++) {
+        int j = s[k] - ATLAS_FIRST;
+        SDL_Rect src = {j % ATLAS_COLS * font_width,
+            j / ATLAS_COLS * font_height, font_width, font_height};
+        SDL_Rect dst = {x + (int) k * font_width, y, font_width, font_height};
+        SDL_RenderCopy(renderer, atlas, &src, &dst);
+    }
+    return true;
+}
+
 void App::draw_text(int x, int y, string s, SDL_Color c) {
+    PROFILE_ZONE("App::draw_text");
     if (s.length() == 0) return;
+    if (atlas && draw_glyphs(x, y, s, c)) return;
     SDL_Surface *surface;
     //surface = TTF_RenderUTF8_Shaded(font, lines[0].c_str(), WHITE, {255, 0, 0});
     surface = TTF_RenderUTF8_Blended(font, s.c_str(), c);
@@ -133,279 +370,12 @@ void App::draw_text(int x, int y, string s, SDL_Color c) {
     if (texture == NULL) {
         throw Exception(TTF_GetError());
     }
-    SDL_Rect dst = {x, y, s.length() * font_width, font_height};
+    SDL_Rect dst = {x, y, surface->w, surface->h};
     SDL_RenderCopy(renderer, texture, NULL, &dst);
     SDL_FreeSurface(surface);
     SDL_DestroyTexture(texture);
 }
 
-class KiloEditor {
-    const int HL_NORMAL = 0;
-};
-
-#define TAB_SIZE 4
-#define TAB '\t'
-
-/* Syntax highlight types */
-#define HL_NORMAL 0
-#define HL_NONPRINT 1
-#define HL_COMMENT 2   /* Single line comment. */
-#define HL_MLCOMMENT 3 /* Multi-line comment. */
-#define HL_KEYWORD1 4
-#define HL_KEYWORD2 5
-#define HL_STRING 6
-#define HL_NUMBER 7
-#define HL_MATCH 8      /* Search match. */
-
-#define HL_HIGHLIGHT_STRINGS (1<<0)
-#define HL_HIGHLIGHT_NUMBERS (1<<1)
-
-struct editorSyntax {
-    char **filematch;
-    char **keywords;
-    char singleline_comment_start[3];
-    char multiline_comment_start[3];
-    char multiline_comment_end[3];
-    int flags;
-};
-
-/* This structure represents a single line of the file we are editing. */
-typedef struct erow {
-    int idx;            /* Row index in the file, zero-based. */
-    int size;           /* Size of the row, excluding the null term. */
-    int rsize;          /* Size of the rendered row. */
-    char *chars;        /* Row content. */
-    char *render;       /* Row content "rendered" for screen (for TABs). */
-    unsigned char *hl;  /* Syntax highlight type for each character in render.*/
-    int hl_oc;          /* Row had open comment at end in last syntax highlight
-                           check. */
-} erow;
-
-typedef struct hlcolor {
-    int r,g,b;
-} hlcolor;
-
-struct editorConfig {
-    int cx,cy;  /* Cursor x and y position in characters */
-    int rowoff;     /* Offset of row displayed. */
-    int coloff;     /* Offset of column displayed. */
-    int screenrows; /* Number of rows that we can show */
-    int screencols; /* Number of cols that we can show */
-    int numrows;    /* Number of rows */
-    int rawmode;    /* Is terminal raw mode enabled? */
-    erow *row;      /* Rows */
-    int dirty;      /* File modified but not saved. */
-    char *filename; /* Currently open filename */
-    char statusmsg[80];
-    time_t statusmsg_time;
-    struct editorSyntax *syntax;    /* Current syntax highlight, or NULL. */
-};
-
-static struct editorConfig E;
-
-void editorSetStatusMessage(const char *fmt, ...);
-
-/* =========================== Syntax highlights DB =========================
- *
- * In order to add a new syntax, define two arrays with a list of file name
- * matches and keywords. The file name matches are used in order to match
- * a given syntax with a given file name: if a match pattern starts with a
- * dot, it is matched as the last past of the filename, for example ".c".
- * Otherwise the pattern is just searched inside the filenme, like "Makefile").
- *
- * The list of keywords to highlight is just a list of words, however if they
- * a trailing '|' character is added at the end, they are highlighted in
- * a different color, so that you can have two different sets of keywords.
- *
- * Finally add a stanza in the HLDB global variable with two two arrays
- * of strings, and a set of flags in order to enable highlighting of
- * comments and numbers.
- *
- * The characters for single and multi line comments must be exactly two
- * and must be provided as well (see the C language example).
- *
- * There is no support to highlight patterns currently. */
-
-/* C / C++ */
-char *C_HL_extensions[] = {".c",".cpp",NULL};
-char *C_HL_keywords[] = {
-        /* A few C / C++ keywords */
-        "switch","if","while","for","break","continue","return","else",
-        "struct","union","typedef","static","enum","class",
-        /* C types */
-        "int|","long|","double|","float|","char|","unsigned|","signed|",
-        "void|",NULL
-};
-
-/* Here we define an array of syntax highlights by extensions, keywords,
- * comments delimiters and flags. */
-editorSyntax HLDB[] = {
-    {
-        /* C / C++ */
-        C_HL_extensions,
-        C_HL_keywords,
-        "//","/*","*/",
-        HL_HIGHLIGHT_STRINGS | HL_HIGHLIGHT_NUMBERS
-    }
-};
-
-#define HLDB_ENTRIES (sizeof(HLDB)/sizeof(HLDB[0]))
-
-/* ====================== Syntax highlight color scheme  ==================== */
-
-int is_separator(int c) {
-    return c == '\0' || isspace(c) || strchr(",.()+-/*=~%[];",c) != NULL;
-}
-
-/* Return true if the specified row last char is part of a multi line comment
- * that starts at this row or at one before, and does not end at the end
- * of the row but spawns to the next row. */
-int editorRowHasOpenComment(erow *row) {
-    if (row->hl && row->rsize && row->hl[row->rsize-1] == HL_MLCOMMENT &&
-        (row->rsize < 2 || (row->render[row->rsize-2] != '*' ||
-                            row->render[row->rsize-1] != '/'))) return 1;
-    return 0;
-}
-
-/* Set every byte of row->hl (that corresponds to every character in the line)
- * to the right syntax highlight type (HL_* defines). */
-void editorUpdateSyntax(erow *row) {
-    row->hl = (unsigned char*) realloc(row->hl,row->rsize);
-    memset(row->hl,HL_NORMAL,row->rsize);
-
-    if (E.syntax == NULL) return; /* No syntax, everything is HL_NORMAL. */
-
-    int i, prev_sep, in_string, in_comment;
-    char *p;
-    char **keywords = E.syntax->keywords;
-    char *scs = E.syntax->singleline_comment_start;
-    char *mcs = E.syntax->multiline_comment_start;
-    char *mce = E.syntax->multiline_comment_end;
-
-    /* Point to the first non-space char. */
-    p = row->render;
-    i = 0; /* Current char offset */
-    while(*p && isspace(*p)) {
-        p++;
-        i++;
-    }
-    prev_sep = 1; /* Tell the parser if 'i' points to start of word. */
-    in_string = 0; /* Are we inside "" or '' ? */
-    in_comment = 0; /* Are we inside multi-line comment? */
-
-    /* If the previous line has an open comment, this line starts
-     * with an open comment state. */
-    if (row->idx > 0 && editorRowHasOpenComment(&E.row[row->idx-1]))
-        in_comment = 1;
-
-    while(*p) {
-        /* Handle // comments. */
-        if (prev_sep && *p == scs[0] && *(p+1) == scs[1]) {
-            /* From here to end is a comment */
-            memset(row->hl+i,HL_COMMENT,row->size-i);
-            return;
-        }
-
-        /* Handle multi line comments. */
-        if (in_comment) {
-            row->hl[i] = HL_MLCOMMENT;
-            if (*p == mce[0] && *(p+1) == mce[1]) {
-                row->hl[i+1] = HL_MLCOMMENT;
-                p += 2; i += 2;
-                in_comment = 0;
-                prev_sep = 1;
-                continue;
-            } else {
-                prev_sep = 0;
-                p++; i++;
-                continue;
-            }
-        } else if (*p == mcs[0] && *(p+1) == mcs[1]) {
-            row->hl[i] = HL_MLCOMMENT;
-            row->hl[i+1] = HL_MLCOMMENT;
-            p += 2; i += 2;
-            in_comment = 1;
-            prev_sep = 0;
-            continue;
-        }
-
-        /* Handle "" and '' */
-        if (in_string) {
-            row->hl[i] = HL_STRING;
-            if (*p == '\\') {
-                row->hl[i+1] = HL_STRING;
-                p += 2; i += 2;
-                prev_sep = 0;
-                continue;
-            }
-            if (*p == in_string) in_string = 0;
-            p++; i++;
-            continue;
-        } else {
-            if (*p == '"' || *p == '\'') {
-                in_string = *p;
-                row->hl[i] = HL_STRING;
-                p++; i++;
-                prev_sep = 0;
-                continue;
-            }
-        }
-
-        /* Handle non printable chars. */
-        if (!isprint(*p)) {
-            row->hl[i] = HL_NONPRINT;
-            p++; i++;
-            prev_sep = 0;
-            continue;
-        }
-
-        /* Handle numbers */
-        if ((isdigit(*p) && (prev_sep || row->hl[i-1] == HL_NUMBER)) ||
-            (*p == '.' && i >0 && row->hl[i-1] == HL_NUMBER)) {
-            row->hl[i] = HL_NUMBER;
-            p++; i++;
-            prev_sep = 0;
-            continue;
-        }
-
-        /* Handle keywords and lib calls */
-        if (prev_sep) {
-            int j;
-            for (j = 0; keywords[j]; j++) {
-                int klen = strlen(keywords[j]);
-                int kw2 = keywords[j][klen-1] == '|';
-                if (kw2) klen--;
-
-                if (!memcmp(p,keywords[j],klen) &&
-                    is_separator(*(p+klen)))
-                {
-                    /* Keyword */
-                    memset(row->hl+i,kw2 ? HL_KEYWORD2 : HL_KEYWORD1,klen);
-                    p += klen;
-                    i += klen;
-                    break;
-                }
-            }
-            if (keywords[j] != NULL) {
-                prev_sep = 0;
-                continue; /* We had a keyword match */
-            }
-        }
-
-        /* Not special chars */
-        prev_sep = is_separator(*p);
-        p++; i++;
-    }
-
-    /* Propagate syntax change to the next row if the open commen
-     * state changed. This may recursively affect all the following rows
-     * in the file. */
-    int oc = editorRowHasOpenComment(row);
-    if (row->hl_oc != oc && row->idx+1 < E.numrows)
-        editorUpdateSyntax(&E.row[row->idx+1]);
-    row->hl_oc = oc;
-}
-
 /* Maps syntax highlight token types to SDL colors. */
 SDL_Color editorSyntaxToColor(int hl) {
     switch(hl) {
@@ -420,330 +390,129 @@ SDL_Color editorSyntaxToColor(int hl) {
     }
 }
 
-/* Select the syntax highlight scheme depending on the filename,
- * setting it in the global state E.syntax. */
-void editorSelectSyntaxHighlight(char *filename) {
-    for (unsigned int j = 0; j < HLDB_ENTRIES; j++) {
-        struct editorSyntax *s = HLDB+j;
-        unsigned int i = 0;
-        while(s->filematch[i]) {
-            char *p;
-            int patlen = strlen(s->filematch[i]);
-            if ((p = strstr(filename,s->filematch[i])) != NULL) {
-                if (s->filematch[i][0] != '.' || p[patlen] == '\0') {
-                    E.syntax = s;
-                    return;
-                }
-            }
-            i++;
-        }
-    }
+/* =============================== Prompt mode ============================== */
+
+/* While a prompt is active, the status message line shows it and all the
+ * keyboard input goes to it. The callback is called with key 0 after every
+ * change of the input, with the key for the arrows, and with SDLK_RETURN or
+ * SDLK_ESCAPE when the prompt ends. */
+typedef void (*editorPromptCallback)(const char *input, SDL_Keycode key);
+
+static struct {
+    bool active;
+    const char *fmt;    /* Status message, with a %s for the input. */
+    string input;
+    editorPromptCallback callback;
+} prompt;
+
+void editorPromptStart(const char *fmt, editorPromptCallback callback) {
+    prompt.active = true;
+    prompt.fmt = fmt;
+    prompt.input.clear();
+    prompt.callback = callback;
+    editorSetStatusMessage(fmt, "");
 }
 
-/* ======================= Editor rows implementation ======================= */
-
-/* Update the rendered version and the syntax highlight of a row. */
-void editorUpdateRow(erow *row) {
-    int tabs = 0, nonprint = 0, j, idx;
-
-   /* Create a version of the row we can directly print on the screen,
-     * respecting tabs, substituting non printable characters with '?'. */
-    free(row->render);
-    for (j = 0; j < row->size; j++)
-        if (row->chars[j] == TAB) tabs++;
-
-    row->render = (char*) malloc(row->size + tabs*TAB_SIZE + nonprint*9 + 1);
-    idx = 0;
-    for (j = 0; j < row->size; j++) {
-        if (row->chars[j] == TAB) {
-            row->render[idx++] = ' ';
-            while((idx+1) % TAB_SIZE != 0) row->render[idx++] = ' ';
-        } else {
-            row->render[idx++] = row->chars[j];
+/* Handle a key press or text input event while the prompt is active. Arrows
+ * coalesced into a single event are passed 'repeat' times. */
+void editorPromptEvent(SDL_Event &event, int repeat) {
+    if (event.type == SDL_TEXTINPUT) {
+        prompt.input += event.text.text;
+    } else if (event.type == SDL_KEYDOWN) {
+        SDL_Keycode key = event.key.keysym.sym;
+        switch (key) {
+        case SDLK_ESCAPE:
+        case SDLK_RETURN:
+            prompt.active = false;
+            editorSetStatusMessage("");
+            prompt.callback(prompt.input.c_str(), key);
+            return;
+        case SDLK_BACKSPACE:
+            if (prompt.input.empty()) return;
+            prompt.input.resize(utf8Prev(prompt.input.data(),
+                                         prompt.input.size()));
+            break;
+        case SDLK_UP: case SDLK_DOWN: case SDLK_LEFT: case SDLK_RIGHT:
+            while (repeat--) prompt.callback(prompt.input.c_str(), key);
+            return;
+        default:
+            return;
         }
-    }
-    row->rsize = idx;
-    row->render[idx] = '\0';
-
-    /* Update the syntax highlighting attributes of the row. */
-    editorUpdateSyntax(row);
-}
-
-/* Insert a row at the specified position, shifting the other rows on the bottom
- * if required. */
-void editorInsertRow(int at, char *s, size_t len) {
-    if (at > E.numrows) return;
-    E.row = (erow*) realloc(E.row,sizeof(erow)*(E.numrows+1));
-    if (at != E.numrows) {
-        memmove(E.row+at+1,E.row+at,sizeof(E.row[0])*(E.numrows-at));
-        for (int j = at+1; j <= E.numrows; j++) E.row[j].idx++;
-    }
-    E.row[at].size = len;
-    E.row[at].chars = (char*) malloc(len+1);
-    memcpy(E.row[at].chars,s,len+1);
-    E.row[at].hl = NULL;
-    E.row[at].hl_oc = 0;
-    E.row[at].render = NULL;
-    E.row[at].rsize = 0;
-    E.row[at].idx = at;
-    editorUpdateRow(E.row+at);
-    E.numrows++;
-    E.dirty++;
-}
-
-/* Free row's heap allocated stuff. */
-void editorFreeRow(erow *row) {
-    free(row->render);
-    free(row->chars);
-    free(row->hl);
-}
-
-/* Remove the row at the specified position, shifting the remainign on the
- * top. */
-void editorDelRow(int at) {
-    erow *row;
-
-    if (at >= E.numrows) return;
-    row = E.row+at;
-    editorFreeRow(row);
-    memmove(E.row+at,E.row+at+1,sizeof(E.row[0])*(E.numrows-at-1));
-    for (int j = at; j < E.numrows-1; j++) E.row[j].idx++;
-    E.numrows--;
-    E.dirty++;
-}
-
-/* Turn the editor rows into a single heap-allocated string.
- * Returns the pointer to the heap-allocated string and populate the
- * integer pointed by 'buflen' with the size of the string, escluding
- * the final nulterm. */
-char *editorRowsToString(int *buflen) {
-    char *buf = NULL, *p;
-    int totlen = 0;
-    int j;
-
-    /* Compute count of bytes */
-    for (j = 0; j < E.numrows; j++)
-        totlen += E.row[j].size+1; /* +1 is for "\n" at end of every row */
-    *buflen = totlen;
-    totlen++; /* Also make space for nulterm */
-
-    p = buf = (char*) malloc(totlen);
-    for (j = 0; j < E.numrows; j++) {
-        memcpy(p,E.row[j].chars,E.row[j].size);
-        p += E.row[j].size;
-        *p = '\n';
-        p++;
-    }
-    *p = '\0';
-    return buf;
-}
-
-/* Insert a character at the specified position in a row, moving the remaining
- * chars on the right if needed. */
-void editorRowInsertChar(erow *row, int at, int c) {
-    if (at > row->size) {
-        /* Pad the string with spaces if the insert location is outside the
-         * current length by more than a single character. */
-        int padlen = at-row->size;
-        /* In the next line +2 means: new char and null term. */
-        row->chars = (char*) realloc(row->chars,row->size+padlen+2);
-        memset(row->chars+row->size,' ',padlen);
-        row->chars[row->size+padlen+1] = '\0';
-        row->size += padlen+1;
     } else {
-        /* If we are in the middle of the string just make space for 1 new
-         * char plus the (already existing) null term. */
-        row->chars = (char*) realloc(row->chars,row->size+2);
-        memmove(row->chars+at+1,row->chars+at,row->size-at+1);
-        row->size++;
-    }
-    row->chars[at] = c;
-    editorUpdateRow(row);
-    E.dirty++;
-}
-
-/* Append the string 's' at the end of a row */
-void editorRowAppendString(erow *row, char *s, size_t len) {
-    row->chars = (char*) realloc(row->chars,row->size+len+1);
-    memcpy(row->chars+row->size,s,len);
-    row->size += len;
-    row->chars[row->size] = '\0';
-    editorUpdateRow(row);
-    E.dirty++;
-}
-
-/* Delete the character at offset 'at' from the specified row. */
-void editorRowDelChar(erow *row, int at) {
-    if (row->size <= at) return;
-    memmove(row->chars+at,row->chars+at+1,row->size-at);
-    editorUpdateRow(row);
-    row->size--;
-    E.dirty++;
-}
-
-/* Insert the specified char at the current prompt position. */
-void editorInsertChar(int c) {
-    int filerow = E.rowoff+E.cy;
-    int filecol = E.coloff+E.cx;
-    erow *row = (filerow >= E.numrows) ? NULL : &E.row[filerow];
-
-    /* If the row where the cursor is currently located does not exist in our
-     * logical representaion of the file, add enough empty rows as needed. */
-    if (!row) {
-        while(E.numrows <= filerow)
-            editorInsertRow(E.numrows,"",0);
-    }
-    row = &E.row[filerow];
-    editorRowInsertChar(row,filecol,c);
-    if (E.cx == E.screencols-1)
-        E.coloff++;
-    else
-        E.cx++;
-    E.dirty++;
-}
-
-/* Inserting a newline is slightly complex as we have to handle inserting a
- * newline in the middle of a line, splitting the line as needed. */
-void editorInsertNewline(void) {
-    int filerow = E.rowoff+E.cy;
-    int filecol = E.coloff+E.cx;
-    erow *row = (filerow >= E.numrows) ? NULL : &E.row[filerow];
-
-    if (!row) {
-        if (filerow == E.numrows) {
-            editorInsertRow(filerow,"",0);
-            goto fixcursor;
-        }
         return;
     }
-    /* If the cursor is over the current line size, we want to conceptually
-     * think it's just over the last character. */
-    if (filecol >= row->size) filecol = row->size;
-    if (filecol == 0) {
-        editorInsertRow(filerow,"",0);
-    } else {
-        /* We are in the middle of a line. Split it between two rows. */
-        editorInsertRow(filerow+1,row->chars+filecol,row->size-filecol);
-        row = &E.row[filerow];
-        row->chars[filecol] = '\0';
-        row->size = filecol;
-        editorUpdateRow(row);
-    }
-fixcursor:
-    if (E.cy == E.screenrows-1) {
-        E.rowoff++;
-    } else {
-        E.cy++;
-    }
-    E.cx = 0;
-    E.coloff = 0;
-}
-
-/* Delete the char at the current prompt position. */
-void editorDelChar() {
-    int filerow = E.rowoff+E.cy;
-    int filecol = E.coloff+E.cx;
-    erow *row = (filerow >= E.numrows) ? NULL : &E.row[filerow];
-
-    if (!row || (filecol == 0 && filerow == 0)) return;
-    if (filecol == 0) {
-        /* Handle the case of column 0, we need to move the current line
-         * on the right of the previous one. */
-        filecol = E.row[filerow-1].size;
-        editorRowAppendString(&E.row[filerow-1],row->chars,row->size);
-        editorDelRow(filerow);
-        row = NULL;
-        if (E.cy == 0)
-            E.rowoff--;
-        else
-            E.cy--;
-        E.cx = filecol;
-        if (E.cx >= E.screencols) {
-            int shift = (E.screencols-E.cx)+1;
-            E.cx -= shift;
-            E.coloff += shift;
-        }
-    } else {
-        editorRowDelChar(row,filecol-1);
-        if (E.cx == 0 && E.coloff)
-            E.coloff--;
-        else
-            E.cx--;
-    }
-    if (row) editorUpdateRow(row);
-    E.dirty++;
+    editorSetStatusMessage(prompt.fmt, prompt.input.c_str());
+    prompt.callback(prompt.input.c_str(), 0);
 }
 
-/* Load the specified program in the editor memory and returns 0 on success
- * or 1 on error. */
-int editorOpen(char *filename) {
-    FILE *fp;
+/* ============================= Terminal update ============================ */
 
-    E.dirty = 0;
-    free(E.filename);
-    E.filename = strdup(filename);
+/* Draw the columns of row 'r' from 'firstcol' on, at pixel 'x','y'. The
+ * visible columns of the rendered row are walked using the row index of wide
+ * chars to know the size of every char. A wide char only partially visible
+ * on the left is not drawn, nor on the right unless the row is wrapped, and
+ * zero width chars are drawn together with the char they follow. */
+static void editorDrawRow(App &app, erow *r, int firstcol, int x, int y) {
+    int fw, fh;
+    app.getFontSize(fw, fh);
 
-    fp = fopen(filename,"r");
-    if (!fp) {
-        if (errno != ENOENT) {
-            throw Exception("Opening file");
+    int roff = editorRowColToRoff(r, firstcol);
+    int col = editorRowRoffToCol(r, roff);
+    int k = editorRowWideFrom(r, roff);
+    int endcol = firstcol + E.screencols;
+    int nwide = r->rend ? r->rend->nwide : 0;
+    ewide *wide = r->rend ? r->rend->wide : NULL;
+    char *render = editorRowRender(r);
+    unsigned char *rowhl = editorRowHl(r);
+    SDL_Color color = WHITE;
+    while (roff < r->rsize && col < endcol) {
+        int width = 1, rlen = 1;
+        if (k < nwide && wide[k].roff == roff) {
+            width = wide[k].width;
+            rlen = wide[k].rlen;
+            k++;
         }
-        return 1;
-    }
-
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
-    while((linelen = getline(&line,&linecap,fp)) != -1) {
-        if (linelen && (line[linelen-1] == '\n' || line[linelen-1] == '\r'))
-            line[--linelen] = '\0';
-        editorInsertRow(E.numrows,line,linelen);
+        while (k < nwide && wide[k].roff == roff+rlen && wide[k].width == 0)
+            rlen += wide[k++].rlen;
+        unsigned char hl = rowhl ? rowhl[roff] : HL_NORMAL;
+        int cx = x+(col-firstcol)*fw, cy = y;
+        if (col < firstcol || (col+width > endcol && !E.wrap) ||
+            render[roff] == ' ')
+        {
+            /* Nothing to draw. */
+        } else if (hl == HL_NONPRINT) {
+            app.draw_text(cx, cy, "?", color);
+        } else {
+            color = hl == HL_NORMAL ? WHITE : editorSyntaxToColor(hl);
+            app.draw_text(cx, cy, string(render+roff, rlen), color);
+        }
+        roff += rlen;
+        col += width;
     }
-    free(line);
-    fclose(fp);
-    E.dirty = 0;
-    return 0;
 }
 
-/* Save the current file on disk. Return 0 on success, 1 on error. */
-int editorSave(void) {
-    int len;
-    char *buf = editorRowsToString(&len);
-    int fd = open(E.filename,O_RDWR|O_CREAT,0644);
-    if (fd == -1) goto writeerr;
-
-    /* Use truncate + a single write(2) call in order to make saving
-     * a bit safer, under the limits of what we can do in a small editor. */
-    if (ftruncate(fd,len) == -1) goto writeerr;
-    if (write(fd,buf,len) != len) goto writeerr;
-
-    close(fd);
-    free(buf);
-    E.dirty = 0;
-    editorSetStatusMessage("%d bytes written on disk", len);
-    return 0;
-
-writeerr:
-    free(buf);
-    if (fd != -1) close(fd);
-    editorSetStatusMessage("Can't save! I/O error: %s",strerror(errno));
-    return 1;
-}
-
-/* ============================= Terminal update ============================ */
-
 /* This function writes the whole screen using VT100 escape characters
  * starting from the logical state of the editor in the global state 'E'. */
 void editorRefreshScreen(App &app) {
-    char buf[32];
+    PROFILE_ZONE("editorRefreshScreen");
     
     int fw, fh, ww, wh;
     app.getWindowSize(ww, wh);
     app.getFontSize(fw, fh);
 
-    for (int y = 0; y < E.screenrows; y++) {
-        int filerow = E.rowoff+y;
-
+    /* When wrapping, every screen row shows a segment of 'screencols'
+     * columns of a file row, starting from segment 'wrapoff' of the first
+     * row. Otherwise every screen row shows a file row from 'coloff'. While
+     * scrolling by pixels, the rows are drawn that many pixels higher, and
+     * one more row shows at the bottom. */
+    int filerow = E.rowoff;
+    int segment = E.wrap ? E.wrapoff : 0;
+    int scroll = app.scroll_pixels();
+    SDL_Rect text = {0, 0, KILO_GUTTER_WIDTH + E.screencols*fw,
+                     E.screenrows*fh};
+    app.clip(&text);
+    for (int y = 0; y < E.screenrows + (scroll > 0); y++) {
+        int py = y*fh - scroll;
         if (filerow >= E.numrows) {
             if (E.numrows == 0 && y == E.screenrows/3) {
                 char welcome[80];
@@ -762,249 +531,598 @@ void editorRefreshScreen(App &app) {
                     padding--;
                 }
                 t += welcome;
-                app.draw_text(0, y*fh, t);
+                app.draw_text(KILO_GUTTER_WIDTH, py, t);
             } else {
-                app.draw_text(0, y*fh, "~");
+                app.draw_text(KILO_GUTTER_WIDTH, py, "~");
             }
             continue;
         }
 
         erow *r = &E.row[filerow];
-
-        int len = r->rsize - E.coloff;
-        SDL_Color color = WHITE;
-        if (len > 0) {
-            if (len > E.screencols) len = E.screencols;
-            char *c = r->render + E.coloff;
-            unsigned char *hl = r->hl + E.coloff;
-            for (int j = 0; j < len; j++) {
-                int cx = j*fw, cy = y*fh;
-                if (hl[j] == HL_NONPRINT) {
-                    app.draw_text(cx, cy, "?", color);
-                } else if (hl[j] == HL_NORMAL) {
-                    color = WHITE;
-                    app.draw_text(cx, cy, *(c+j), color);
-                } else {
-                    color = editorSyntaxToColor(hl[j]);
-                    app.draw_text(cx, cy, *(c+j), color);
-                }
-            }
+        int mark = editorGutterMark(filerow);
+        if (!E.wrap) {
+            app.draw_gutter(py, mark);
+            app.draw_row(r, E.coloff, py);
+            filerow++;
+            continue;
+        }
+        /* Removed lines are marked above the first segment of the row, or
+         * below the last one. */
+        int last = editorRowWidth(r)/E.screencols;
+        if (segment != 0) mark &= ~GUTTER_REMOVED;
+        if (segment != last) mark &= ~GUTTER_REMOVED_END;
+        app.draw_gutter(py, mark);
+        app.draw_row(r, segment*E.screencols, py);
+        if (++segment > last) {
+            segment = 0;
+            filerow++;
         }
     }
+    app.clip(NULL);
 
     /* Create a two rows status. First row: */
-    char status[80], rstatus[80];
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-        E.filename, E.numrows, E.dirty ? "(modified)" : "");
-    int rlen = snprintf(rstatus, sizeof(rstatus),
-        "%d/%d",E.rowoff+E.cy+1,E.numrows);
-    int y = E.screenrows;
-    for(int j=0; j<min(len, E.screencols); j++) {
-        app.draw_text(fw*j, fh*y, status[j]);
-    }
-    int jj = max(0, E.screencols - rlen);
-    for(int j=0; j<min(rlen, E.screencols); j++, jj++) {
-        app.draw_text(fw*jj, fh*y, rstatus[j]);
+    char status[80], rstatus[80], bufstr[32] = "";
+    int len, rlen;
+    if (editorBufferCount() > 1)
+        snprintf(bufstr, sizeof(bufstr), "[%d/%d] ",
+            editorBufferCurrent()+1, editorBufferCount());
+    if (E.view) {
+        /* Line numbers are known as far as the index got. */
+        int done;
+        long long lines = editorViewLines(&done);
+        long long line = editorViewCursorLine();
+        char linestr[32] = "?";
+        if (line != -1) snprintf(linestr, sizeof(linestr), "%lld", line+1);
+        len = snprintf(status, sizeof(status), "%s%.20s - %lld%s lines [view]",
+            bufstr, E.filename, lines, done ? "" : "+");
+        rlen = snprintf(rstatus, sizeof(rstatus), "%s/%lld%s @%lld",
+            linestr, lines, done ? "" : "+",
+            (long long) editorCursorFileOffset());
+    } else {
+        len = snprintf(status, sizeof(status), "%s%.20s - %d lines %s%s",
+            bufstr, E.filename, E.numrows, E.dirty ? "(modified) " : "",
+            E.follow ? "[follow]" : "");
+        rlen = snprintf(rstatus, sizeof(rstatus),
+            "%d/%d @%lld",E.rowoff+E.cy+1,E.numrows,
+            (long long) editorCursorFileOffset());
     }
+    int y = E.screenrows;
+    len = utf8Clip(status, min(len, (int) sizeof(status)-1), E.screencols);
+    app.draw_text(0, fh*y, string(status, len));
+    rlen = min(rlen, E.screencols);
+    app.draw_text(fw*(E.screencols - rlen), fh*y, string(rstatus, rlen));
 
     /* Second row depends on E.statusmsg and the status message update time. */
     int msglen = strlen(E.statusmsg);
-    if (msglen && time(NULL)-E.statusmsg_time < 5) {
-        for(int j=0; j<min(msglen, E.screencols); j++) {
-            app.draw_text(fw*j, fh*(y + 1), E.statusmsg[j]);
+    if (msglen && (prompt.active || time(NULL)-E.statusmsg_time < 5)) {
+        msglen = utf8Clip(E.statusmsg, msglen, E.screencols);
+        app.draw_text(0, fh*(y + 1), string(E.statusmsg, msglen));
+    }
+}
+
+/* ============================ Smooth scrolling ============================
+ *
+ * The mouse wheel and the trackpad scroll the view by pixels. Every wheel
+ * step adds speed, which decays exponentially with time constant
+ * KILO_SCROLL_TAU. Each step therefore scrolls exactly its distance in
+ * total, and a flick of the trackpad keeps going for a while. When the
+ * motion stops, the view snaps to the closest row. The keyboard stops it
+ * right away.
+ *
+ * Each row on screen is drawn once in a texture of its own. The texture is
+ * kept as long as what the row shows stays the same: the content, the
+ * highlight and the first column. A frame then costs a texture copy per
+ * row, and scrolling by pixels only moves the copies. A row is drawn again
+ * only when it changes or comes into view, reusing the textures not shown
+ * for the longest time. */
+
+#define KILO_WHEEL_ROWS 3       /* Rows scrolled by a wheel step. */
+#define KILO_SCROLL_TAU 0.08f   /* Seconds for the speed to decay by e. */
+#define KILO_SCROLL_STOP 20.0f  /* Pixels/s, slower than this stops. */
+
+/* Identify what row 'r' shows from column 'firstcol' on: the rendered chars
+ * and highlight in view, a few more for the zero width chars following the
+ * last one, where it starts and whether it is wrapped. */
+static uint64_t rowKey(erow *r, int firstcol) {
+    int from = editorRowColToRoff(r, firstcol);
+    int to = min(editorRowColToRoff(r, firstcol + E.screencols) + 16,
+                 r->rsize);
+    const unsigned char *render = (unsigned char*) editorRowRender(r);
+    const unsigned char *hl = editorRowHl(r);
+    uint64_t h = diffHash((const char*) render + from, max(to - from, 0));
+    for (int j = from; hl && j < to; j++) {
+        h ^= hl[j] + 1;
+        h *= 1099511628211ULL;
+    }
+    h ^= (uint64_t) firstcol << 32 | (uint64_t) E.wrap << 31 |
+         (hl != NULL) << 30;
+    return h * 1099511628211ULL;
+}
+
+/* Draw row 'r' from column 'firstcol' on at pixel row 'y', copying it from
+ * its texture, drawn first if it is not there. */
+void App::draw_row(erow *r, int firstcol, int y) {
+    if (rows_off) {
+        editorDrawRow(*this, r, firstcol, KILO_GUTTER_WIDTH, y);
+        return;
+    }
+    int w = (E.screencols + 2) * font_width;
+    if (w != rows_w) {
+        flush_rows();
+        rows_w = w;
+    }
+
+    uint64_t key = rowKey(r, firstcol);
+    auto it = rows_index.find(key);
+    size_t j;
+    if (it != rows_index.end()) {
+        j = it->second;
+    } else {
+        /* Keep the textures for two screens, the least recently shown
+         * going first. */
+        if (rows.size() < (size_t) 2 * (E.screenrows + 1)) {
+            SDL_Texture *tex = SDL_CreateTexture(renderer,
+                SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET,
+                w, font_height);
+            if (tex == NULL) {
+                rows_off = true;
+                flush_rows();
+                draw_row(r, firstcol, y);
+                return;
+            }
+            rows.push_back({0, 0, tex});
+            j = rows.size() - 1;
+        } else {
+            j = 0;
+            for (size_t k = 1; k < rows.size(); k++)
+                if (rows[k].used < rows[j].used) j = k;
+            rows_index.erase(rows[j].key);
         }
+        PROFILE_ZONE("App::draw_row");
+        SDL_SetRenderTarget(renderer, rows[j].tex);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+        SDL_RenderClear(renderer);
+        editorDrawRow(*this, r, firstcol, 0, 0);
+        SDL_SetRenderTarget(renderer, NULL);
+        rows[j].key = key;
+        rows_index[key] = j;
     }
+    rows[j].used = frame;
+    SDL_Rect dst = {KILO_GUTTER_WIDTH, y, w, font_height};
+    SDL_RenderCopy(renderer, rows[j].tex, NULL, &dst);
+}
+
+void App::flush_rows() {
+    for (auto &t : rows) SDL_DestroyTexture(t.tex);
+    rows.clear();
+    rows_index.clear();
 }
 
-/* Set an editor status message for the second line of the status, at the
- * end of the screen. */
-void editorSetStatusMessage(const char *fmt, ...) {
-    va_list ap;
-    va_start(ap,fmt);
-    vsnprintf(E.statusmsg,sizeof(E.statusmsg),fmt,ap);
-    va_end(ap);
-    E.statusmsg_time = time(NULL);
+/* Scroll 'steps' wheel steps down, or up if negative. */
+void App::scroll_wheel(float steps) {
+    scroll_v += steps * KILO_WHEEL_ROWS * font_height / KILO_SCROLL_TAU;
+}
+
+/* Stop scrolling, snapping to the closest row. */
+void App::scroll_stop() {
+    scroll_v = 0;
+    if (scroll_y >= font_height / 2.0f) editorScrollView(1);
+    scroll_y = 0;
+}
+
+/* Move the view by the distance scrolled in the last 'dt' seconds. */
+void App::update(float dt /* sec. */) {
+    if (scroll_v == 0) return;
+    float decay = expf(-dt / KILO_SCROLL_TAU);
+    scroll_y += scroll_v * KILO_SCROLL_TAU * (1 - decay);
+    scroll_v *= decay;
+
+    int delta = (int) floorf(scroll_y / font_height);
+    if (delta) {
+        int moved = editorScrollView(delta);
+        scroll_y -= moved * font_height;
+        if (moved != delta) {
+            /* The start or the end of the file. */
+            scroll_v = 0;
+            scroll_y = 0;
+        }
+    }
+    if (fabsf(scroll_v) < KILO_SCROLL_STOP) scroll_stop();
 }
 
 /* =============================== Find mode ================================ */
 
-#define KILO_QUERY_LEN 256
+/* Where the cursor and the view were when the search started, to go back
+ * there when it is canceled. */
+static struct {
+    int cx, cy, rowoff, coloff, wrapoff;
+    int64_t offset;     /* Byte offset in the file. */
+} find_saved;
+
+/* Search step in a read only view: stream through the file from the last
+ * match, or from where the search started. A step that reads too much
+ * without a match stops, and the next arrow goes on from there. Returns
+ * the row of the match, setting '*offset' to its render offset, or -1. */
+static int editorViewFindStep(const char *query, int dir, bool restart,
+                              int *offset)
+{
+    static int64_t fwd, back;   /* Where to search from, in each direction. */
+    if (restart) fwd = back = find_saved.offset;
+
+    int64_t next;
+    int64_t match = editorViewFind(query, dir > 0 ? fwd : back, dir, &next);
+    if (match == -1) {
+        if (next == -1) {
+            editorSetStatusMessage("No more matches");
+        } else {
+            (dir > 0 ? fwd : back) = next;
+            editorSetStatusMessage("Searching... at %lld MB, "
+                "use the arrows to go on", (long long) (next >> 20));
+        }
+        return -1;
+    }
+    fwd = match+1;
+    back = match;
+    editorViewGotoOffset(match);
+    int current = E.rowoff + E.cy;
+    erow *row = &E.row[current];
+    *offset = editorRowColToRoff(row,
+        editorRowOffToCol(row, match - E.view->off[current]));
+    return current;
+}
+
+/* Search prompt callback: search the query as it is typed, the arrows go to
+ * the next or previous match. The match is highlighted until the next
+ * search step. */
+static void editorFindCallback(const char *query, SDL_Keycode key) {
+    static int last_match = -1; /* Last line where a match was found. */
+    static int hl_line = -1;    /* Row where the match is highlighted. */
+    int dir = 1;
+    bool arrow = key == SDLK_RIGHT || key == SDLK_DOWN ||
+                 key == SDLK_LEFT || key == SDLK_UP;
+
+    /* Highlighting the row again clears the match. In a read only view the
+     * window may have been loaded again since, which does no harm. */
+    if (hl_line != -1 && hl_line < E.numrows)
+        editorUpdateSyntax(&E.row[hl_line]);
+    hl_line = -1;
+
+    if (key == SDLK_ESCAPE || key == SDLK_RETURN) {
+        if (key == SDLK_ESCAPE && E.view) {
+            editorViewGotoOffset(find_saved.offset);
+        } else if (key == SDLK_ESCAPE) {
+            E.cx = find_saved.cx; E.cy = find_saved.cy;
+            E.rowoff = find_saved.rowoff; E.coloff = find_saved.coloff;
+            E.wrapoff = find_saved.wrapoff;
+        }
+        last_match = -1;
+        return;
+    } else if (key == SDLK_RIGHT || key == SDLK_DOWN) {
+        dir = 1;
+    } else if (key == SDLK_LEFT || key == SDLK_UP) {
+        dir = -1;
+    } else {
+        last_match = -1;
+    }
+    if (*query == '\0') return;
+
+    /* A new query is searched from the row where the search started. */
+    int from = last_match;
+    if (from == -1) {
+        from = find_saved.rowoff + find_saved.cy - 1;
+        if (!E.view) dir = 1;
+    }
+    int offset, current;
+    if (E.view)
+        current = editorViewFindStep(query, dir, !arrow, &offset);
+    else
+        current = editorFindRow(query, from, dir, &offset);
+    if (current == -1) return;
+
+    erow *row = &E.row[current];
+    last_match = current;
+    hl_line = current;
+    editorRowSetHighlight(row, offset, strlen(query), HL_MATCH);
+    int col = editorRowRoffToCol(row, offset);
+    editorJumpTo(current, editorRowColToOff(row, col));
+}
 
 void editorFind() {
-    //char query[KILO_QUERY_LEN+1] = {0};
-    //int qlen = 0;
-    //int last_match = -1; /* Last line where a match was found. -1 for none. */
-    //int find_next = 0; /* if 1 search next, if -1 search prev. */
-    //int saved_hl_line = -1;  /* No saved HL */
-    //char *saved_hl = NULL;
-
-//#define FIND_RESTORE_HL do { \
-    //if (saved_hl) { \
-        //memcpy(E.row[saved_hl_line].hl,saved_hl, E.row[saved_hl_line].rsize); \
-        //saved_hl = NULL; \
-    //} \
-//} while (0)
-
-    ///* Save the cursor position in order to restore it later. */
-    //int saved_cx = E.cx, saved_cy = E.cy;
-    //int saved_coloff = E.coloff, saved_rowoff = E.rowoff;
-
-    //while(1) {
-        //editorSetStatusMessage(
-            //"Search: %s (Use ESC/Arrows/Enter)", query);
-        //editorRefreshScreen();
-
-        //int c = editorReadKey(fd);
-        //if (c == DEL_KEY || c == CTRL_H || c == BACKSPACE) {
-            //if (qlen != 0) query[--qlen] = '\0';
-            //last_match = -1;
-        //} else if (c == ESC || c == ENTER) {
-            //if (c == ESC) {
-                //E.cx = saved_cx; E.cy = saved_cy;
-                //E.coloff = saved_coloff; E.rowoff = saved_rowoff;
-            //}
-            //FIND_RESTORE_HL;
-            //editorSetStatusMessage("");
-            //return;
-        //} else if (c == ARROW_RIGHT || c == ARROW_DOWN) {
-            //find_next = 1;
-        //} else if (c == ARROW_LEFT || c == ARROW_UP) {
-            //find_next = -1;
-        //} else if (isprint(c)) {
-            //if (qlen < KILO_QUERY_LEN) {
-                //query[qlen++] = c;
-                //query[qlen] = '\0';
-                //last_match = -1;
-            //}
-        //}
-
-        ///* Search occurrence. */
-        //if (last_match == -1) find_next = 1;
-        //if (find_next) {
-            //char *match = NULL;
-            //int match_offset = 0;
-            //int i, current = last_match;
-
-            //for (i = 0; i < E.numrows; i++) {
-                //current += find_next;
-                //if (current == -1) current = E.numrows-1;
-                //else if (current == E.numrows) current = 0;
-                //match = strstr(E.row[current].render,query);
-                //if (match) {
-                    //match_offset = match-E.row[current].render;
-                    //break;
-                //}
-            //}
-            //find_next = 0;
-
-            ///* Highlight */
-            //FIND_RESTORE_HL;
-
-            //if (match) {
-                //erow *row = &E.row[current];
-                //last_match = current;
-                //if (row->hl) {
-                    //saved_hl_line = current;
-                    //saved_hl = (char*) malloc(row->rsize);
-                    //memcpy(saved_hl,row->hl,row->rsize);
-                    //memset(row->hl+match_offset,HL_MATCH,qlen);
-                //}
-                //E.cy = 0;
-                //E.cx = match_offset;
-                //E.rowoff = current;
-                //E.coloff = 0;
-                ///* Scroll horizontally as needed. */
-                //if (E.cx > E.screencols) {
-                    //int diff = E.cx - E.screencols;
-                    //E.cx -= diff;
-                    //E.coloff += diff;
-                //}
-            //}
-        //}
-    //}
+    find_saved.cx = E.cx; find_saved.cy = E.cy;
+    find_saved.rowoff = E.rowoff; find_saved.coloff = E.coloff;
+    find_saved.wrapoff = E.wrapoff;
+    find_saved.offset = editorCursorFileOffset();
+    editorPromptStart("Search: %s (Use ESC/Arrows/Enter)", editorFindCallback);
 }
 
-/* ========================= Editor events handling  ======================== */
+/* ================================ Replace ================================= */
+
+/* The query, while the replacement is being typed. A query between slashes,
+ * like "/[0-9]+/", is a regular expression. */
+static string replace_query;
+static string replace_fmt;
+
+static void editorReplaceWithCallback(const char *input, SDL_Keycode key) {
+    if (key != SDLK_RETURN) return;
+    const char *query = replace_query.c_str();
+    size_t qlen = replace_query.size();
+    bool regex = qlen > 2 && query[0] == '/' && query[qlen-1] == '/';
+    string pattern = regex ? replace_query.substr(1, qlen-2) : replace_query;
+
+    auto t1 = high_resolution_clock::now();
+    long long count = editorReplaceAll(pattern.c_str(), input, regex);
+    auto t2 = high_resolution_clock::now();
+    if (count == 0) {
+        editorSetStatusMessage("No match for %s", query);
+    } else if (count > 0) {
+        editorSetStatusMessage("Replaced %lld matches in %.0f ms, "
+            "Ctrl-Z to undo", count,
+            duration_cast<microseconds>(t2 - t1).count() / 1e3);
+    }
+}
 
-/* Handle cursor position change because arrow keys were pressed. */
-void editorMoveCursor(SDL_Keycode key) {
-    int filerow = E.rowoff + E.cy;
-    int filecol = E.coloff + E.cx;
-    int rowlen;
-    erow *row = (filerow >= E.numrows) ? NULL : &E.row[filerow];
+static void editorReplaceCallback(const char *input, SDL_Keycode key) {
+    if (key != SDLK_RETURN || *input == '\0') return;
+    replace_query = input;
+    /* The query goes in the prompt format, escape it. */
+    replace_fmt = "Replace ";
+    for (const char *p = input; *p; p++) {
+        if (*p == '%') replace_fmt += '%';
+        replace_fmt += *p;
+    }
+    replace_fmt += " with: %s";
+    editorPromptStart(replace_fmt.c_str(), editorReplaceWithCallback);
+}
 
-    switch(key) {
-    case SDLK_LEFT:
-        if (E.cx == 0) {
-            if (E.coloff) {
-                E.coloff--;
-            } else {
-                if (filerow > 0) {
-                    E.cy--;
-                    E.cx = E.row[filerow-1].size;
-                    if (E.cx > E.screencols-1) {
-                        E.coloff = E.cx-E.screencols+1;
-                        E.cx = E.screencols-1;
-                    }
-                }
-            }
+void editorReplace() {
+    editorPromptStart("Replace all (/regex/ for a regular expression): %s",
+        editorReplaceCallback);
+}
+
+/* ================================= Go to ================================== */
+
+/* Go to prompt callback. The input is a line number with an optional
+ * column, both starting from 1 ("120" or "120:8"), a percentage of the
+ * file ("50%"), a byte offset in the file ("@4096", or "@0x1000"), or a
+ * visual line when wrapping ("v300"). */
+static void editorGotoCallback(const char *input, SDL_Keycode key) {
+    if (key != SDLK_RETURN || *input == '\0') return;
+
+    char *end;
+    if (input[0] == '@') {
+        long long offset = strtoll(input+1, &end, 0);
+        if (end == input+1 || *end) goto invalid;
+        if (E.view) {
+            editorViewGotoOffset(offset);
         } else {
-            E.cx -= 1;
+            int filerow, filecol;
+            editorFileOffsetToPos(offset, &filerow, &filecol);
+            editorJumpTo(filerow, filecol);
         }
-        break;
-    case SDLK_RIGHT:
-        if (row && filecol < row->size) {
-            if (E.cx == E.screencols-1) {
-                E.coloff++;
-            } else {
-                E.cx += 1;
-            }
-        } else if (row && filecol == row->size) {
-            E.cx = 0;
-            E.coloff = 0;
-            if (E.cy == E.screenrows-1) {
-                E.rowoff++;
-            } else {
-                E.cy += 1;
-            }
+    } else if (strchr(input, '%')) {
+        double percent = strtod(input, &end);
+        if (end == input || strcmp(end, "%")) goto invalid;
+        percent = max(0.0, min(100.0, percent));
+        if (E.view)
+            editorViewGotoOffset(E.view->size * percent / 100);
+        else
+            editorJumpTo((int) (E.numrows * percent / 100), 0);
+    } else if (input[0] == 'v') {
+        long long line = strtoll(input+1, &end, 10);
+        if (end == input+1 || *end) goto invalid;
+        editorGotoVisualLine(line-1);
+    } else {
+        long line = strtol(input, &end, 10), col = 1;
+        if (end == input) goto invalid;
+        if (*end == ':') {
+            const char *colstr = end+1;
+            col = strtol(colstr, &end, 10);
+            if (end == colstr) goto invalid;
         }
-        break;
-    case SDLK_UP:
-        if (E.cy == 0) {
-            if (E.rowoff) E.rowoff--;
+        if (*end) goto invalid;
+        if (E.view) {
+            editorViewGotoLine(line-1);
+            editorSetCursor(E.rowoff + E.cy, max(0L, col-1));
         } else {
-            E.cy -= 1;
+            editorJumpTo(line-1, col-1);
         }
-        break;
-    case SDLK_DOWN:
-        if (filerow < E.numrows) {
-            if (E.cy == E.screenrows-1) {
-                E.rowoff++;
-            } else {
-                E.cy += 1;
-            }
+    }
+    return;
+
+invalid:
+    editorSetStatusMessage("Invalid position: %s", input);
+}
+
+void editorGoto() {
+    editorPromptStart("Go to line[:col], N%, @offset or v<visual line>: %s",
+        editorGotoCallback);
+}
+
+/* ================================= Open =================================== */
+
+/* Open prompt callback: the file is loaded in a new buffer in the
+ * background, and shown when ready. */
+static void editorOpenCallback(const char *input, SDL_Keycode key) {
+    if (key != SDLK_RETURN || *input == '\0') return;
+    editorBufferOpen(input, 1);
+}
+
+/* Project search prompt callback: search every file under the current
+ * directory. */
+static void editorGrepCallback(const char *input, SDL_Keycode key) {
+    if (key != SDLK_RETURN || *input == '\0') return;
+    editorGrepStart(".", input);
+}
+
+/* ================================= Filter ================================= */
+
+/* Filter prompt callback: pipe the whole buffer through the command, or
+ * lines <first>,<last> (counting from 1, both included) when it starts with
+ * them, like "10,20 sort". The command runs in the background, see
+ * editorFilterPoll(). */
+static void editorFilterCallback(const char *input, SDL_Keycode key) {
+    if (key != SDLK_RETURN) return;
+    int first = 1, last = E.numrows, n = 0;
+    if (sscanf(input, "%d,%d %n", &first, &last, &n) == 2 && n > 0) {
+        input += n;
+    } else {
+        first = 1;
+        last = E.numrows;
+    }
+    if (*input == '\0') return;
+    editorFilterStart(input, first-1, last);
+}
+
+/* ============================ Multiple cursors ============================ */
+
+/* Cursors prompt callback: put a cursor at every match of the input, where
+ * what is typed next goes, see editorCursorsAdd(). */
+static void editorCursorsCallback(const char *input, SDL_Keycode key) {
+    if (key != SDLK_RETURN || *input == '\0') return;
+    int n = editorCursorsAdd(input);
+    if (n == 0)
+        editorSetStatusMessage("No match");
+    else if (n > 0)
+        editorSetStatusMessage("%d cursors, ESC leaves one", n);
+}
+
+/* ============================== Completion ================================ */
+
+/* Ctrl-N completes the word before the cursor with the best ranked word of
+ * the buffer that starts with it, see editorComplete(). Pressing it again
+ * right away replaces it with the next one, and after the last one goes
+ * back to the word as typed. */
+
+#define KILO_COMPLETIONS 16     /* Completions cycled through. */
+
+static struct {
+    vector<string> words;
+    int next;       /* Completion to insert next, words.size() for none. */
+    int plen;       /* Bytes of the word as typed. */
+    int inserted;   /* Bytes inserted after it. */
+    int buffer, filerow, filecol, dirty;    /* Where the last completion
+                                               ends, and E.dirty after it:
+                                               anything else starts over. */
+} completion;
+
+void editorCompleteWord() {
+    int filerow = E.rowoff + E.cy, filecol = editorCursorOffset();
+    if (filerow >= E.numrows) return;
+    if (editorCursorsCount()) {
+        editorSetStatusMessage("No completion with multiple cursors");
+        return;
+    }
+    erow *row = &E.row[filerow];
+    bool again = !completion.words.empty() &&
+        completion.buffer == editorBufferCurrent() &&
+        completion.filerow == filerow && completion.filecol == filecol &&
+        completion.dirty == E.dirty;
+
+    if (again) {
+        filecol -= completion.inserted;
+        editorRowDelRange(row, filecol, completion.inserted);
+        editorSetCursor(filerow, filecol);
+    } else {
+        const char *chars = editorRowChars(row);
+        int start = filecol;
+        while (start > 0 && is_word_char(chars[start-1])) start--;
+        completion.plen = filecol - start;
+        completion.words.clear();
+        if (completion.plen == 0) {
+            editorSetStatusMessage("No word to complete");
+            return;
         }
-        break;
+        editorComplete(chars + start, completion.plen, filerow,
+            completion.words, KILO_COMPLETIONS);
+        completion.next = 0;
+        if (completion.words.empty()) {
+            editorSetStatusMessage("No completion");
+            return;
+        }
+    }
+
+    int n = completion.words.size();
+    completion.inserted = 0;
+    if (completion.next < n) {
+        const string &word = completion.words[completion.next];
+        int dirty = E.dirty;
+        editorInsertText(word.data() + completion.plen,
+            word.size() - completion.plen);
+        if (E.dirty == dirty) {     /* Read only. */
+            completion.words.clear();
+            return;
+        }
+        completion.inserted = word.size() - completion.plen;
+        editorSetStatusMessage("Completion %d/%d: %s", completion.next + 1,
+            n, word.c_str());
+    } else {
+        editorSetStatusMessage("Completion: back to the word as typed");
+    }
+    completion.next = (completion.next + 1) % (n + 1);
+    completion.buffer = editorBufferCurrent();
+    completion.filerow = E.rowoff + E.cy;
+    completion.filecol = editorCursorOffset();
+    completion.dirty = E.dirty;
+}
+
+/* ========================= Editor events handling  ======================== */
+
+/* Handle cursor position change because arrow keys were pressed 'times'
+ * times in a row. Vertical moves are a single jump, whatever the count.
+ * The other cursors, if any, move along. */
+void editorMoveCursor(SDL_Keycode key, int times = 1) {
+    int filerow, filecol;
+    erow *row;
+
+    switch(key) {
+    case SDLK_UP:
+        editorMoveRows(-times);
+        editorCursorsMove(-times, 0);
+        return;
+    case SDLK_DOWN:
+        editorMoveRows(times);
+        editorCursorsMove(times, 0);
+        return;
     }
-    /* Fix cx if the current line has not enough chars. */
-    filerow = E.rowoff+E.cy;
-    filecol = E.coloff+E.cx;
-    row = (filerow >= E.numrows) ? NULL : &E.row[filerow];
-    rowlen = row ? row->size : 0;
-    if (filecol > rowlen) {
-        E.cx -= filecol-rowlen;
-        if (E.cx < 0) {
-            E.coloff += E.cx;
-            E.cx = 0;
+    editorCursorsMove(0, key == SDLK_LEFT ? -times : times);
+
+    /* Horizontal moves go a char at a time, skipping the zero width chars
+     * that display together with the char before them. */
+    while (times--) {
+        filerow = E.rowoff + E.cy;
+        filecol = editorCursorOffset();
+        row = (filerow >= E.numrows) ? NULL : &E.row[filerow];
+
+        switch(key) {
+        case SDLK_LEFT:
+            if (row && filecol > 0) {
+                int col = editorRowOffToCol(row, filecol);
+                do {
+                    filecol = utf8Prev(editorRowChars(row), filecol);
+                } while (filecol > 0 && editorRowOffToCol(row, filecol) >= col);
+                editorSetCursor(filerow, filecol);
+            } else if (filerow > 0) {
+                editorSetCursor(filerow-1, E.row[filerow-1].size);
+            }
+            break;
+        case SDLK_RIGHT:
+            if (row && filecol < row->size) {
+                editorSetCursor(filerow,
+                    utf8Next(editorRowChars(row), row->size, filecol));
+            } else if (row) {
+                editorSetCursor(filerow+1, 0);
+            }
+            break;
         }
     }
+    editorFixCursorCol();
 }
 
 /* Process events arriving from the standard input, which is, the user
  * is typing stuff on the terminal. */
 #define KILO_QUIT_TIMES 3
 
-void editorProcessKeypress(App &app, SDL_Event &event) {
+void editorProcessKeypress(App &app, SDL_Event &event, int repeat) {
     /* When the file is modified, requires Ctrl-q to be pressed N times
      * before actually quitting. */
     static int quit_times = KILO_QUIT_TIMES;
@@ -1017,10 +1135,11 @@ void editorProcessKeypress(App &app, SDL_Event &event) {
         case SDLK_c:         /* Ctrl-c */
             break;
         case SDLK_q:         /* Ctrl-q */
-            /* Quit if the file was already saved. */
-            if (E.dirty && quit_times) {
-                editorSetStatusMessage("WARNING!!! File has unsaved changes. "
-                    "Press Ctrl-Q %d more times to quit.", quit_times);
+            /* Quit if the files were already saved. */
+            if (editorBufferDirty() && quit_times) {
+                editorSetStatusMessage("WARNING!!! %d file(s) with unsaved "
+                    "changes. Press Ctrl-Q %d more times to quit.",
+                    editorBufferDirty(), quit_times);
                 quit_times--;
                 return;
             }
@@ -1029,46 +1148,121 @@ void editorProcessKeypress(App &app, SDL_Event &event) {
         case SDLK_s:         /* Ctrl-s */
             editorSave();
             break;
-        case SDLK_f:
-            editorFind();
+        case SDLK_f:         /* Ctrl-f, or Ctrl-Shift-f to search in files */
+            if (event.key.keysym.mod & KMOD_SHIFT)
+                editorPromptStart("Search in files: %s", editorGrepCallback);
+            else
+                editorFind();
+            break;
+        case SDLK_e:         /* Ctrl-e, replace all */
+            editorReplace();
+            break;
+        case SDLK_z:         /* Ctrl-z, undo replace all, filter or an
+                                edit at multiple cursors */
+            if (editorUndo() == 0)
+                editorSetStatusMessage("Undone");
+            break;
+        case SDLK_d:         /* Ctrl-d, a cursor at every match */
+            editorPromptStart("Cursors at: %s", editorCursorsCallback);
+            break;
+        case SDLK_g:         /* Ctrl-g, go to line or offset */
+            editorGoto();
             break;
         case SDLK_h:         /* Ctrl-h */
             editorDelChar();
             break;
+        case SDLK_w:         /* Ctrl-w, toggle soft wrap */
+            editorSetWrap(!E.wrap);
+            editorSetStatusMessage("Soft wrap %s", E.wrap ? "on" : "off");
+            break;
+        case SDLK_r:         /* Ctrl-r, reload the file from disk */
+            editorReload();
+            break;
+        case SDLK_t:         /* Ctrl-t, toggle follow mode */
+            if (E.follow) {
+                editorFollowStop();
+                editorSetStatusMessage("Follow off");
+            } else if (editorFollowStart() == 0) {
+                editorSetStatusMessage("Follow on");
+            }
+            break;
+        case SDLK_v:         /* Ctrl-v, paste */
+            if (SDL_HasClipboardText()) {
+                char *text = SDL_GetClipboardText();
+                editorInsertText(text, strlen(text));
+                SDL_free(text);
+            }
+            break;
         case SDLK_l:         /* ctrl+l, clear screen */
             /* Just refresht the line as side effect. */
             break;
+        case SDLK_n:         /* Ctrl-n, complete the word before the cursor */
+            editorCompleteWord();
+            break;
+        case SDLK_m:         /* Ctrl-m, show or hide the minimap */
+            app.toggle_minimap();
+            break;
+        case SDLK_p:         /* Ctrl-p, pipe the buffer through a command */
+            editorPromptStart("Filter through: %s", editorFilterCallback);
+            break;
+        case SDLK_o:         /* Ctrl-o, open a file in a new buffer */
+            editorPromptStart("Open: %s", editorOpenCallback);
+            break;
+        case SDLK_k:         /* Ctrl-k, close the buffer */
+            /* Like quitting, a modified file needs more presses. */
+            if (E.dirty && quit_times) {
+                editorSetStatusMessage("WARNING!!! File has unsaved changes. "
+                    "Press Ctrl-K %d more times to close it.", quit_times);
+                quit_times--;
+                return;
+            }
+            editorBufferClose();
+            break;
+        case SDLK_PAGEUP:    /* Ctrl-PageUp/PageDown, switch buffer */
+            editorBufferNext(-1);
+            break;
+        case SDLK_PAGEDOWN:
+            editorBufferNext(1);
+            break;
         }
     } else {
         switch(key) {
         case SDLK_RETURN:         /* Enter */
-            editorInsertNewline();
+            if (E.results)
+                editorGrepOpen();
+            else
+                editorInsertNewline();
             break;
         case SDLK_BACKSPACE:     /* Backspace */
         case SDLK_DELETE:
             editorDelChar();
             break;
         case SDLK_PAGEUP:
+            editorMovePages(-repeat);
+            break;
         case SDLK_PAGEDOWN:
-            if (key == SDLK_PAGEUP && E.cy != 0)
-                E.cy = 0;
-            else if (key == SDLK_PAGEDOWN && E.cy != E.screenrows-1)
-                E.cy = E.screenrows-1;
-            {
-            int times = E.screenrows;
-            while(times--)
-                editorMoveCursor(key == SDLK_PAGEUP ? SDLK_UP
-                                                    : SDLK_DOWN);
-            }
+            editorMovePages(repeat);
             break;
         case SDLK_UP:
         case SDLK_DOWN:
         case SDLK_LEFT:
         case SDLK_RIGHT:
-            editorMoveCursor(key);
+            editorMoveCursor(key, repeat);
             break;
-        case SDLK_ESCAPE:
-            /* Nothing to do for ESC in this mode. */
+        case SDLK_ESCAPE:         /* Cancel the filter, or leave one cursor. */
+            if (editorFilterRunning()) {
+                editorFilterStop();
+                editorSetStatusMessage("Filter cancelled");
+            } else if (editorCursorsCount()) {
+                editorCursorsClear();
+                editorSetStatusMessage("");
+            }
+            break;
+        case SDLK_F11:
+            app.toggle_profiler_trace();
+            break;
+        case SDLK_F12:
+            app.toggle_profiler_overlay();
             break;
         default:
             //editorInsertChar(key);
@@ -1079,31 +1273,25 @@ void editorProcessKeypress(App &app, SDL_Event &event) {
     quit_times = KILO_QUIT_TIMES; /* Reset it to the original value. */
 }
 
-int editorFileWasModified(void) {
-    return E.dirty;
-}
-
-void initEditor(App &app) {
-    E.cx = 0;
-    E.cy = 0;
-    E.rowoff = 0;
-    E.coloff = 0;
-    E.numrows = 0;
-    E.row = NULL;
-    E.dirty = 0;
-    E.filename = NULL;
-    E.syntax = NULL;
-    int fw, fh, ww, wh;
-    app.getWindowSize(ww, wh);
-    app.getFontSize(fw, fh);
-    E.screenrows = wh / fh;
-    E.screencols = ww / fw;
-    E.screenrows -= 2; /* Get room for status bar. */
-}
-
 App::App(int &_argc, char **&_argv) : argc(_argc), argv(_argv) {}
 
 App::~App() {
+	if (P.tracing) {
+		profileStopTrace(trace_path);
+	}
+	if (record_fp) {
+		fclose(record_fp);
+	}
+	if (minimap_tex) {
+		SDL_DestroyTexture(minimap_tex);
+	}
+	flush_rows();
+	if (atlas) {
+		SDL_DestroyTexture(atlas);
+	}
+	if (atlas_surface) {
+		SDL_FreeSurface(atlas_surface);
+	}
 	if (window) {
 		SDL_DestroyWindow(window);
 	}
@@ -1118,103 +1306,736 @@ App::~App() {
 }
 
 void App::init_sdl() {
+	if (headless) {
+		/* Run without a display: the dummy driver has no accelerated
+		 * renderer, so everything is drawn by the software one. */
+		SDL_SetHint(SDL_HINT_VIDEODRIVER, "dummy");
+		SDL_SetHint(SDL_HINT_RENDER_DRIVER, "software");
+	}
 	if (SDL_Init(SDL_INIT_VIDEO) < 0) {
 		throw Exception(SDL_GetError());
 	}
-	if (TTF_Init() < 0) {
-		throw Exception(TTF_GetError());
-	}
 	
 	window = SDL_CreateWindow(
 		"kilo (SDL clone)", 
 		SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
 		DEFAULT_WINDOW_WIDTH, DEFAULT_WINDOW_HEIGHT,
-		SDL_WINDOW_SHOWN
+		headless ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE
 	);
 	if (window == NULL) {
 		throw Exception(SDL_GetError());
 	}
 	
-	renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+	/* Vsync paces the main loop at the display refresh rate: the input
+	 * that arrives during a frame is coalesced in the next one. */
+	renderer = SDL_CreateRenderer(window, -1, headless ? SDL_RENDERER_SOFTWARE :
+		SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
 	if (renderer == NULL) {
 		throw Exception(SDL_GetError());
 	}
-    
-	font = TTF_OpenFont("SourceCodePro-Medium.ttf", 16);
-	if (font == NULL) {
-		throw Exception(TTF_GetError());
-	}
-	if (TTF_SizeUTF8(font, "W", &font_width, &font_height) < 0) {
-		throw Exception(TTF_GetError());
-	}
 }
 
+#define KILO_USAGE "Usage: kilo [--headless] [--follow] [--view] [--no-cache] " \
+    "[--replay <events>] " \
+    "[--record <events>] [--report <json>] [--budget-p99 <us>] " \
+    "[--budget-startup <ms>] " \
+    "[--trace <json>] <filename> [<filename> ...]\n" \
+    "  --no-cache  Don't use the line index cache of large files, that\n" \
+    "              assumes they are only appended to"
+
+void App::parse_args() {
+    for (int j = 1; j < argc; j++) {
+        char *arg = argv[j];
+        bool has_value = j+1 < argc;
+        if (!strcmp(arg,"--headless")) {
+            headless = true;
+        } else if (!strcmp(arg,"--follow")) {
+            follow = true;
+        } else if (!strcmp(arg,"--view")) {
+            view = true;
+        } else if (!strcmp(arg,"--no-cache")) {
+            nocache = true;
+        } else if (!strcmp(arg,"--replay") && has_value) {
+            replay_path = argv[++j];
+        } else if (!strcmp(arg,"--record") && has_value) {
+            record_path = argv[++j];
+        } else if (!strcmp(arg,"--report") && has_value) {
+            report_path = argv[++j];
+        } else if (!strcmp(arg,"--budget-p99") && has_value) {
+            budget_p99 = atof(argv[++j]);
+        } else if (!strcmp(arg,"--budget-startup") && has_value) {
+            budget_startup = atof(argv[++j]);
+        } else if (!strcmp(arg,"--trace") && has_value) {
+            trace_path = argv[++j];
+            profileStartTrace();
+        } else if (arg[0] == '-') {
+            throw Exception(KILO_USAGE);
+        } else if (filename) {
+            more_files.push_back(arg);
+        } else {
+            filename = arg;
+        }
+    }
+    if (!filename) {
+        throw Exception(KILO_USAGE);
+    }
+}
+
+/* The file is opened and the font loaded in threads of their own while the
+ * window is created, as each can take a while. The file is opened for a
+ * screen size guessed from the default window and font size, and resized
+ * once they are known. If it is still loading then, its first screen is
+ * drawn meanwhile, so that the first frame never waits for a large file. */
 void App::init() {
-    if (argc != 2) {
-        throw Exception("Usage: kilo <filename>");
+    parse_args();
+    auto t1 = high_resolution_clock::now();
+    editorOpenStart(filename, view,
+        DEFAULT_WINDOW_HEIGHT / KILO_FONT_SIZE - 2,
+        DEFAULT_WINDOW_WIDTH / (KILO_FONT_SIZE / 2), nocache);
+    thread fonts(&App::load_font, this);
+    try {
+        init_sdl();
+        fonts.join();
+        if (!font_error.empty()) {
+            throw Exception(font_error);
+        }
+        atlas = SDL_CreateTextureFromSurface(renderer, atlas_surface);
+        if (atlas == NULL) {
+            throw Exception(SDL_GetError());
+        }
+        SDL_SetTextureBlendMode(atlas, SDL_BLENDMODE_BLEND);
+        SDL_FreeSurface(atlas_surface);
+        atlas_surface = NULL;
+    } catch (...) {
+        if (fonts.joinable()) fonts.join();
+        editorOpenWait(1, 1);
+        throw;
+    }
+
+    int fw, fh, ww, wh;
+    getWindowSize(ww, wh);
+    getFontSize(fw, fh);
+    int rows = wh / fh - 2, cols = text_cols(ww); /* Room for status bar. */
+    if (editorOpenPreview(filename, rows, cols)) {
+        draw();
+        first_frame();
     }
-	init_sdl();
+    editorOpenWait(rows, cols);
+    auto t2 = high_resolution_clock::now();
+    open_ms = duration_cast<microseconds>(t2 - t1).count() / 1e3;
     SDL_StartTextInput();
-    initEditor(*this);
-    editorSelectSyntaxHighlight(argv[1]);
-    editorOpen(argv[1]);
+    if (record_path) {
+        record_fp = fopen(record_path, "w");
+        if (record_fp == NULL) {
+            throw Exception("Opening event record file");
+        }
+    }
     editorSetStatusMessage(
-        "HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find");
+        "HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find | "
+        "Ctrl-G = go to");
+    if (follow) editorFollowStart();
+    for (char *f : more_files) editorBufferOpen(f, 0);
+}
+
+/* Called after drawing a frame: the first one sets startup_ms. */
+void App::first_frame() {
+	if (startup_ms) return;
+	startup_ms = duration_cast<microseconds>(
+		high_resolution_clock::now() - started).count() / 1e3;
+}
+
+bool App::replaying() {
+    return replay_path != NULL;
 }
 
 void App::finish() {
 	running = false;
 }
 
-void App::on_event() {
+/* Handle the current event. 'repeat' is how many identical events were
+ * coalesced into this one, see motionRun(). */
+void App::on_event(int repeat) {
+	PROFILE_ZONE("App::on_event");
+	if (record_fp) {
+		record_event(repeat);
+	}
 	switch (event.type) {
 		case SDL_QUIT:
 			finish();
 			break;
 		case SDL_KEYDOWN:
-            editorProcessKeypress(*this, event);
+			scroll_stop();
+			if (prompt.active)
+				editorPromptEvent(event, repeat);
+			else
+				editorProcessKeypress(*this, event, repeat);
 			break;
 		case SDL_TEXTINPUT:
-			// cout << "event.text.text: '" << event.text.text << "'" << endl;
-            editorInsertChar(*event.text.text);
+			scroll_stop();
+			if (prompt.active)
+				editorPromptEvent(event, repeat);
+			else
+				editorInsertText(event.text.text, strlen(event.text.text));
+			break;
+		case SDL_WINDOWEVENT:
+			if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+				/* Leave room for the status bar, like init(). */
+				editorResize(event.window.data2 / font_height - 2,
+					text_cols(event.window.data1));
+			}
+			break;
+		case SDL_MOUSEBUTTONDOWN:
+			if (event.button.button == SDL_BUTTON_LEFT) {
+				scroll_stop();
+				minimap_drag = minimap_jump(event.button.x, event.button.y);
+			}
+			break;
+		case SDL_MOUSEWHEEL: {
+			/* Positive is away from the user, scrolling up. Trackpads
+			 * send fractions of a step. */
+#if SDL_VERSION_ATLEAST(2,0,18)
+			float steps = event.wheel.preciseY;
+#else
+			float steps = event.wheel.y;
+#endif
+			if (event.wheel.direction == SDL_MOUSEWHEEL_FLIPPED)
+				steps = -steps;
+			scroll_wheel(-steps);
+			break;
+		}
+		case SDL_MOUSEBUTTONUP:
+			if (event.button.button == SDL_BUTTON_LEFT)
+				minimap_drag = false;
+			break;
+		case SDL_MOUSEMOTION:
+			if (minimap_drag && (event.motion.state & SDL_BUTTON_LMASK))
+				minimap_jump(event.motion.x, event.motion.y);
 			break;
 	}
 }
 
+/* Return how many events starting at pending[j] are the same cursor motion
+ * key, like the repeats of a held down key. These are handled as a single
+ * move followed by a single redraw. */
+static int motionRun(const vector<SDL_Event> &pending, size_t j) {
+    const SDL_Event &first = pending[j];
+    if (first.type != SDL_KEYDOWN || (first.key.keysym.mod & KMOD_CTRL))
+        return 1;
+    switch (first.key.keysym.sym) {
+    case SDLK_UP: case SDLK_DOWN: case SDLK_LEFT: case SDLK_RIGHT:
+    case SDLK_PAGEUP: case SDLK_PAGEDOWN:
+        break;
+    default:
+        return 1;
+    }
+
+    size_t k = j+1;
+    while (k < pending.size() && pending[k].type == SDL_KEYDOWN &&
+           pending[k].key.keysym.sym == first.key.keysym.sym &&
+           pending[k].key.keysym.mod == first.key.keysym.mod) k++;
+    return k-j;
+}
+
+/* Main loop: sleep until there is input, drain everything that is pending,
+ * handle it with repeated motions coalesced, then draw a single frame. The
+ * wait times out now and then so that the status message can expire, and
+ * to check if the file changed on disk. In follow mode, or while files are
+ * loaded, searched, diffed or indexed for completion in the background, it
+ * times out more often to poll them, and a frame is drawn only when there
+ * was input or something changed. While scrolling it does not wait, every
+ * frame moving the view, paced by vsync, and while filtering it waits for
+ * the command instead, see editorFilterPoll(). */
+#define KILO_IDLE_MS 500
+#define KILO_FOLLOW_MS 10
+
 void App::run() {
+	draw();
+	first_frame();
 	auto t1 = high_resolution_clock::now();
+	auto last_draw = t1;
+	vector<SDL_Event> pending;
 	while (running) {
-		while (SDL_PollEvent(&event)) {
-			on_event();
+		pending.clear();
+		if (SDL_WaitEventTimeout(&event,
+				scrolling() || editorFilterRunning() ? 0 :
+				E.follow || E.words.dirty || editorGutterBusy() ||
+				editorBufferLoading() || editorGrepRunning() ?
+				KILO_FOLLOW_MS : KILO_IDLE_MS)) {
+			do {
+				pending.push_back(event);
+			} while (SDL_PollEvent(&event));
 		}
+		for (size_t j = 0; j < pending.size() && running; ) {
+			int repeat = motionRun(pending, j);
+			event = pending[j];
+			on_event(repeat);
+			j += repeat;
+		}
+		bool changed = editorBufferPoll();
+		changed = editorGrepPoll() || changed;
+		changed = editorViewPoll() || editorFollowPoll() ||
+			editorCheckDisk() || changed;
+		changed = editorGutterPoll() || changed;
+		changed = editorFilterPoll() || changed;
+		editorWordsPoll();
 		auto t2 = high_resolution_clock::now();
 		auto dt = duration_cast<microseconds>(t2 - t1).count();
 		t1 = t2;
+		changed = scrolling() || changed;
 		update((float)dt / 1e6f);
+		if (pending.empty() && !changed &&
+			t2 - last_draw < milliseconds(KILO_IDLE_MS)) continue;
+		last_draw = t2;
 		draw();
 	}
 }
 
-void App::update(float dt /* sec. */) {
-}
-
 void App::draw() {
 	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
 	SDL_RenderClear(renderer);
     editorRefreshScreen(*this);
+	if (minimap && !E.view) {
+		draw_minimap();
+	}
+    /* The cursor covers the whole char under it, two columns for wide
+     * chars, but a single one for TABs. */
+    int cursor_x, cursor_y;
+    int cursor_cols = 1, filerow = E.rowoff + E.cy;
+    editorCursorScreen(&cursor_x, &cursor_y);
+    if (filerow < E.numrows) {
+        erow *row = &E.row[filerow];
+        int off = editorCursorOffset();
+        if (off < row->size && editorRowChars(row)[off] != TAB) {
+            int next = utf8Next(editorRowChars(row), row->size, off);
+            cursor_cols = max(1, editorRowOffToCol(row, next) -
+                                 editorRowOffToCol(row, off));
+        }
+    }
     SDL_Rect cursor_rect = {
-        E.cx * font_width, E.cy * font_height,
-        font_width, font_height
+        KILO_GUTTER_WIDTH + cursor_x * font_width,
+        cursor_y * font_height - scroll_pixels(),
+        cursor_cols * font_width, font_height
     };
 	SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
     SDL_RenderFillRect(renderer, &cursor_rect);
-	SDL_RenderPresent(renderer);
+    /* The other cursors are thin bars, not to hide the chars they edit. */
+    editorCursorsScreen(cursors_shown);
+    cursors_rects.clear();
+    for (auto &c : cursors_shown) {
+        cursors_rects.push_back({KILO_GUTTER_WIDTH + c.col * font_width,
+            c.row * font_height - scroll_pixels(), 2, font_height});
+    }
+    if (!cursors_rects.empty()) {
+        SDL_RenderFillRects(renderer, cursors_rects.data(),
+            cursors_rects.size());
+    }
+	if (P.overlay) {
+		draw_profiler_overlay();
+	}
+	{
+		PROFILE_ZONE("SDL_RenderPresent");
+		SDL_RenderPresent(renderer);
+	}
+	profileFrameEnd();
+}
+
+/* F12: show or hide the profiler overlay. */
+void App::toggle_profiler_overlay() {
+	profileSetOverlay(!P.overlay);
+}
+
+/* F11: start a trace capture, or stop it and write it to trace_path. */
+void App::toggle_profiler_trace() {
+	if (!P.tracing) {
+		profileStartTrace();
+		editorSetStatusMessage("Profiler trace started, F11 to stop");
+	} else if (profileStopTrace(trace_path) == 0) {
+		editorSetStatusMessage("Profiler trace written to %s", trace_path);
+	} else {
+		editorSetStatusMessage("Can't write profiler trace: %s",
+			strerror(errno));
+	}
+}
+
+/* Screen columns left for the text in a window 'ww' pixels wide. */
+int App::text_cols(int ww) {
+	return (ww - KILO_GUTTER_WIDTH - (minimap ? MINIMAP_WIDTH : 0)) /
+		font_width;
+}
+
+/* Mark the row at pixel 'y' in the gutter with 'mark', see
+ * editorGutterMark(): a bar for a changed or added row, and a line on its
+ * top or bottom edge if lines were removed there. */
+void App::draw_gutter(int y, int mark) {
+	if (!mark) return;
+	SDL_Rect bar = {0, y, KILO_GUTTER_WIDTH - 1, font_height};
+	if (mark & (GUTTER_CHANGED|GUTTER_ADDED)) {
+		if (mark & GUTTER_ADDED)
+			SDL_SetRenderDrawColor(renderer, 0x40, 0xC0, 0x40, 255);
+		else
+			SDL_SetRenderDrawColor(renderer, 0x40, 0x80, 0xE0, 255);
+		SDL_RenderFillRect(renderer, &bar);
+	}
+	SDL_SetRenderDrawColor(renderer, 0xE0, 0x40, 0x40, 255);
+	if (mark & GUTTER_REMOVED) {
+		SDL_Rect edge = {0, bar.y, KILO_GUTTER_WIDTH, 2};
+		SDL_RenderFillRect(renderer, &edge);
+	}
+	if (mark & GUTTER_REMOVED_END) {
+		SDL_Rect edge = {0, bar.y + font_height - 2, KILO_GUTTER_WIDTH, 2};
+		SDL_RenderFillRect(renderer, &edge);
+	}
+}
+
+/* Ctrl-M: show or hide the minimap, on the right of the text. */
+void App::toggle_minimap() {
+	int ww, wh;
+	getWindowSize(ww, wh);
+	minimap = !minimap;
+	editorResize(E.screenrows, text_cols(ww));
+}
+
+/* Draw the minimap, a pixel a cell, next to the text. Only the tiles that
+ * changed since the last frame are converted and uploaded to the texture,
+ * which is then drawn with a single copy, and the rows on screen are shown
+ * by a translucent band over it. */
+void App::draw_minimap() {
+	PROFILE_ZONE("App::draw_minimap");
+	int ww, wh;
+	getWindowSize(ww, wh);
+	int h = E.screenrows * font_height;
+	int x0 = ww - MINIMAP_WIDTH;
+
+	if (minimap_tex == NULL || minimap_h != h) {
+		if (minimap_tex) SDL_DestroyTexture(minimap_tex);
+		minimap_tex = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+			SDL_TEXTUREACCESS_STREAMING, MINIMAP_WIDTH, h);
+		if (minimap_tex == NULL) {
+			throw Exception("Creating the minimap texture");
+		}
+		SDL_SetTextureBlendMode(minimap_tex, SDL_BLENDMODE_BLEND);
+		minimap_h = h;
+		E.minimap.redraw = 1;
+	}
+	minimap_tiles.clear();
+	int rows = editorMinimapUpdate(h, minimap_tiles);
+	minimap_argb.resize(MINIMAP_TILE * MINIMAP_WIDTH);
+	for (int t : minimap_tiles) {
+		/* The class gives the color, how many rows cover the pixel the
+		 * opacity. */
+		int y = t * MINIMAP_TILE, th = min(MINIMAP_TILE, h - y);
+		const unsigned char *pixel =
+			E.minimap.pixels.data() + (size_t)y * MINIMAP_WIDTH;
+		for (int j = 0; j < th * MINIMAP_WIDTH; j++) {
+			SDL_Color c = editorSyntaxToColor(pixel[j] >> 4);
+			Uint32 a = pixel[j] ? 80 + (pixel[j] & 15) * 175 / 15 : 0;
+			minimap_argb[j] = a << 24 | c.r << 16 | c.g << 8 | c.b;
+		}
+		SDL_Rect r = {0, y, MINIMAP_WIDTH, th};
+		SDL_UpdateTexture(minimap_tex, &r, minimap_argb.data(),
+			MINIMAP_WIDTH * sizeof(Uint32));
+	}
+
+	SDL_SetRenderDrawColor(renderer, 24, 24, 24, 255);
+	SDL_Rect bg = {x0, 0, MINIMAP_WIDTH, h};
+	SDL_RenderFillRect(renderer, &bg);
+	if (rows) {
+		SDL_Rect src = {0, 0, MINIMAP_WIDTH, rows};
+		SDL_Rect dst = {x0, 0, MINIMAP_WIDTH, rows};
+		SDL_RenderCopy(renderer, minimap_tex, &src, &dst);
+	}
+	int scale = E.minimap.scale;
+	SDL_Rect band = {x0, E.rowoff / scale, MINIMAP_WIDTH,
+		max(2, E.screenrows / scale)};
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+	SDL_SetRenderDrawColor(renderer, 255, 255, 255, 48);
+	SDL_RenderFillRect(renderer, &band);
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+}
+
+/* Scroll to the rows under the point x,y of the window, if it is on the
+ * minimap, centering them unless they are already on screen. Returns true
+ * if x,y is on the minimap. */
+bool App::minimap_jump(int x, int y) {
+	int ww, wh;
+	getWindowSize(ww, wh);
+	if (!minimap || E.view || x < ww - MINIMAP_WIDTH ||
+		y < 0 || y >= E.screenrows * font_height) return false;
+	if (E.minimap.height == 0 || E.numrows == 0) return true;
+	editorJumpTo(min(y * E.minimap.scale, E.numrows - 1), 0);
+	return true;
+}
+
+/* Draw the frame time histogram and the per-zone costs in the top right
+ * corner of the window. Bars are red when over the 60 FPS budget. */
+void App::draw_profiler_overlay() {
+	const int bar_w = 2, graph_h = 60;
+	const float graph_ms = 33.3f, budget_ms = 16.7f;
+	int ww, wh;
+	getWindowSize(ww, wh);
+	int w = max(PROFILE_HISTORY*bar_w, 34*font_width);
+	int h = graph_h + (int)(P.zones.size()+1)*font_height;
+	int x0 = ww - w, y0 = 0;
+
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 200);
+	SDL_Rect bg = {x0, y0, w, h};
+	SDL_RenderFillRect(renderer, &bg);
+
+	float sum = 0, worst = 0;
+	for (int j = 0; j < PROFILE_HISTORY; j++) {
+		float ms = P.frame_ms[(P.frame_idx+j) % PROFILE_HISTORY];
+		sum += ms;
+		worst = max(worst, ms);
+		int bh = (int)(min(ms, graph_ms) / graph_ms * graph_h);
+		if (ms > budget_ms)
+			SDL_SetRenderDrawColor(renderer, 255, 64, 64, 255);
+		else
+			SDL_SetRenderDrawColor(renderer, 64, 255, 64, 255);
+		SDL_Rect bar = {x0 + j*bar_w, y0 + graph_h - bh, bar_w, bh};
+		SDL_RenderFillRect(renderer, &bar);
+	}
+	int budget_y = y0 + graph_h - (int)(budget_ms / graph_ms * graph_h);
+	SDL_SetRenderDrawColor(renderer, 255, 255, 0, 255);
+	SDL_RenderDrawLine(renderer, x0, budget_y, x0 + w, budget_y);
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+
+	char line[80];
+	int y = y0 + graph_h;
+	snprintf(line, sizeof(line), "frame avg %5.2f ms  max %5.2f ms",
+		sum / PROFILE_HISTORY, worst);
+	draw_text(x0, y, line, YELLOW);
+	for (auto &z : P.zones) {
+		y += font_height;
+		snprintf(line, sizeof(line), "%-20.20s %6.2f ms %6.0f",
+			z.name, z.avg_ms, z.avg_calls);
+		draw_text(x0, y, line);
+	}
+}
+
+/* ========================= Event record / replay ========================== */
+
+/* Event scripts are plain text, one event per line:
+ *
+ *   key [ctrl+][shift+][alt+]<SDL key name>    e.g. "key ctrl+S", "key PageDown"
+ *   text <utf-8 text>                          e.g. "text hello"
+ *   click <x> <y>                              e.g. "click 600 120"
+ *   wheel <steps>                              e.g. "wheel -3", "wheel 0.25"
+ *   frame
+ *
+ * Text is limited to 31 bytes, like SDL text input events. A click is a
+ * press of the left mouse button at x,y in the window. Wheel steps are
+ * positive scrolling up, like SDL, and "frame" only draws a frame, letting
+ * the scrolling go on. Every event is followed by a frame KILO_REPLAY_FRAME
+ * seconds later. A line may start with a repeat count, like "200 key Down".
+ * Empty lines and lines starting with '#' are ignored. Files written by
+ * --record use the same format, so a recorded session can be replayed as it
+ * is. */
+
+#define KILO_REPLAY_FRAME (1/60.0f)
+
+static const struct {
+    const char *prefix;
+    Uint16 mod;
+} replayMods[] = {
+    {"ctrl+", KMOD_CTRL}, {"shift+", KMOD_SHIFT}, {"alt+", KMOD_ALT}
+};
+
+/* Parse a line of an event script into 'ev'. Returns how many times the
+ * event should be replayed, 0 for lines without an event. */
+static int parseReplayLine(char *line, SDL_Event &ev) {
+    char *p = line;
+    int count = 1;
+
+    if (isdigit(*p)) {
+        count = strtol(p,&p,10);
+        while (*p == ' ') p++;
+    }
+    memset(&ev,0,sizeof(ev));
+    if (!strncmp(p,"key ",4)) {
+        p += 4;
+        ev.type = SDL_KEYDOWN;
+        ev.key.state = SDL_PRESSED;
+        for (auto &m : replayMods) {
+            size_t plen = strlen(m.prefix);
+            if (!strncasecmp(p,m.prefix,plen) && p[plen]) {
+                ev.key.keysym.mod |= m.mod;
+                p += plen;
+            }
+        }
+        ev.key.keysym.sym = SDL_GetKeyFromName(p);
+        if (ev.key.keysym.sym == SDLK_UNKNOWN)
+            throw Exception(string("Unknown key in event script: ") + p);
+    } else if (!strncmp(p,"text ",5)) {
+        p += 5;
+        if (strlen(p) >= sizeof(ev.text.text))
+            throw Exception(string("Text too long in event script: ") + p);
+        ev.type = SDL_TEXTINPUT;
+        strcpy(ev.text.text,p);
+    } else if (!strncmp(p,"click ",6)) {
+        if (sscanf(p+6,"%d %d",&ev.button.x,&ev.button.y) != 2)
+            throw Exception(string("Bad click in event script: ") + p);
+        ev.type = SDL_MOUSEBUTTONDOWN;
+        ev.button.button = SDL_BUTTON_LEFT;
+        ev.button.state = SDL_PRESSED;
+        ev.button.clicks = 1;
+    } else if (!strncmp(p,"wheel ",6)) {
+        ev.type = SDL_MOUSEWHEEL;
+        float steps = strtof(p+6,NULL);
+#if SDL_VERSION_ATLEAST(2,0,18)
+        ev.wheel.preciseY = steps;
+#endif
+        ev.wheel.y = (int) steps;
+    } else if (!strcmp(p,"frame")) {
+        ev.type = SDL_FIRSTEVENT;   /* Nothing: just a frame. */
+    } else if (*p == '\0' || *p == '#') {
+        return 0;
+    } else {
+        throw Exception(string("Bad line in event script: ") + line);
+    }
+    return count;
+}
+
+/* Append the current event to the record file, if it is one that the
+ * replay knows how to generate. */
+void App::record_event(int repeat) {
+    if (event.type == SDL_KEYDOWN) {
+        if (repeat > 1) fprintf(record_fp, "%d ", repeat);
+        fprintf(record_fp, "key ");
+        for (auto &m : replayMods) {
+            if (event.key.keysym.mod & m.mod) fprintf(record_fp, "%s", m.prefix);
+        }
+        fprintf(record_fp, "%s\n", SDL_GetKeyName(event.key.keysym.sym));
+    } else if (event.type == SDL_TEXTINPUT) {
+        fprintf(record_fp, "text %s\n", event.text.text);
+    } else if (event.type == SDL_MOUSEBUTTONDOWN &&
+               event.button.button == SDL_BUTTON_LEFT) {
+        fprintf(record_fp, "click %d %d\n", event.button.x, event.button.y);
+    } else if (event.type == SDL_MOUSEWHEEL) {
+#if SDL_VERSION_ATLEAST(2,0,18)
+        float steps = event.wheel.preciseY;
+#else
+        float steps = event.wheel.y;
+#endif
+        if (event.wheel.direction == SDL_MOUSEWHEEL_FLIPPED) steps = -steps;
+        fprintf(record_fp, "wheel %g\n", steps);
+    }
+}
+
+/* Write "name": {"p50": ..., "p99": ..., "max": ...} for a series of timings
+ * in microseconds. Returns the p99. */
+static double benchWriteStats(FILE *out, const char *name, vector<double> &v) {
+    double p50 = 0, p99 = 0, max = 0;
+    if (!v.empty()) {
+        sort(v.begin(),v.end());
+        p50 = v[(v.size()-1)*50/100];
+        p99 = v[(v.size()-1)*99/100];
+        max = v.back();
+    }
+    fprintf(out, "  \"%s\": {\"p50\": %.1f, \"p99\": %.1f, \"max\": %.1f},\n",
+        name, p50, p99, max);
+    return p99;
+}
+
+/* Write 's' as a JSON string literal. */
+static void benchWriteString(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', out);
+        if ((unsigned char)*s < 0x20) fprintf(out, "\\u%04x", *s);
+        else fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+/* Feed the event script through on_event(), drawing a frame after every
+ * event like run() does, then write a JSON report with per-event handling
+ * time, frame time and input-to-present latency percentiles, plus peak RSS.
+ * Returns the process exit code: 3 if the p99 latency budget is exceeded. */
+int App::replay() {
+    FILE *fp = fopen(replay_path, "r");
+    if (fp == NULL) {
+        throw Exception("Opening event script");
+    }
+
+    vector<double> event_us, frame_us, latency_us;
+    auto start = high_resolution_clock::now();
+    draw();
+    auto first_frame = high_resolution_clock::now();
+    this->first_frame();
+
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t linelen;
+    while(running && (linelen = getline(&line,&linecap,fp)) != -1) {
+        while (linelen && (line[linelen-1] == '\n' || line[linelen-1] == '\r'))
+            line[--linelen] = '\0';
+        int count = parseReplayLine(line, event);
+        while (running && count--) {
+            auto t1 = high_resolution_clock::now();
+            on_event();
+            update(KILO_REPLAY_FRAME);
+            editorBufferPoll();
+            editorGrepPoll();
+            editorViewPoll();
+            editorWordsPoll();
+            editorGutterPoll();
+            editorFilterPoll();
+            auto t2 = high_resolution_clock::now();
+            draw();
+            auto t3 = high_resolution_clock::now();
+            event_us.push_back(duration_cast<nanoseconds>(t2 - t1).count() / 1e3);
+            frame_us.push_back(duration_cast<nanoseconds>(t3 - t2).count() / 1e3);
+            latency_us.push_back(duration_cast<nanoseconds>(t3 - t1).count() / 1e3);
+        }
+    }
+    free(line);
+    fclose(fp);
+    auto end = high_resolution_clock::now();
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    FILE *out = report_path ? fopen(report_path, "w") : stdout;
+    if (out == NULL) {
+        throw Exception("Opening benchmark report");
+    }
+    fprintf(out, "{\n  \"file\": ");
+    benchWriteString(out, filename);
+    fprintf(out, ",\n  \"script\": ");
+    benchWriteString(out, replay_path);
+    fprintf(out, ",\n  \"events\": %zu,\n", event_us.size());
+    fprintf(out, "  \"open_ms\": %.3f,\n", open_ms);
+    fprintf(out, "  \"first_frame_ms\": %.3f,\n",
+        duration_cast<microseconds>(first_frame - start).count() / 1e3);
+    fprintf(out, "  \"startup_ms\": %.3f,\n", startup_ms);
+    benchWriteStats(out, "event_us", event_us);
+    benchWriteStats(out, "frame_us", frame_us);
+    double p99 = benchWriteStats(out, "latency_us", latency_us);
+    fprintf(out, "  \"total_ms\": %.3f,\n",
+        duration_cast<microseconds>(end - start).count() / 1e3);
+    fprintf(out, "  \"peak_rss_kb\": %ld\n}\n", ru.ru_maxrss);
+    if (out != stdout) fclose(out);
+
+    if (budget_p99 > 0 && p99 > budget_p99) {
+        fprintf(stderr, "p99 latency %.1f us exceeds the budget of %.1f us\n",
+            p99, budget_p99);
+        return 3;
+    }
+    if (budget_startup > 0 && startup_ms > budget_startup) {
+        fprintf(stderr, "Startup %.1f ms exceeds the budget of %.1f ms\n",
+            startup_ms, budget_startup);
+        return 3;
+    }
+    return 0;
 }
 
 int main(int argc, char **argv) {
     App app(argc, argv);
     try {
         app.init();
+        if (app.replaying()) {
+            return app.replay();
+        }
         app.run();
     } catch(const exception &e) {
         cout << e.what() << endl;
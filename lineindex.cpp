@@ -0,0 +1,354 @@
+/* Sparse index of the lines of a large file, see lineindex.h. */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "lineindex.h"
+#include "diff.h"
+using namespace std;
+
+/* ============================== Cache file ================================
+ *
+ * The cache of a file holds the header below, the marks, and the states at
+ * the marks if the index has states. It covers the file up to the end of
+ * its last complete line when it was indexed, and is valid as long as the
+ * file has the same size and modification time, or grew, and the bytes at
+ * its start and before the end of the part covered hash the same, so that
+ * files only appended to reuse it. Hashing all of it would mean reading the whole file on every open,
+ * so the files are assumed to be only appended to, like logs: a file
+ * changed in the middle, past the bytes hashed, keeps marks pointing at
+ * the wrong lines. Everything is in the native byte order. */
+
+#define LINEINDEX_MAGIC "KILOIDX1"
+
+struct lineIndexHeader {
+    char magic[8];
+    int64_t every;          /* LINEINDEX_EVERY. */
+    uint64_t statekey;      /* lineIndex.statekey, 0 without states. */
+    int64_t size, mtime;    /* Of the file when indexed. */
+    int64_t scanned;        /* Bytes covered: up to the last newline. */
+    int64_t lines;          /* Newlines in them. */
+    int64_t nmarks;
+    int64_t state;          /* State at 'scanned'. */
+    uint64_t head, tail;    /* Hashes of the samples, see above. */
+};
+
+/* Hash of the LINEINDEX_SAMPLE bytes (or less) ending at 'end' if 'back',
+ * or starting at 0 otherwise. */
+static uint64_t lineIndexSample(int fd, int64_t end, bool back) {
+    vector<char> buf(LINEINDEX_SAMPLE);
+    int64_t len = min<int64_t>(end,buf.size());
+    if (pread(fd,buf.data(),len,back ? end-len : 0) != len) return 0;
+    return diffHash(buf.data(),len);
+}
+
+/* Path of the cache of 'filename', in $XDG_CACHE_HOME/kilo or in
+ * ~/.cache/kilo, named after a hash of its absolute path. Returns an empty
+ * string if there is no place for it. */
+string lineIndexCachePath(const char *filename) {
+    char *real = realpath(filename,NULL);
+    if (!real) return "";
+    uint64_t h = diffHash(real,strlen(real));
+    free(real);
+
+    const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    string dir;
+    if (xdg && *xdg) {
+        dir = xdg;
+    } else if (home && *home) {
+        dir = string(home) + "/.cache";
+        mkdir(dir.c_str(),0755);
+    } else {
+        return "";
+    }
+    dir += "/kilo";
+    mkdir(dir.c_str(),0755);
+
+    char name[32];
+    snprintf(name,sizeof(name),"/%016llx.idx",(unsigned long long) h);
+    return dir + name;
+}
+
+/* Load the cache of the file, if valid, setting where to go on scanning
+ * from. Returns true on success. */
+static bool lineIndexLoad(lineIndex &ix, int64_t *pos, int64_t *lines,
+                          int *state)
+{
+    if (ix.cachepath.empty()) return false;
+    int fd = open(ix.cachepath.c_str(),O_RDONLY|O_CLOEXEC);
+    if (fd == -1) return false;
+    struct stat st;
+    if (fstat(fd,&st) == -1 || st.st_size < (off_t) sizeof(lineIndexHeader)) {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    const lineIndexHeader *h = (const lineIndexHeader*) map;
+    bool states = (bool) ix.linestate;
+    bool ok = !memcmp(h->magic,LINEINDEX_MAGIC,8) &&
+              h->every == LINEINDEX_EVERY &&
+              h->statekey == (states ? ix.statekey : 0) &&
+              h->nmarks > 0 && h->nmarks <= st.st_size &&
+              st.st_size >= (off_t) (sizeof(*h) +
+                                     h->nmarks*(sizeof(int64_t)+states)) &&
+              h->scanned >= 0 && h->scanned <= ix.size &&
+              h->lines >= (h->nmarks-1)*LINEINDEX_EVERY &&
+              (ix.size > h->size ||
+               (ix.size == h->size && ix.mtime == h->mtime));
+    /* The marks of a file rewritten in place, or of a corrupt cache, must
+     * not point out of the part covered. */
+    const int64_t *marks = (const int64_t*) (h+1);
+    for (int64_t j = 0; ok && j < h->nmarks; j++)
+        ok = j ? marks[j] > marks[j-1] && marks[j] <= h->scanned :
+                 marks[j] == 0;
+    /* Even unchanged files are checked to be the same file, with bytes
+     * appended or not: an edit keeping the size and the time is cheap to
+     * catch at the start or the end. */
+    ok = ok && lineIndexSample(ix.fd,h->scanned,false) == h->head &&
+               lineIndexSample(ix.fd,h->scanned,true) == h->tail;
+    if (ok) {
+        ix.marks.assign(marks,marks+h->nmarks);
+        if (states) {
+            const unsigned char *s = (const unsigned char*) (marks+h->nmarks);
+            ix.states.assign(s,s+h->nmarks);
+        }
+        *pos = h->scanned;
+        *lines = h->lines;
+        *state = h->state;
+    }
+    munmap(map,st.st_size);
+    return ok;
+}
+
+/* Save the index, covering the file up to 'scanned', to the cache. Written
+ * to a temporary file renamed over the old cache, so that a reader never
+ * sees half of it. */
+static void lineIndexSave(lineIndex *ix, int64_t scanned, int64_t lines,
+                          int state)
+{
+    vector<int64_t> marks;
+    vector<unsigned char> states;
+    {
+        lock_guard<mutex> guard(ix->lock);
+        marks = ix->marks;
+        states = ix->states;
+    }
+    /* Marks past the end of the last line can't be, but be safe. */
+    while (marks.size() > 1 && marks.back() > scanned) {
+        marks.pop_back();
+        if (!states.empty()) states.pop_back();
+    }
+
+    lineIndexHeader h;
+    memset(&h,0,sizeof(h));
+    memcpy(h.magic,LINEINDEX_MAGIC,8);
+    h.every = LINEINDEX_EVERY;
+    h.statekey = ix->linestate ? ix->statekey : 0;
+    h.size = ix->size;
+    h.mtime = ix->mtime;
+    h.scanned = scanned;
+    h.lines = lines;
+    h.nmarks = marks.size();
+    h.state = state;
+    h.head = lineIndexSample(ix->fd,scanned,false);
+    h.tail = lineIndexSample(ix->fd,scanned,true);
+
+    string tmp = ix->cachepath + "." + to_string(getpid());
+    int fd = open(tmp.c_str(),O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0644);
+    if (fd == -1) return;
+    size_t mlen = marks.size()*sizeof(int64_t);
+    bool ok = write(fd,&h,sizeof(h)) == (ssize_t) sizeof(h) &&
+              write(fd,marks.data(),mlen) == (ssize_t) mlen &&
+              write(fd,states.data(),states.size()) ==
+                  (ssize_t) states.size();
+    close(fd);
+    if (!ok || rename(tmp.c_str(),ix->cachepath.c_str()) == -1)
+        unlink(tmp.c_str());
+}
+
+/* ================================ Scanning ================================ */
+
+/* Pass the line starting at 'p' to the state callback, 'line' holding its
+ * start if it began in a previous buffer. Lines are split like the rows of
+ * a view: a piece is passed when 'maxline' bytes are collected and more
+ * follow. Returns where the next line starts, or NULL if the line does not
+ * end before 'end', keeping what was not passed yet in 'line'. */
+static const char *lineIndexFeed(lineIndex *ix, string &line, const char *p,
+                                 const char *end, int *state)
+{
+    size_t maxline = ix->maxline ? ix->maxline : SIZE_MAX;
+    const char *nl = (const char*) memchr(p,'\n',end-p);
+    const char *stop = nl ? nl : end;
+    while (p < stop) {
+        if (line.size() == maxline) {
+            *state = ix->linestate(line.data(),line.size(),*state);
+            line.clear();
+        }
+        size_t take = min<size_t>(stop-p,maxline-line.size());
+        line.append(p,take);
+        p += take;
+    }
+    if (!nl) return NULL;
+    *state = ix->linestate(line.data(),line.size(),*state);
+    line.clear();
+    return nl+1;
+}
+
+/* Background thread: count the newlines of the file from 'pos', where line
+ * 'lines' starts with state 'state', adding a mark every LINEINDEX_EVERY
+ * lines, and publish the progress after every chunk. */
+static void lineIndexScan(lineIndex *ix, int64_t pos, int64_t lines,
+                          int state)
+{
+    vector<char> buf(LINEINDEX_CHUNK);
+    vector<int64_t> marks;
+    vector<unsigned char> states;
+    string line;    /* Piece of a line split across chunks, for the states. */
+    int64_t linestart = pos;
+    int startstate = state;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(ix->fd,pos,0,POSIX_FADV_SEQUENTIAL);
+#endif
+    while (pos < ix->size && !ix->stop) {
+        ssize_t n = pread(ix->fd,buf.data(),buf.size(),pos);
+        if (n <= 0) {
+            /* Read error, or the file was truncated: index what we saw. */
+            lock_guard<mutex> guard(ix->lock);
+            ix->size = pos;
+            break;
+        }
+        const char *p = buf.data(), *end = p+n, *nl;
+        if (!ix->linestate) {
+            while ((nl = (const char*) memchr(p,'\n',end-p)) != NULL) {
+                p = nl+1;
+                if (++lines % LINEINDEX_EVERY == 0)
+                    marks.push_back(pos + (p-buf.data()));
+            }
+            if (p != buf.data()) linestart = pos + (p-buf.data());
+        } else {
+            while ((nl = lineIndexFeed(ix,line,p,end,&state)) != NULL) {
+                p = nl;
+                linestart = pos + (p-buf.data());
+                startstate = state;
+                if (++lines % LINEINDEX_EVERY == 0) {
+                    marks.push_back(linestart);
+                    states.push_back(state);
+                }
+            }
+        }
+        pos += n;
+
+        lock_guard<mutex> guard(ix->lock);
+        ix->marks.insert(ix->marks.end(),marks.begin(),marks.end());
+        ix->states.insert(ix->states.end(),states.begin(),states.end());
+        ix->scanned = pos;
+        ix->lines = lines;
+        marks.clear();
+        states.clear();
+    }
+
+    /* The cache covers the complete lines: 'lines' is also the number of
+     * newlines before 'linestart'. */
+    if (pos >= ix->size && !ix->stop && !ix->cachepath.empty())
+        lineIndexSave(ix,linestart,lines,startstate);
+}
+
+/* Start indexing 'fd', a file of 'size' bytes modified at 'mtime', in the
+ * background, from the cache if there is a valid one. The file must stay
+ * open until lineIndexStop() is called. */
+void lineIndexStart(lineIndex &ix, int fd, int64_t size, int64_t mtime) {
+    lineIndexStop(ix);
+    ix.fd = fd;
+    ix.size = size;
+    ix.mtime = mtime;
+    ix.marks.assign(1,0);
+    ix.states.assign(ix.linestate ? 1 : 0,0);
+    ix.scanned = 0;
+    ix.lines = 0;
+    ix.stop = false;
+
+    int64_t pos = 0, lines = 0;
+    int state = 0;
+    if (lineIndexLoad(ix,&pos,&lines,&state)) {
+        ix.scanned = pos;
+        ix.lines = lines;
+    }
+    ix.cached = pos;
+    /* Nothing to save if the cache covers the whole file already. */
+    if (pos == size) ix.cachepath.clear();
+    ix.worker = thread(lineIndexScan,&ix,pos,lines,state);
+}
+
+void lineIndexStop(lineIndex &ix) {
+    ix.stop = true;
+    if (ix.worker.joinable()) ix.worker.join();
+}
+
+/* Get how many bytes were scanned, and how many newlines they contain.
+ * Returns true once the whole file is indexed. */
+int lineIndexProgress(lineIndex &ix, int64_t *scanned, int64_t *lines) {
+    lock_guard<mutex> guard(ix.lock);
+    *scanned = ix.scanned;
+    *lines = ix.lines;
+    return ix.scanned >= ix.size;
+}
+
+/* Offset of the closest known mark at or before line 'line' (0-based),
+ * setting '*markline' to the line it starts. */
+int64_t lineIndexFindLine(lineIndex &ix, int64_t line, int64_t *markline) {
+    lock_guard<mutex> guard(ix.lock);
+    int64_t j = min<int64_t>(max<int64_t>(line,0)/LINEINDEX_EVERY,
+                             ix.marks.size()-1);
+    *markline = j*LINEINDEX_EVERY;
+    return ix.marks[j];
+}
+
+/* Offset of the last mark at or before byte 'offset', setting '*markline' to
+ * the line it starts and, if not NULL, '*state' to the state there. Returns
+ * -1 if the scan did not reach 'offset' yet, so that the line there is not
+ * known. */
+int64_t lineIndexFindOffset(lineIndex &ix, int64_t offset, int64_t *markline,
+                            int *state)
+{
+    lock_guard<mutex> guard(ix.lock);
+    if (offset > ix.scanned) return -1;
+    auto it = upper_bound(ix.marks.begin(),ix.marks.end(),offset);
+    int64_t j = it-ix.marks.begin()-1;
+    *markline = j*LINEINDEX_EVERY;
+    if (state) *state = j < (int64_t) ix.states.size() ? ix.states[j] : 0;
+    return ix.marks[j];
+}
+
+/* State at byte 'offset', the start of a row, computing it from the closest
+ * mark before. Returns -1 if the scan did not reach 'offset' yet. */
+int lineIndexStateAt(lineIndex &ix, int64_t offset) {
+    if (!ix.linestate) return 0;
+    int64_t markline;
+    int state;
+    int64_t pos = lineIndexFindOffset(ix,offset,&markline,&state);
+    if (pos == -1) return -1;
+
+    vector<char> buf(min<int64_t>(LINEINDEX_CHUNK,offset-pos));
+    string line;
+    while (pos < offset) {
+        ssize_t n = pread(ix.fd,buf.data(),
+                          min<int64_t>(buf.size(),offset-pos),pos);
+        if (n <= 0) return -1;
+        const char *p = buf.data(), *end = p+n;
+        while ((p = lineIndexFeed(&ix,line,p,end,&state)) != NULL);
+        pos += n;
+    }
+    /* 'offset' is in the middle of a line too long to find its start. */
+    if (!line.empty()) state = ix.linestate(line.data(),line.size(),state);
+    return state;
+}
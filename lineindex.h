@@ -0,0 +1,67 @@
+/* Sparse index of the lines of a large file: the byte offset where one line
+ * every LINEINDEX_EVERY starts, so that any line is found reading at most
+ * LINEINDEX_EVERY lines from the closest mark before it.
+ *
+ * The index is built by a background thread reading the file sequentially
+ * in large chunks. It can be used while it is being built: the marks are
+ * only appended, and the queries tell how far the scan went.
+ *
+ * Optionally, a per line state (the highlighter state at the start of the
+ * line) is computed by a callback for every line and saved at each mark,
+ * and the index is saved to a sidecar cache file once complete. Opening
+ * the same file again loads the cache instead of scanning it, and if the
+ * file was only appended to since, the scan goes on from where the cache
+ * ends. Only the start and the end of the part cached are checked, files
+ * are assumed not to change in the middle. */
+
+#ifndef KILO_LINEINDEX_H
+#define KILO_LINEINDEX_H
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define LINEINDEX_EVERY 1024            /* Lines between two marks. */
+#define LINEINDEX_CHUNK (4<<20)         /* Bytes read at a time. */
+#define LINEINDEX_SAMPLE (64<<10)       /* Bytes hashed to validate a cache. */
+
+/* State at the start of the line after 'line', 'len' bytes without the
+ * newline, given the state at its start. Lines longer than 'maxline' are
+ * passed in pieces of 'maxline' bytes and a last one, as if they were
+ * several lines. Called from the index thread. */
+typedef std::function<int(const char *line, size_t len, int state)>
+    lineStateFn;
+
+struct lineIndex {
+    int fd = -1;
+    int64_t size = 0;               /* Bytes in the file. */
+    int64_t mtime = 0;              /* Modification time, for the cache. */
+    lineStateFn linestate;          /* Set before starting, may be empty. */
+    size_t maxline = 0;             /* Longer lines are passed in pieces. */
+    uint64_t statekey = 0;          /* What the states depend on. */
+    std::string cachepath;          /* Sidecar cache file, or empty. */
+    int64_t cached = 0;             /* Bytes indexed loading the cache. */
+
+    std::mutex lock;                /* Guards the fields below. */
+    std::vector<int64_t> marks;     /* marks[j]: start of line j*EVERY. */
+    std::vector<unsigned char> states;  /* states[j]: state at marks[j]. */
+    int64_t scanned = 0;            /* Bytes scanned so far. */
+    int64_t lines = 0;              /* Newlines in the scanned bytes. */
+    std::atomic<bool> stop{false};
+    std::thread worker;
+};
+
+void lineIndexStart(lineIndex &ix, int fd, int64_t size, int64_t mtime);
+void lineIndexStop(lineIndex &ix);
+int lineIndexProgress(lineIndex &ix, int64_t *scanned, int64_t *lines);
+int64_t lineIndexFindLine(lineIndex &ix, int64_t line, int64_t *markline);
+int64_t lineIndexFindOffset(lineIndex &ix, int64_t offset, int64_t *markline,
+                            int *state);
+int lineIndexStateAt(lineIndex &ix, int64_t offset);
+std::string lineIndexCachePath(const char *filename);
+
+#endif
@@ -0,0 +1,98 @@
+/* Kilo frame profiler, see profile.h. */
+
+#include <stdio.h>
+#include <string.h>
+#include "profile.h"
+using namespace std;
+
+struct profileState P;
+thread_local bool profileMuted;
+
+/* A single zone entry, kept while a trace is being captured. */
+struct profileEvent {
+    int id;
+    uint64_t start, dur;
+};
+
+static vector<profileEvent> trace;
+
+/* Register a zone and return its id. Called once per PROFILE_ZONE() site,
+ * the first time it runs with profiling enabled. */
+int profileRegisterZone(const char *name) {
+    profileZoneInfo z;
+    memset(&z,0,sizeof(z));
+    z.name = name;
+    P.zones.push_back(z);
+    return P.zones.size()-1;
+}
+
+/* Account an entry in zone 'id'. Only the outermost entry of a recursive
+ * zone is summed in the frame costs, but all of them go in the trace. */
+void profileRecord(int id, uint64_t start, uint64_t end, bool outer) {
+    profileZoneInfo &z = P.zones[id];
+    if (outer) {
+        z.frame_ns += end-start;
+        z.frame_calls++;
+    }
+    if (P.tracing) {
+        if (trace.size() < PROFILE_MAX_EVENTS)
+            trace.push_back({id, start, end-start});
+        else
+            P.dropped++;
+    }
+}
+
+/* Close the current frame: record its duration in the history and fold the
+ * per-zone costs into the moving averages shown by the overlay. */
+void profileFrameEnd(void) {
+    uint64_t now = profileNow();
+    if (P.frame_start) {
+        P.frame_ms[P.frame_idx] = (now - P.frame_start) / 1e6;
+        P.frame_idx = (P.frame_idx+1) % PROFILE_HISTORY;
+    }
+    P.frame_start = now;
+
+    for (auto &z : P.zones) {
+        z.avg_ms = z.avg_ms*0.9 + (z.frame_ns / 1e6)*0.1;
+        z.avg_calls = z.avg_calls*0.9 + z.frame_calls*0.1;
+        z.frame_ns = 0;
+        z.frame_calls = 0;
+    }
+}
+
+void profileSetOverlay(bool on) {
+    P.overlay = on;
+    P.enabled = P.overlay || P.tracing;
+}
+
+void profileStartTrace(void) {
+    trace.clear();
+    trace.reserve(PROFILE_MAX_EVENTS/16);
+    P.dropped = 0;
+    P.trace_start = profileNow();
+    P.tracing = true;
+    P.enabled = true;
+}
+
+/* Stop the capture and write it as Chrome trace-event JSON. Returns 0 on
+ * success, 1 on error. */
+int profileStopTrace(const char *path) {
+    P.tracing = false;
+    P.enabled = P.overlay;
+
+    FILE *fp = fopen(path,"w");
+    if (!fp) return 1;
+    fprintf(fp,"{\"traceEvents\":[\n");
+    for (size_t j = 0; j < trace.size(); j++) {
+        profileEvent &ev = trace[j];
+        fprintf(fp,"{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+                   "\"ts\":%.3f,\"dur\":%.3f}%s\n",
+            P.zones[ev.id].name, (ev.start - P.trace_start) / 1e3,
+            ev.dur / 1e3, j+1 < trace.size() ? "," : "");
+    }
+    fprintf(fp,"],\"otherData\":{\"dropped\":%llu}}\n",
+        (unsigned long long) P.dropped);
+    trace.clear();
+    trace.shrink_to_fit();
+    return fclose(fp) == 0 ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+/* Kilo frame profiler: scoped timers around the hot paths.
+ *
+ * Put PROFILE_ZONE("name") at the top of a block to time it. Timing only
+ * happens while the on-screen overlay is visible or a trace is being
+ * captured; otherwise a zone costs a load and a branch. Zones are timed
+ * in the main thread only: code that also runs in other threads (like
+ * files loaded in the background) sets profileMuted there.
+ *
+ * Per-zone costs are summed for every frame and smoothed across frames for
+ * the overlay, while a trace keeps every single zone entry and can be
+ * written as a Chrome trace-event JSON file (chrome://tracing, Perfetto).
+ * Building with -DKILO_NO_PROFILE compiles the zones out entirely. */
+
+#ifndef KILO_PROFILE_H
+#define KILO_PROFILE_H
+
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+
+#define PROFILE_HISTORY 120     /* Frame times kept for the overlay. */
+#define PROFILE_MAX_EVENTS (1<<20) /* Trace events kept in a capture. */
+
+struct profileZoneInfo {
+    const char *name;
+    int depth;              /* Nesting of the zone, only the outer is summed. */
+    uint64_t frame_ns;      /* Time spent in the zone in the current frame. */
+    int frame_calls;        /* Entries in the zone in the current frame. */
+    double avg_ms;          /* Moving average of the time per frame. */
+    double avg_calls;       /* Moving average of the entries per frame. */
+};
+
+struct profileState {
+    bool enabled;           /* Overlay or trace active: zones are timed. */
+    bool overlay;           /* On-screen overlay visible. */
+    bool tracing;           /* Capturing trace events. */
+    std::vector<profileZoneInfo> zones;
+    float frame_ms[PROFILE_HISTORY];    /* Ring buffer of frame times. */
+    int frame_idx;          /* Next slot in frame_ms. */
+    uint64_t frame_start;   /* Start time of the current frame. */
+    uint64_t trace_start;   /* Start time of the capture. */
+    uint64_t dropped;       /* Events not recorded because the trace was full. */
+};
+
+extern struct profileState P;
+extern thread_local bool profileMuted;  /* Zones are not timed here. */
+
+static inline uint64_t profileNow(void) {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(
+        steady_clock::now().time_since_epoch()).count();
+}
+
+int profileRegisterZone(const char *name);
+void profileRecord(int id, uint64_t start, uint64_t end, bool outer);
+void profileFrameEnd(void);
+void profileSetOverlay(bool on);
+void profileStartTrace(void);
+int profileStopTrace(const char *path);
+
+/* Times the enclosing scope as zone 'zid' when profiling is enabled,
+ * registering the zone the first time. */
+struct profileScope {
+    int id;
+    uint64_t start;
+    profileScope(int &zid, const char *name) {
+        if (profileMuted || !P.enabled) {
+            id = -1;
+            return;
+        }
+        if (zid == -1) zid = profileRegisterZone(name);
+        id = zid;
+        P.zones[id].depth++;
+        start = profileNow();
+    }
+    ~profileScope() {
+        if (id == -1) return;
+        bool outer = --P.zones[id].depth == 0;
+        profileRecord(id, start, profileNow(), outer);
+    }
+};
+
+#define PROFILE_CAT2(a,b) a##b
+#define PROFILE_CAT(a,b) PROFILE_CAT2(a,b)
+#ifndef KILO_NO_PROFILE
+#define PROFILE_ZONE(name) \
+    static int PROFILE_CAT(profile_id_,__LINE__) = -1; \
+    profileScope PROFILE_CAT(profile_scope_,__LINE__)( \
+        PROFILE_CAT(profile_id_,__LINE__),name)
+#else
+#define PROFILE_ZONE(name) do {} while(0)
+#endif
+
+#endif
@@ -0,0 +1,135 @@
+/* UTF-8 decoding and display width of code points.
+ *
+ * The width tables follow the spirit of Markus Kuhn's wcwidth(): combining
+ * marks and format characters take no column, East Asian wide and
+ * fullwidth characters (and most emoji) take two, everything else one. They
+ * cover the commonly used ranges rather than every Unicode version detail,
+ * and do not depend on the C library locale. */
+
+#include "utf8.h"
+
+struct utf8Range {
+    uint32_t first, last;
+};
+
+static const struct utf8Range zeroWidth[] = {
+    {0x0300,0x036F}, {0x0483,0x0489}, {0x0591,0x05BD}, {0x05BF,0x05BF},
+    {0x05C1,0x05C2}, {0x05C4,0x05C5}, {0x05C7,0x05C7}, {0x0610,0x061A},
+    {0x064B,0x065F}, {0x0670,0x0670}, {0x06D6,0x06DC}, {0x06DF,0x06E4},
+    {0x06E7,0x06E8}, {0x06EA,0x06ED}, {0x0711,0x0711}, {0x0730,0x074A},
+    {0x07A6,0x07B0}, {0x0900,0x0902}, {0x093C,0x093C}, {0x0941,0x0948},
+    {0x094D,0x094D}, {0x0951,0x0957}, {0x0E31,0x0E31}, {0x0E34,0x0E3A},
+    {0x0E47,0x0E4E}, {0x1AB0,0x1AFF}, {0x1DC0,0x1DFF}, {0x200B,0x200F},
+    {0x202A,0x202E}, {0x2060,0x2064}, {0x20D0,0x20FF}, {0xFE00,0xFE0F},
+    {0xFE20,0xFE2F}, {0xFEFF,0xFEFF}, {0xE0100,0xE01EF}
+};
+
+static const struct utf8Range doubleWidth[] = {
+    {0x1100,0x115F}, {0x231A,0x231B}, {0x2329,0x232A}, {0x23E9,0x23EC},
+    {0x23F0,0x23F0}, {0x23F3,0x23F3}, {0x25FD,0x25FE}, {0x2614,0x2615},
+    {0x2648,0x2653}, {0x267F,0x267F}, {0x2693,0x2693}, {0x26A1,0x26A1},
+    {0x26AA,0x26AB}, {0x26BD,0x26BE}, {0x26C4,0x26C5}, {0x26CE,0x26CE},
+    {0x26D4,0x26D4}, {0x26EA,0x26EA}, {0x26F2,0x26F3}, {0x26F5,0x26F5},
+    {0x26FA,0x26FA}, {0x26FD,0x26FD}, {0x2705,0x2705}, {0x270A,0x270B},
+    {0x2728,0x2728}, {0x274C,0x274C}, {0x274E,0x274E}, {0x2753,0x2755},
+    {0x2757,0x2757}, {0x2795,0x2797}, {0x27B0,0x27B0}, {0x27BF,0x27BF},
+    {0x2B1B,0x2B1C}, {0x2B50,0x2B50}, {0x2B55,0x2B55}, {0x2E80,0x303E},
+    {0x3041,0x33FF}, {0x3400,0x4DBF}, {0x4E00,0x9FFF}, {0xA000,0xA4CF},
+    {0xA960,0xA97F}, {0xAC00,0xD7A3}, {0xF900,0xFAFF}, {0xFE10,0xFE19},
+    {0xFE30,0xFE6F}, {0xFF00,0xFF60}, {0xFFE0,0xFFE6}, {0x16FE0,0x16FE4},
+    {0x17000,0x18AFF}, {0x1B000,0x1B2FF}, {0x1F004,0x1F004},
+    {0x1F0CF,0x1F0CF}, {0x1F18E,0x1F18E}, {0x1F191,0x1F19A},
+    {0x1F200,0x1F251}, {0x1F300,0x1F64F}, {0x1F680,0x1F6FF},
+    {0x1F900,0x1F9FF}, {0x1FA70,0x1FAFF}, {0x20000,0x2FFFD},
+    {0x30000,0x3FFFD}
+};
+
+#define RANGES(r) (sizeof(r)/sizeof(r[0]))
+
+/* Binary search 'cp' in a sorted table of ranges. */
+static int utf8InTable(uint32_t cp, const struct utf8Range *table, int n) {
+    int lo = 0, hi = n-1;
+    if (cp < table[0].first || cp > table[n-1].last) return 0;
+    while (lo <= hi) {
+        int mid = (lo+hi)/2;
+        if (cp > table[mid].last) lo = mid+1;
+        else if (cp < table[mid].first) hi = mid-1;
+        else return 1;
+    }
+    return 0;
+}
+
+/* Decode the UTF-8 sequence at 's', of at most 'len' bytes, into '*cp'.
+ * Returns the length of the sequence, or 0 if it is not valid UTF-8
+ * (truncated, overlong, surrogate or out of range). */
+int utf8Decode(const char *s, int len, uint32_t *cp) {
+    const unsigned char *p = (const unsigned char*) s;
+    int n;
+    uint32_t c;
+
+    if (len <= 0) return 0;
+    if (p[0] < 0x80) {
+        *cp = p[0];
+        return 1;
+    } else if ((p[0] & 0xE0) == 0xC0) {
+        n = 2; c = p[0] & 0x1F;
+    } else if ((p[0] & 0xF0) == 0xE0) {
+        n = 3; c = p[0] & 0x0F;
+    } else if ((p[0] & 0xF8) == 0xF0) {
+        n = 4; c = p[0] & 0x07;
+    } else {
+        return 0;
+    }
+    if (n > len) return 0;
+    for (int j = 1; j < n; j++) {
+        if ((p[j] & 0xC0) != 0x80) return 0;
+        c = (c << 6) | (p[j] & 0x3F);
+    }
+    if ((n == 2 && c < 0x80) || (n == 3 && c < 0x800) ||
+        (n == 4 && c < 0x10000) || c > 0x10FFFF ||
+        (c >= 0xD800 && c <= 0xDFFF)) return 0;
+    *cp = c;
+    return n;
+}
+
+/* Number of terminal cells taken by 'cp': 0, 1 or 2. */
+int utf8CharWidth(uint32_t cp) {
+    if (cp < 0x300) return 1;
+    if (utf8InTable(cp,zeroWidth,RANGES(zeroWidth))) return 0;
+    if (utf8InTable(cp,doubleWidth,RANGES(doubleWidth))) return 2;
+    return 1;
+}
+
+/* Offset of the start of the char before offset 'at' in 's'. */
+int utf8Prev(const char *s, int at) {
+    if (at <= 0) return 0;
+    int j = at-1;
+    while (j > 0 && at-j < 4 && (s[j] & 0xC0) == 0x80) j--;
+    uint32_t cp;
+    if (utf8Decode(s+j,at-j,&cp) == at-j) return j;
+    return at-1; /* Invalid sequence: step back a single byte. */
+}
+
+/* Offset of the start of the char after offset 'at' in 's', 'len' bytes
+ * long. Invalid bytes count as a single char. */
+int utf8Next(const char *s, int len, int at) {
+    if (at >= len) return len;
+    uint32_t cp;
+    int n = utf8Decode(s+at,len-at,&cp);
+    return at + (n ? n : 1);
+}
+
+/* Length in bytes of the longest prefix of 's', 'len' bytes long, that fits
+ * in 'cols' display columns. */
+int utf8Clip(const char *s, int len, int cols) {
+    int at = 0;
+    while (at < len) {
+        uint32_t cp;
+        int n = utf8Decode(s+at,len-at,&cp);
+        int w = n ? utf8CharWidth(cp) : 1;
+        if (w > cols) break;
+        cols -= w;
+        at += n ? n : 1;
+    }
+    return at;
+}
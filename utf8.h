@@ -0,0 +1,14 @@
+/* UTF-8 decoding and display width of code points. */
+
+#ifndef KILO_UTF8_H
+#define KILO_UTF8_H
+
+#include <stdint.h>
+
+int utf8Decode(const char *s, int len, uint32_t *cp);
+int utf8CharWidth(uint32_t cp);
+int utf8Prev(const char *s, int at);
+int utf8Next(const char *s, int len, int at);
+int utf8Clip(const char *s, int len, int cols);
+
+#endif